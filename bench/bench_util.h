@@ -0,0 +1,98 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <compressed_matrix.h>
+#include <cholesky.h>
+#include <coo_builder.h>
+#include <eigen.h>
+#include <fixed_matrix.h>
+#include <full_matrix.h>
+#include <iterative.h>
+#include <lu.h>
+#include <matrix_file.h>
+#include <matrix_market.h>
+#include <symmetric_matrix.h>
+#include <tiled_matrix.h>
+
+// Shared inputs and counters for the scaling benchmarks. Every benchmark
+// reports through state.counters, which also end up in the JSON output:
+//   flop/s   arithmetic operations of the textbook algorithm
+//   bytes/s  smallest amount of memory the operation must read and write
+//   nnz/s    stored entries processed, for sparse operations
+namespace bench {
+
+    // square sizes 16, 64, 256, 1024 and 4096
+    inline void sizes(benchmark::internal::Benchmark* b) {
+        b->RangeMultiplier(4)->Range(16, 4096);
+    }
+
+    // sizes by densities, in entries per ten thousand (0.1%, 1% and 10%)
+    inline void sparse_sizes(benchmark::internal::Benchmark* b) {
+        b->ArgsProduct({benchmark::CreateRange(16, 4096, 4), {10, 100, 1000}})->ArgNames({"n", "density"});
+    }
+
+    inline double density(const benchmark::State& state) {
+        return static_cast<double>(state.range(1)) / 10000;
+    }
+
+    // values in [1, 9], so integer products of the largest sizes do not overflow
+    template < typename T >
+    full_matrix<T> dense(size_t h, size_t w, unsigned seed = 1) {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<int> value(1, 9);
+        full_matrix<T> m (h, w);
+        for (size_t i = 0; i < h; ++i) {
+            for (size_t j = 0; j < w; ++j) {
+                m[i][j] = static_cast<T>(value(gen));
+            }
+        }
+        return m;
+    }
+
+    // about density * n * n entries at uniformly random positions
+    template < typename T >
+    csr_matrix<T> sparse(size_t n, double density, unsigned seed = 1) {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<size_t> position(0, n - 1);
+        std::uniform_int_distribution<int> value(1, 9);
+        size_t entries = std::max<size_t>(1, static_cast<size_t>(density * n * n));
+        coo_builder<T> builder (n, n);
+        builder.reserve(entries);
+        for (size_t k = 0; k < entries; ++k) {
+            builder.insert(position(gen), position(gen), static_cast<T>(value(gen)));
+        }
+        return builder.build();
+    }
+
+    template < typename T >
+    vector<T> dense_vector(size_t n, unsigned seed = 1) {
+        std::mt19937 gen(seed);
+        std::uniform_int_distribution<int> value(1, 9);
+        vector<T> v (n);
+        for (T& x : v) {
+            x = static_cast<T>(value(gen));
+        }
+        return v;
+    }
+
+    // per-iteration amounts, reported as rates
+    inline void count(benchmark::State& state, double flops, double bytes, double nnz = 0) {
+        using benchmark::Counter;
+        if(flops > 0) {
+            state.counters["flop/s"] = Counter(flops, Counter::kIsIterationInvariantRate);
+        }
+        state.counters["bytes/s"] = Counter(bytes, Counter::kIsIterationInvariantRate, Counter::kIs1024);
+        if(nnz > 0) {
+            state.counters["nnz/s"] = Counter(nnz, Counter::kIsIterationInvariantRate);
+        }
+    }
+
+    // bytes of a CSR matrix's arrays
+    template < typename T >
+    double csr_bytes(const csr_matrix<T>& m) {
+        return static_cast<double>(m.nnz() * (sizeof(T) + sizeof(size_t)) + (m.height() + 1) * sizeof(size_t));
+    }
+}
@@ -0,0 +1,333 @@
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <cstdio>
+#include <string>
+#include "bench_util.h"
+
+// Dense operations on n x n matrices of int, float and double.
+
+template < typename T >
+static void BM_DenseCreation(benchmark::State& state) {
+    size_t n = state.range(0);
+    for (auto _ : state) {
+        full_matrix<T> m (n, n);
+        benchmark::DoNotOptimize(m.data());
+    }
+    bench::count(state, 0, double(n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_DenseSum(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n, 1);
+    full_matrix<T> b = bench::dense<T>(n, n, 2);
+    for (auto _ : state) {
+        full_matrix<T> c = a + b;
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, double(n * n), double(3 * n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_DenseScale(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n);
+    for (auto _ : state) {
+        full_matrix<T> c = a * static_cast<T>(3);
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, double(n * n), double(2 * n * n * sizeof(T)));
+}
+
+// a nested expression, evaluated in one fused pass
+template < typename T >
+static void BM_DenseExpression(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n, 1);
+    full_matrix<T> b = bench::dense<T>(n, n, 2);
+    full_matrix<T> c = bench::dense<T>(n, n, 3);
+    for (auto _ : state) {
+        full_matrix<T> d = a + b * static_cast<T>(2) - c;
+        benchmark::DoNotOptimize(d.data());
+    }
+    bench::count(state, double(3 * n * n), double(4 * n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_DenseTranspose(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n);
+    for (auto _ : state) {
+        full_matrix<T> t = a.transpose();
+        benchmark::DoNotOptimize(t.data());
+    }
+    bench::count(state, 0, double(2 * n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_DenseProduct(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n, 1);
+    full_matrix<T> b = bench::dense<T>(n, n, 2);
+    for (auto _ : state) {
+        full_matrix<T> c = a.dotProduct(b);
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, 2.0 * n * n * n, double(3 * n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_DenseVectorProduct(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n);
+    vector<T> x = bench::dense_vector<T>(n);
+    for (auto _ : state) {
+        vector<T> y = a.dotProduct(x);
+        benchmark::DoNotOptimize(y.data());
+    }
+    bench::count(state, 2.0 * n * n, double((n * n + 2 * n) * sizeof(T)));
+}
+
+template < typename T >
+static void BM_DenseNorm(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(a.twoNorm());
+    }
+    bench::count(state, 2.0 * n * n, double(n * n * sizeof(T)));
+}
+
+// a symmetric matrix, so the whole lower triangle is compared
+template < typename T >
+static void BM_DenseIsSymmetric(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::dense<T>(n, n);
+    full_matrix<T> sym = a + a.transpose();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sym.isSymmetric());
+    }
+    bench::count(state, 0, double(n * n * sizeof(T)));
+}
+
+// geometry-sized products, inline fixed storage against the dynamic matrix
+template < typename T, size_t N >
+static void BM_FixedProduct(benchmark::State& state) {
+    fixed_matrix<T, N, N> a = bench::dense<T>(N, N, 1);
+    fixed_matrix<T, N, N> b = bench::dense<T>(N, N, 2);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(a);
+        fixed_matrix<T, N, N> c = a.dotProduct(b);
+        benchmark::DoNotOptimize(c);
+    }
+    bench::count(state, 2.0 * N * N * N, double(3 * N * N * sizeof(T)));
+}
+
+template < typename T, size_t N >
+static void BM_SmallDenseProduct(benchmark::State& state) {
+    full_matrix<T> a = bench::dense<T>(N, N, 1);
+    full_matrix<T> b = bench::dense<T>(N, N, 2);
+    for (auto _ : state) {
+        full_matrix<T> c = a.dotProduct(b);
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, 2.0 * N * N * N, double(3 * N * N * sizeof(T)));
+}
+
+// C += A * B over 64 x 64 tiles, updating views in place against copying
+// every tile out and the result back
+template < typename T >
+static void BM_TiledProduct(benchmark::State& state) {
+    size_t n = state.range(0);
+    const size_t tile = 64;
+    full_matrix<T> a = bench::dense<T>(n, n, 1);
+    full_matrix<T> b = bench::dense<T>(n, n, 2);
+    full_matrix<T> c (n, n);
+    for (auto _ : state) {
+        for (size_t i = 0; i < n; i += tile) {
+            for (size_t j = 0; j < n; j += tile) {
+                for (size_t k = 0; k < n; k += tile) {
+                    c.block(i, j, tile, tile) += a.block(i, k, tile, tile).dotProduct(b.block(k, j, tile, tile));
+                }
+            }
+        }
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, 2.0 * n * n * n, double(3 * n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_TiledProductCopies(benchmark::State& state) {
+    size_t n = state.range(0);
+    const size_t tile = 64;
+    full_matrix<T> a = bench::dense<T>(n, n, 1);
+    full_matrix<T> b = bench::dense<T>(n, n, 2);
+    full_matrix<T> c (n, n);
+    for (auto _ : state) {
+        for (size_t i = 0; i < n; i += tile) {
+            for (size_t j = 0; j < n; j += tile) {
+                full_matrix<T> sum = c.block(i, j, tile, tile);
+                for (size_t k = 0; k < n; k += tile) {
+                    full_matrix<T> ta = a.block(i, k, tile, tile);
+                    full_matrix<T> tb = b.block(k, j, tile, tile);
+                    full_matrix<T> product = ta.dotProduct(tb);
+                    sum += product;
+                }
+                c.block(i, j, tile, tile) = sum;
+            }
+        }
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, 2.0 * n * n * n, double(3 * n * n * sizeof(T)));
+}
+
+// reading a saved matrix into memory against mapping it, which defers the
+// reads to the first access of each page
+template < typename T >
+static void BM_BinaryLoad(benchmark::State& state) {
+    size_t n = state.range(0);
+    const std::string path = "bench_binary_load.bin";
+    binary::save(bench::dense<T>(n, n), path);
+    for (auto _ : state) {
+        full_matrix<T> m = binary::load<T>(path);
+        benchmark::DoNotOptimize(m.data());
+    }
+    std::remove(path.c_str());
+    bench::count(state, 0, double(n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_BinaryMap(benchmark::State& state) {
+    size_t n = state.range(0);
+    const std::string path = "bench_binary_map.bin";
+    binary::save(bench::dense<T>(n, n), path);
+    for (auto _ : state) {
+        mapped_matrix<T> m (path);
+        benchmark::DoNotOptimize(m.data());
+    }
+    std::remove(path.c_str());
+    bench::count(state, 0, double(n * n * sizeof(T)));
+}
+
+// product of matrices kept on disk in 256 x 256 tiles, with caches of
+// eight tiles each, against the same product in memory (BM_DenseProduct)
+template < typename T >
+static void BM_OutOfCoreProduct(benchmark::State& state) {
+    size_t n = state.range(0);
+    const size_t tile = 256;
+    const size_t budget = 8 * tile * tile * sizeof(T);
+    tiled_matrix<T> a (n, n, tile, budget);
+    tiled_matrix<T> b (n, n, tile, budget);
+    tiled_matrix<T> c (n, n, tile, budget);
+    a = bench::dense<T>(n, n, 1);
+    b = bench::dense<T>(n, n, 2);
+    for (auto _ : state) {
+        c = a.dotProduct(b);
+        c.flush();
+    }
+    bench::count(state, 2.0 * n * n * n, double(3 * n * n * sizeof(T)));
+}
+
+// LU factorization with panels of the given width; a width of n is the
+// unblocked algorithm, whose updates never reach the blocked product
+template < typename T >
+static void BM_LU(benchmark::State& state) {
+    size_t n = state.range(0);
+    size_t block = state.range(1) == 0 ? n : state.range(1);
+    full_matrix<T> a = bench::dense<T>(n, n, 1);
+    for (auto _ : state) {
+        lu_factorization<T> f (a, block);
+        benchmark::DoNotOptimize(f.factors().data());
+    }
+    bench::count(state, 2.0 * n * n * n / 3, double(2 * n * n * sizeof(T)));
+}
+
+// solving 64 right-hand sides as one batch
+template < typename T >
+static void BM_LUSolve(benchmark::State& state) {
+    size_t n = state.range(0);
+    lu_factorization<T> f (bench::dense<T>(n, n, 1));
+    full_matrix<T> b = bench::dense<T>(n, 64, 2);
+    for (auto _ : state) {
+        full_matrix<T> x = f.solve(b);
+        benchmark::DoNotOptimize(x.data());
+    }
+    bench::count(state, 2.0 * n * n * 64, double((n * n + 2 * n * 64) * sizeof(T)));
+}
+
+// Cholesky of a positive definite matrix, against BM_LU of the same size
+template < typename T >
+static void BM_Cholesky(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> b = bench::dense<T>(n, n, 1);
+    symmetric_matrix<T> a (b.dotProduct(b.transpose()) + full_matrix<T>::identity(n) * T(n));
+    for (auto _ : state) {
+        symmetric_factorization<T> f (a);
+        benchmark::DoNotOptimize(&f);
+    }
+    bench::count(state, 1.0 * n * n * n / 3, double((n * n / 2 + n * n) * sizeof(T)));
+}
+
+BENCHMARK_TEMPLATE(BM_DenseCreation, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseCreation, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseCreation, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseSum, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseSum, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseSum, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseScale, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseScale, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseScale, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseExpression, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseExpression, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseExpression, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseTranspose, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseTranspose, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseTranspose, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseProduct, int)->Apply(bench::sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_DenseProduct, float)->Apply(bench::sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_DenseProduct, double)->Apply(bench::sizes)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_DenseVectorProduct, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseVectorProduct, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseVectorProduct, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseNorm, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseNorm, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseNorm, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_DenseIsSymmetric, int)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseIsSymmetric, float)->Apply(bench::sizes);
+BENCHMARK_TEMPLATE(BM_DenseIsSymmetric, double)->Apply(bench::sizes);
+
+BENCHMARK_TEMPLATE(BM_TiledProduct, float)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_TiledProduct, double)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_TiledProductCopies, float)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_TiledProductCopies, double)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_BinaryLoad, double)->Arg(1024)->Arg(4096)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_BinaryMap, double)->Arg(1024)->Arg(4096)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_OutOfCoreProduct, double)->Arg(1024)->Arg(2048)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_LU, double)->ArgsProduct({{256, 1024}, {0, 64}})->ArgNames({"n", "block"})->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_LUSolve, double)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_Cholesky, double)->Arg(256)->Arg(1024)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_FixedProduct, float, 3);
+BENCHMARK_TEMPLATE(BM_FixedProduct, float, 4);
+BENCHMARK_TEMPLATE(BM_FixedProduct, double, 3);
+BENCHMARK_TEMPLATE(BM_FixedProduct, double, 4);
+
+BENCHMARK_TEMPLATE(BM_SmallDenseProduct, float, 3);
+BENCHMARK_TEMPLATE(BM_SmallDenseProduct, float, 4);
+BENCHMARK_TEMPLATE(BM_SmallDenseProduct, double, 3);
+BENCHMARK_TEMPLATE(BM_SmallDenseProduct, double, 4);
+
+#pragma clang diagnostic pop
@@ -3,6 +3,7 @@
 
 #include <benchmark/benchmark.h>
 #include <full_matrix.h>
+#include <string>
 
 
 static void BM_MatrixCreation(benchmark::State& state) {
@@ -79,6 +80,18 @@ static void BM_MatrixTranspose(benchmark::State& state) {
 }
 BENCHMARK(BM_MatrixTranspose);
 
-BENCHMARK_MAIN();
+// records the settings results depend on next to the machine description
+int main(int argc, char** argv) {
+    static const char* const isa_names[] = {"scalar", "sse2", "avx2", "avx512"};
+    benchmark::AddCustomContext("simd_isa", isa_names[static_cast<int>(simd::active_isa())]);
+    benchmark::AddCustomContext("threads", std::to_string(parallel::concurrency()));
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
 
 #pragma clang diagnostic pop
\ No newline at end of file
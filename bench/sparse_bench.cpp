@@ -0,0 +1,281 @@
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+#include <sstream>
+#include <string>
+#include "bench_util.h"
+
+// Sparse operations on n x n CSR matrices of int, float and double at
+// several densities. The *AsDense benchmarks run the same operation on the
+// same matrix stored dense, to find where the sparse formats stop paying off.
+
+template < typename T >
+static void BM_SparseAssembly(benchmark::State& state) {
+    size_t n = state.range(0);
+    size_t entries = std::max<size_t>(1, static_cast<size_t>(bench::density(state) * n * n));
+    std::mt19937 gen(1);
+    std::uniform_int_distribution<size_t> position(0, n - 1);
+    std::vector<std::pair<size_t, size_t>> positions (entries);
+    for (auto& p : positions) {
+        p = std::make_pair(position(gen), position(gen));
+    }
+    for (auto _ : state) {
+        coo_builder<T> builder (n, n);
+        builder.reserve(entries);
+        for (const auto& p : positions) {
+            builder.insert(p.first, p.second, static_cast<T>(1));
+        }
+        csr_matrix<T> m = builder.build();
+        benchmark::DoNotOptimize(m.values().data());
+    }
+    bench::count(state, 0, double(entries * (2 * sizeof(size_t) + sizeof(T))), double(entries));
+}
+
+template < typename T >
+static void BM_SparseSum(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state), 1);
+    csr_matrix<T> b = bench::sparse<T>(state.range(0), bench::density(state), 2);
+    csr_matrix<T> c = a + b;
+    for (auto _ : state) {
+        csr_matrix<T> sum = a + b;
+        benchmark::DoNotOptimize(sum.values().data());
+    }
+    bench::count(state, double(a.nnz() + b.nnz()), bench::csr_bytes(a) + bench::csr_bytes(b) + bench::csr_bytes(c),
+                 double(a.nnz() + b.nnz()));
+}
+
+template < typename T >
+static void BM_SparseTranspose(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state));
+    for (auto _ : state) {
+        csr_matrix<T> t = a.transpose();
+        benchmark::DoNotOptimize(t.values().data());
+    }
+    bench::count(state, 0, 2 * bench::csr_bytes(a), double(a.nnz()));
+}
+
+template < typename T >
+static void BM_SparseVectorProduct(benchmark::State& state) {
+    size_t n = state.range(0);
+    csr_matrix<T> a = bench::sparse<T>(n, bench::density(state));
+    vector<T> x = bench::dense_vector<T>(n);
+    for (auto _ : state) {
+        vector<T> y = a.dotProduct(x);
+        benchmark::DoNotOptimize(y.data());
+    }
+    bench::count(state, 2.0 * a.nnz(), bench::csr_bytes(a) + double(2 * n * sizeof(T)), double(a.nnz()));
+}
+
+template < typename T >
+static void BM_SparseVectorProductAsDense(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::sparse<T>(n, bench::density(state));
+    vector<T> x = bench::dense_vector<T>(n);
+    for (auto _ : state) {
+        vector<T> y = a.dotProduct(x);
+        benchmark::DoNotOptimize(y.data());
+    }
+    bench::count(state, 2.0 * n * n, double((n * n + 2 * n) * sizeof(T)));
+}
+
+// times a dense n x 32 block of vectors
+template < typename T >
+static void BM_SparseDenseProduct(benchmark::State& state) {
+    size_t n = state.range(0);
+    const size_t k = 32;
+    csr_matrix<T> a = bench::sparse<T>(n, bench::density(state));
+    full_matrix<T> b = bench::dense<T>(n, k);
+    for (auto _ : state) {
+        full_matrix<T> c = a.dotProduct(b);
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, 2.0 * a.nnz() * k, bench::csr_bytes(a) + double(2 * n * k * sizeof(T)), double(a.nnz()));
+}
+
+template < typename T >
+static void BM_SparseProduct(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state));
+    // every stored a(i, k) meets every stored entry of row k
+    double flops = 0;
+    for (size_t k = 0; k < a.indices().size(); ++k) {
+        size_t row = a.indices()[k];
+        flops += 2.0 * (a.offsets()[row + 1] - a.offsets()[row]);
+    }
+    csr_matrix<T> c = a.dotProduct(a);
+    for (auto _ : state) {
+        csr_matrix<T> product = a.dotProduct(a);
+        benchmark::DoNotOptimize(product.values().data());
+    }
+    bench::count(state, flops, 2 * bench::csr_bytes(a) + bench::csr_bytes(c), double(c.nnz()));
+}
+
+template < typename T >
+static void BM_SparseProductAsDense(benchmark::State& state) {
+    size_t n = state.range(0);
+    full_matrix<T> a = bench::sparse<T>(n, bench::density(state));
+    for (auto _ : state) {
+        full_matrix<T> c = a.dotProduct(a);
+        benchmark::DoNotOptimize(c.data());
+    }
+    bench::count(state, 2.0 * n * n * n, double(3 * n * n * sizeof(T)));
+}
+
+template < typename T >
+static void BM_SparseNorm(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(a.twoNorm());
+    }
+    bench::count(state, 2.0 * a.nnz(), bench::csr_bytes(a), double(a.nnz()));
+}
+
+template < typename T >
+static void BM_SparseIsSymmetric(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state));
+    csr_matrix<T> sym = a + a.transpose();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sym.isSymmetric());
+    }
+    bench::count(state, 0, bench::csr_bytes(sym), double(sym.nnz()));
+}
+
+// Matrix Market text held in memory, so that only parsing and formatting are timed
+template < typename T >
+static void BM_MatrixMarketRead(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state));
+    std::stringstream text;
+    matrix_market::write(text, a);
+    const std::string contents = text.str();
+    for (auto _ : state) {
+        std::istringstream in(contents);
+        csr_matrix<T> m = matrix_market::read<T>(in);
+        benchmark::DoNotOptimize(m.values().data());
+    }
+    bench::count(state, 0, double(contents.size()) + bench::csr_bytes(a), double(a.nnz()));
+}
+
+template < typename T >
+static void BM_MatrixMarketWrite(benchmark::State& state) {
+    csr_matrix<T> a = bench::sparse<T>(state.range(0), bench::density(state));
+    size_t bytes = 0;
+    for (auto _ : state) {
+        std::ostringstream out;
+        matrix_market::write(out, a);
+        bytes = out.tellp();
+        benchmark::DoNotOptimize(bytes);
+    }
+    bench::count(state, 0, double(bytes) + bench::csr_bytes(a), double(a.nnz()));
+}
+
+// the 5-point Laplacian on a k x k grid
+template < typename T >
+static csr_matrix<T> laplacian(size_t k) {
+    coo_builder<T> builder (k * k, k * k);
+    builder.reserve(5 * k * k);
+    for (size_t i = 0; i < k; ++i) {
+        for (size_t j = 0; j < k; ++j) {
+            size_t row = i * k + j;
+            builder.insert(row, row, 4);
+            if(i > 0) builder.insert(row, row - k, -1);
+            if(i + 1 < k) builder.insert(row, row + k, -1);
+            if(j > 0) builder.insert(row, row - 1, -1);
+            if(j + 1 < k) builder.insert(row, row + 1, -1);
+        }
+    }
+    return builder.build();
+}
+
+// 100 iterations of CG on the Laplacian of a k x k grid, without a
+// preconditioner (0), with Jacobi (1) or with IC(0) (2)
+template < typename T >
+static void BM_ConjugateGradient(benchmark::State& state) {
+    csr_matrix<T> a = laplacian<T>(state.range(0));
+    const size_t n = a.height();
+    vector<T> b (n, T{1});
+    iterative::options opts (100, 0);
+    size_t iterations = 0;
+    for (auto _ : state) {
+        vector<T> x (n);
+        switch (state.range(1)) {
+            case 0:
+                iterations = iterative::cg(a, b, x, opts).iterations;
+                break;
+            case 1:
+                iterations = iterative::cg(a, b, x, opts, iterative::jacobi_preconditioner<T>(a)).iterations;
+                break;
+            default:
+                iterations = iterative::cg(a, b, x, opts, iterative::ic0_preconditioner<T>(a)).iterations;
+        }
+        benchmark::DoNotOptimize(x.data());
+    }
+    // a product and the vector passes each iteration
+    bench::count(state, iterations * (2.0 * a.nnz() + 10.0 * n),
+                 iterations * (bench::csr_bytes(a) + 10.0 * n * sizeof(T)), iterations * double(a.nnz()));
+}
+
+// the 4 dominant eigenpairs of the Laplacian of a k x k grid to a residual
+// of 1e-6, by power iteration with deflation (0) or Lanczos (1)
+template < typename T >
+static void BM_DominantEigenpairs(benchmark::State& state) {
+    csr_matrix<T> a = laplacian<T>(state.range(0));
+    eigen::options opts (100000, 1e-6);
+    size_t products = 0;
+    for (auto _ : state) {
+        eigen::eigenpairs<T> e = state.range(1) == 0 ? eigen::power_iteration(a, 4, opts) : eigen::lanczos(a, 4, opts);
+        products = e.products;
+        benchmark::DoNotOptimize(e.values.data());
+    }
+    state.counters["products"] = double(products);
+    bench::count(state, 0, products * bench::csr_bytes(a), products * double(a.nnz()));
+}
+
+BENCHMARK_TEMPLATE(BM_SparseAssembly, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseAssembly, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseAssembly, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseSum, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseSum, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseSum, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseTranspose, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseTranspose, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseTranspose, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseVectorProduct, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseVectorProduct, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseVectorProduct, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseVectorProductAsDense, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseVectorProductAsDense, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseVectorProductAsDense, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseDenseProduct, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseDenseProduct, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseDenseProduct, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseProduct, int)->Apply(bench::sparse_sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SparseProduct, float)->Apply(bench::sparse_sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SparseProduct, double)->Apply(bench::sparse_sizes)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_SparseProductAsDense, int)->Apply(bench::sparse_sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SparseProductAsDense, float)->Apply(bench::sparse_sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_SparseProductAsDense, double)->Apply(bench::sparse_sizes)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_SparseNorm, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseNorm, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseNorm, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_SparseIsSymmetric, int)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseIsSymmetric, float)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_SparseIsSymmetric, double)->Apply(bench::sparse_sizes);
+
+BENCHMARK_TEMPLATE(BM_ConjugateGradient, float)->ArgsProduct({{64, 256}, {0, 1, 2}})->ArgNames({"k", "preconditioner"});
+BENCHMARK_TEMPLATE(BM_ConjugateGradient, double)->ArgsProduct({{64, 256}, {0, 1, 2}})->ArgNames({"k", "preconditioner"});
+
+BENCHMARK_TEMPLATE(BM_DominantEigenpairs, double)->ArgsProduct({{32, 64}, {0, 1}})->ArgNames({"k", "method"})
+        ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_TEMPLATE(BM_MatrixMarketRead, double)->Apply(bench::sparse_sizes);
+BENCHMARK_TEMPLATE(BM_MatrixMarketWrite, double)->Apply(bench::sparse_sizes);
+
+#pragma clang diagnostic pop
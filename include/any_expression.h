@@ -0,0 +1,75 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include "matrix.h"
+
+// Type-erased matrix expression, for code that needs a single runtime type
+// for expressions of different shapes (containers, non-template interfaces).
+// Every element access is a virtual call, so keep it out of inner loops.
+// Stored matrices are held by reference and expression nodes by value, with
+// the same lifetime rules as the expression itself.
+template < typename T >
+class any_expression : public matrix_expression<T, any_expression<T>> {
+public:
+
+    template < typename Other >
+    any_expression(const matrix_expression<T, Other>& other) // NOLINT(google-explicit-constructor)
+            : _impl(std::make_shared<model<Other>>(other.derived())) {}
+
+    T get(size_t row, size_t col) const {
+        return _impl->get(row, col);
+    }
+
+    size_t height() const {
+        return _impl->height();
+    }
+
+    size_t width() const {
+        return _impl->width();
+    }
+
+    double element_cost() const {
+        return _impl->element_cost();
+    }
+
+private:
+    struct concept {
+        virtual ~concept() = default;
+
+        virtual T get(size_t row, size_t col) const = 0;
+
+        virtual size_t height() const = 0;
+
+        virtual size_t width() const = 0;
+
+        virtual double element_cost() const = 0;
+    };
+
+    template < typename E >
+    struct model : concept {
+        using held_type = typename std::conditional<std::is_base_of<matrix<T, E>, E>::value, const E&, const E>::type;
+
+        explicit model(const E& e) : _e(e) {}
+
+        T get(size_t row, size_t col) const override {
+            return _e.get(row, col);
+        }
+
+        size_t height() const override {
+            return _e.height();
+        }
+
+        size_t width() const override {
+            return _e.width();
+        }
+
+        double element_cost() const override {
+            return _e.element_cost();
+        }
+
+        held_type _e;
+    };
+
+    std::shared_ptr<const concept> _impl;
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "dense_storage.h"
+
+// Bump allocator for the temporaries of a hot loop. Memory is carved out of
+// large blocks that are kept when the arena is rewound, so once the blocks
+// have grown to what one iteration needs, later iterations make no heap
+// calls. Single deallocations are ignored: memory only comes back when the
+// arena is rewound, usually by a scope. An arena belongs to one thread.
+class arena {
+public:
+    // position to rewind to, everything allocated after it is released at once
+    struct marker {
+        size_t block;
+        size_t offset;
+    };
+
+    // Makes `a` the active arena of the calling thread, which default
+    // constructed arena_allocators take their memory from, and rewinds it to
+    // where it was on destruction. Whatever was allocated inside the scope
+    // must not outlive it.
+    class scope {
+    public:
+        explicit scope(arena& a) : _arena(a), _mark(a.mark()), _previous(active()) {
+            active() = &a;
+        }
+
+        scope(const scope&) = delete;
+
+        scope& operator=(const scope&) = delete;
+
+        ~scope() {
+            active() = _previous;
+            _arena.rewind(_mark);
+        }
+
+    private:
+        arena& _arena;
+        marker _mark;
+        arena* _previous;
+    };
+
+    explicit arena(size_t block_size = size_t(1) << 20) : _block_size(block_size) {}
+
+    arena(const arena&) = delete;
+
+    arena& operator=(const arena&) = delete;
+
+    ~arena() {
+        for (const block& b : _blocks) {
+            ::operator delete(b.data);
+        }
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        while (_current < _blocks.size()) {
+            const block& b = _blocks[_current];
+            auto base = reinterpret_cast<uintptr_t>(b.data);
+            size_t offset = ((base + _offset + align - 1) & ~uintptr_t(align - 1)) - base;
+            if(offset + bytes <= b.size) {
+                _offset = offset + bytes;
+                return b.data + offset;
+            }
+            ++_current;
+            _offset = 0;
+        }
+        // room for the worst-case alignment of the request
+        size_t size = std::max(_block_size, bytes + align);
+        _blocks.push_back({static_cast<char*>(::operator new(size)), size});
+        return allocate(bytes, align);
+    }
+
+    marker mark() const noexcept {
+        return {_current, _offset};
+    }
+
+    void rewind(marker m) noexcept {
+        _current = m.block;
+        _offset = m.offset;
+    }
+
+    // releases everything, keeping the blocks for reuse
+    void reset() noexcept {
+        rewind({0, 0});
+    }
+
+    // bytes held from the heap
+    size_t capacity() const noexcept {
+        size_t total = 0;
+        for (const block& b : _blocks) {
+            total += b.size;
+        }
+        return total;
+    }
+
+    size_t blocks() const noexcept {
+        return _blocks.size();
+    }
+
+    // the innermost arena made active by a scope on this thread, if any
+    static arena*& active() {
+        static thread_local arena* current = nullptr;
+        return current;
+    }
+
+private:
+    struct block {
+        char* data;
+        size_t size;
+    };
+
+    size_t _block_size;
+    std::vector<block> _blocks;
+    size_t _current = 0;
+    size_t _offset = 0;
+};
+
+// Allocator taking aligned memory from an arena: the given one, or else the
+// calling thread's active arena when the allocator is created. Without
+// either it behaves as aligned_allocator, so the same storage type works
+// inside and outside of arena scopes.
+template < typename T, size_t Align = matrix_alignment >
+class arena_allocator {
+public:
+    static_assert((Align & (Align - 1)) == 0, "Alignment must be a power of two");
+
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template < typename U >
+    struct rebind {
+        using other = arena_allocator<U, Align>;
+    };
+
+    arena_allocator() noexcept : _arena(arena::active()) {}
+
+    explicit arena_allocator(arena& a) noexcept : _arena(&a) {}
+
+    template < typename U >
+    arena_allocator(const arena_allocator<U, Align>& other) noexcept : _arena(other.source()) {} // NOLINT(google-explicit-constructor)
+
+    T* allocate(size_t n) {
+        if(_arena == nullptr) {
+            return aligned_allocator<T, Align>().allocate(n);
+        }
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), std::max(Align, alignof(T))));
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if(_arena == nullptr) {
+            aligned_allocator<T, Align>().deallocate(p, n);
+        }
+    }
+
+    // the arena memory comes from, null for the heap
+    arena* source() const noexcept {
+        return _arena;
+    }
+
+    template < typename U >
+    bool operator==(const arena_allocator<U, Align>& other) const noexcept {
+        return _arena == other.source();
+    }
+
+    template < typename U >
+    bool operator!=(const arena_allocator<U, Align>& other) const noexcept {
+        return _arena != other.source();
+    }
+
+private:
+    arena* _arena;
+};
@@ -0,0 +1,533 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "full_matrix.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "symmetric_matrix.h"
+#include "triangular.h"
+
+// Factorization of a symmetric matrix from its lower triangle alone, kept
+// to solve any number of systems with it: A = L Lᵀ (Cholesky) when A is
+// positive definite, and P A Pᵀ = L D Lᵀ otherwise, D block diagonal with
+// 1 x 1 and 2 x 2 blocks chosen by Bunch-Kaufman pivoting.
+//
+// The lower triangle is kept in panels, one per block of `block` columns,
+// each the rows from the block's diagonal down at the block's width as
+// stride: about half the memory of a full matrix, yet dense enough for the
+// blocked kernel.
+//
+// Cholesky is tried first, blocked and right-looking as LAPACK's potrf: a
+// panel's diagonal block is factored, the rows below it are solved against
+// it, split over threads, and only the lower triangle of the trailing
+// matrix is updated, a panel at a time, by products through the blocked
+// kernel. That is half the work of LU. A pivot that is not positive
+// rebuilds A from what was factored so far and restarts as LDLᵀ, whose
+// symmetric pivoting handles indefinite matrices; it goes by columns, the
+// rows of each update split over threads.
+template < typename T >
+class symmetric_factorization {
+public:
+    static_assert(std::is_floating_point<T>::value, "Symmetric factorization needs a floating point type");
+
+    enum class method { cholesky, ldlt };
+
+    static constexpr size_t default_block = triangular::default_block;
+
+    // reads the lower triangle of a, once; throws std::runtime_error if a is
+    // not square
+    template < typename M >
+    explicit symmetric_factorization(const matrix_expression<T, M>& a, size_t block = default_block)
+            : _n(a.derived().height()), _block(std::max<size_t>(block, 1)) {
+        if(a.derived().width() != _n) {
+            throw std::runtime_error("symmetric factorization of a non-square matrix");
+        }
+        read(a.derived());
+        if(!factor_cholesky()) {
+            factor_ldlt();
+        }
+    }
+
+    size_t size() const {
+        return _n;
+    }
+
+    method kind() const {
+        return _method;
+    }
+
+    bool positive_definite() const {
+        return _method == method::cholesky;
+    }
+
+    // whether D has a zero block; nothing can be solved then
+    bool singular() const {
+        return _singular;
+    }
+
+    // X with A X = B, for the columns of B at once; throws std::runtime_error
+    // if A is singular or B has another height
+    template < typename M >
+    full_matrix<T> solve(const matrix_expression<T, M>& b) const {
+        full_matrix<T> x (b.derived());
+        if(x.height() != size()) {
+            throw std::runtime_error("right-hand side height does not match the matrix");
+        }
+        solve_in_place(x);
+        return x;
+    }
+
+    vector<T> solve(const vector<T>& b) const {
+        if(b.size() != size()) {
+            throw std::runtime_error("right-hand side height does not match the matrix");
+        }
+        full_matrix<T> x (b.size(), 1);
+        for (size_t i = 0; i < b.size(); ++i) {
+            x.set(i, 0, b[i]);
+        }
+        solve_in_place(x);
+        vector<T> result(b.size());
+        for (size_t i = 0; i < b.size(); ++i) {
+            result[i] = x.get(i, 0);
+        }
+        return result;
+    }
+
+    // L, with its unit diagonal for LDLᵀ
+    full_matrix<T> lower() const {
+        full_matrix<T> l (size(), size());
+        for (size_t i = 0; i < size(); ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                l.set(i, j, at(i, j));
+            }
+            l.set(i, i, _method == method::cholesky ? at(i, i) : T{1});
+        }
+        return l;
+    }
+
+    // D of LDLᵀ, the identity for Cholesky
+    symmetric_matrix<T> block_diagonal() const {
+        symmetric_matrix<T> d (size());
+        for (size_t i = 0; i < size(); ++i) {
+            d.set(i, i, _method == method::cholesky ? T{1} : at(i, i));
+            // _block_size is only filled by the LDLᵀ path
+            if(_method == method::ldlt && i + 1 < size() && _block_size[i] == 2) {
+                d.set(i + 1, i, _off_diagonal[i]);
+            }
+        }
+        return d;
+    }
+
+    // for LDLᵀ, row and column i were swapped with pivots()[i] >= i, in
+    // increasing order of i; empty for Cholesky
+    const std::vector<size_t>& pivots() const {
+        return _pivots;
+    }
+
+private:
+    size_t _n;
+    size_t _block;
+    std::vector<T> _data;
+    std::vector<size_t> _panel;     // where each panel starts in _data
+    method _method = method::cholesky;
+    bool _singular = false;
+    // LDLᵀ only: 1 or 2 where a block of D starts, and the off-diagonal
+    // entry of 2 x 2 blocks, which is not part of L
+    std::vector<size_t> _pivots;
+    std::vector<unsigned char> _block_size;
+    std::vector<T> _off_diagonal;
+
+    size_t width(size_t b) const {
+        return std::min(_block, _n - b * _block);
+    }
+
+    // row i of panel b, from column b * _block; i must not be above the panel
+    T* row(size_t i, size_t b) {
+        return _data.data() + _panel[b] + (i - b * _block) * width(b);
+    }
+
+    const T* row(size_t i, size_t b) const {
+        return _data.data() + _panel[b] + (i - b * _block) * width(b);
+    }
+
+    // for i >= j
+    T& at(size_t i, size_t j) {
+        return row(i, j / _block)[j % _block];
+    }
+
+    const T& at(size_t i, size_t j) const {
+        return row(i, j / _block)[j % _block];
+    }
+
+    // h rows of panel b from row i on
+    dense_view<T, true> panel(size_t b, size_t i, size_t h) {
+        return dense_view<T, true>(row(i, b), h, width(b), width(b), 1);
+    }
+
+    dense_view<T, false> panel(size_t b, size_t i, size_t h) const {
+        return dense_view<T, false>(row(i, b), h, width(b), width(b), 1);
+    }
+
+    // calls f(j, at(i, j)) for j from `from` to i, a panel at a time
+    template < typename F >
+    void for_row(size_t i, size_t from, F f) {
+        for (size_t b = from / _block; b * _block <= i; ++b) {
+            T* r = row(i, b) - b * _block;
+            for (size_t j = std::max(from, b * _block); j <= std::min(i, (b + 1) * _block - 1); ++j) {
+                f(j, r[j]);
+            }
+        }
+    }
+
+    template < typename M >
+    void read(const M& a) {
+        const size_t panels = (_n + _block - 1) / _block;
+        _panel.resize(panels);
+        size_t total = 0;
+        for (size_t b = 0; b < panels; ++b) {
+            _panel[b] = total;
+            total += (_n - b * _block) * width(b);
+        }
+        _data.assign(total, T{});
+        // rows get longer downwards, so chunks are weighed by half a row
+        parallel::for_range(0, _n, parallel::grain_for(_n * a.element_cost() / 2), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                for (size_t j = 0; j <= i; ++j) {
+                    at(i, j) = a.get(i, j);
+                }
+            }
+        });
+    }
+
+    // The lower triangle of panel c, c > b, less L21 L21ᵀ of panel b, or
+    // plus it with `undo`: the diagonal block element by element, as only
+    // its lower triangle is wanted, and the rows below through the blocked
+    // kernel. Panels are disjoint, so nothing is copied.
+    void update(size_t b, size_t c, bool undo) {
+        const size_t nb = width(b);
+        const size_t jb = c * _block;
+        const size_t w = width(c);
+        const T sign = undo ? T{1} : T{-1};
+        for (size_t i = jb; i < jb + w; ++i) {
+            const T* li = row(i, b);
+            T* out = row(i, c);
+            for (size_t j = jb; j <= i; ++j) {
+                const T* lj = row(j, b);
+                T val = 0;
+                for (size_t k = 0; k < nb; ++k) {
+                    val += li[k] * lj[k];
+                }
+                out[j - jb] += sign * val;
+            }
+        }
+        if(jb + w < _n) {
+            dense_view<T, true> below = panel(c, jb + w, _n - jb - w);
+            dense_view<T, true> li = panel(b, jb + w, _n - jb - w);
+            dense_view<T, true> lj = panel(b, jb, w);
+            if(undo) {
+                below.store(below + li.dotProduct(lj.transpose()));
+            } else {
+                below.store(below - li.dotProduct(lj.transpose()));
+            }
+        }
+    }
+
+    bool factor_cholesky() {
+        const size_t n = size();
+        const size_t panels = _panel.size();
+        std::vector<T> diagonal;
+        for (size_t b = 0; b < panels; ++b) {
+            const size_t nb = width(b);
+            const size_t kb = b * _block;
+            const size_t end = kb + nb;
+            // the diagonal block, unblocked, on a copy, so that a pivot that
+            // is not positive finds it as it was
+            T* l11 = row(kb, b);
+            diagonal.assign(l11, l11 + nb * nb);
+            for (size_t j = 0; j < nb; ++j) {
+                if(!(diagonal[j * nb + j] > T{})) {
+                    rebuild(b);
+                    return false;
+                }
+                const T d = std::sqrt(diagonal[j * nb + j]);
+                diagonal[j * nb + j] = d;
+                for (size_t i = j + 1; i < nb; ++i) {
+                    diagonal[i * nb + j] /= d;
+                }
+                for (size_t c = j + 1; c < nb; ++c) {
+                    for (size_t i = c; i < nb; ++i) {
+                        diagonal[i * nb + c] -= diagonal[i * nb + j] * diagonal[c * nb + j];
+                    }
+                }
+            }
+            std::copy(diagonal.begin(), diagonal.end(), l11);
+            if(end == n) {
+                break;
+            }
+            // the rows below, L21 = A21 L11⁻ᵀ, each row a forward substitution
+            parallel::for_range(end, n, parallel::grain_for(nb * nb / 2.0), [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    T* r = row(i, b);
+                    for (size_t j = 0; j < nb; ++j) {
+                        const T* lj = l11 + j * nb;
+                        T val = r[j];
+                        for (size_t c = 0; c < j; ++c) {
+                            val -= r[c] * lj[c];
+                        }
+                        r[j] = val / lj[j];
+                    }
+                }
+            });
+            // the trailing lower triangle, A22 -= L21 L21ᵀ, panel by panel
+            for (size_t c = b + 1; c < panels; ++c) {
+                update(b, c, false);
+            }
+        }
+        return true;
+    }
+
+    // A again, once the diagonal block of panel `failed` had a pivot that is
+    // not positive: the panels from it on hold A22 - L21 L21ᵀ, and the ones
+    // before it L11 and L21
+    void rebuild(size_t failed) {
+        const size_t kb = failed * _block;
+        for (size_t b = 0; b < failed; ++b) {
+            for (size_t c = failed; c < _panel.size(); ++c) {
+                update(b, c, true);
+            }
+        }
+        // A(i, j) = sum of L(i, c) L(j, c), c <= j, for j < kb, in place
+        // going left, so that what is read is not overwritten yet; the rows
+        // below kb read only the ones above it, which go last, upwards
+        auto undo_row = [&](size_t i) {
+            for (size_t j = std::min(i + 1, kb); j-- > 0;) {
+                T val = 0;
+                for (size_t c = 0; c <= j; ++c) {
+                    val += at(i, c) * at(j, c);
+                }
+                at(i, j) = val;
+            }
+        };
+        parallel::for_range(kb, _n, parallel::grain_for(kb * kb / 2.0), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                undo_row(i);
+            }
+        });
+        for (size_t i = kb; i-- > 0;) {
+            undo_row(i);
+        }
+    }
+
+    // Bunch-Kaufman as LAPACK's sytf2 on the lower triangle, except that
+    // whole rows of L are swapped, so that a single permutation applies
+    void factor_ldlt() {
+        const size_t n = size();
+        const T alpha = (1 + std::sqrt(T{17})) / 8;
+        _method = method::ldlt;
+        _pivots.assign(n, 0);
+        _block_size.assign(n, 1);
+        _off_diagonal.assign(n, T{});
+        for (size_t k = 0; k < n;) {
+            size_t step = 1;
+            size_t p = k;
+            const T diagonal = std::abs(at(k, k));
+            size_t imax = k;
+            T column_max = 0;
+            for (size_t i = k + 1; i < n; ++i) {
+                if(std::abs(at(i, k)) > column_max) {
+                    column_max = std::abs(at(i, k));
+                    imax = i;
+                }
+            }
+            if(std::max(diagonal, column_max) == T{}) {
+                _singular = true;
+                _pivots[k] = k;
+                ++k;
+                continue;
+            }
+            if(diagonal < alpha * column_max) {
+                // largest off-diagonal entry in row and column imax
+                T row_max = 0;
+                for (size_t j = k; j < imax; ++j) {
+                    row_max = std::max(row_max, std::abs(at(imax, j)));
+                }
+                for (size_t i = imax + 1; i < n; ++i) {
+                    row_max = std::max(row_max, std::abs(at(i, imax)));
+                }
+                if(diagonal * row_max >= alpha * column_max * column_max) {
+                    p = k;
+                } else if(std::abs(at(imax, imax)) >= alpha * row_max) {
+                    p = imax;
+                } else {
+                    p = imax;
+                    step = 2;
+                }
+            }
+            size_t kk = k + step - 1;
+            swap_symmetric(kk, p);
+            _pivots[kk] = p;
+            if(step == 2) {
+                _pivots[k] = k;
+            }
+            if(step == 1) {
+                const T d = at(k, k);
+                // column k of the panel it lies in has the panel's width as stride
+                const T* lk = &at(k, k);
+                const size_t sk = width(k / _block);
+                parallel::for_range(k + 1, n, parallel::grain_for((n - k) / 2.0), [&](size_t first, size_t last) {
+                    for (size_t i = first; i < last; ++i) {
+                        const T li = at(i, k) / d;
+                        for_row(i, k + 1, [&](size_t j, T& x) {
+                            x -= li * lk[(j - k) * sk];
+                        });
+                    }
+                });
+                for (size_t i = k + 1; i < n; ++i) {
+                    at(i, k) /= d;
+                }
+            } else {
+                const T d11 = at(k, k);
+                const T d21 = at(k + 1, k);
+                const T d22 = at(k + 1, k + 1);
+                const T det = d11 * d22 - d21 * d21;
+                // rows of W D⁻¹, W the two columns below the block
+                std::vector<T> l1(n), l2(n);
+                for (size_t i = k + 2; i < n; ++i) {
+                    l1[i] = (d22 * at(i, k) - d21 * at(i, k + 1)) / det;
+                    l2[i] = (d11 * at(i, k + 1) - d21 * at(i, k)) / det;
+                }
+                const T* lk = &at(k, k);
+                const T* lk1 = &at(k + 1, k + 1);
+                const size_t sk = width(k / _block);
+                const size_t sk1 = width((k + 1) / _block);
+                parallel::for_range(k + 2, n, parallel::grain_for((n - k) / 2.0), [&](size_t first, size_t last) {
+                    for (size_t i = first; i < last; ++i) {
+                        for_row(i, k + 2, [&](size_t j, T& x) {
+                            x -= l1[i] * lk[(j - k) * sk] + l2[i] * lk1[(j - k - 1) * sk1];
+                        });
+                    }
+                });
+                for (size_t i = k + 2; i < n; ++i) {
+                    at(i, k) = l1[i];
+                    at(i, k + 1) = l2[i];
+                }
+                _block_size[k] = 2;
+                _block_size[k + 1] = 0;
+                _off_diagonal[k] = d21;
+                at(k + 1, k) = 0;
+            }
+            k += step;
+        }
+    }
+
+    // swaps row and column a with row and column b > a of the lower triangle,
+    // along with rows a and b of the columns of L already computed
+    void swap_symmetric(size_t a, size_t b) {
+        if(a == b) {
+            return;
+        }
+        for (size_t j = 0; j < a; ++j) {
+            std::swap(at(a, j), at(b, j));
+        }
+        for (size_t j = a + 1; j < b; ++j) {
+            std::swap(at(j, a), at(b, j));
+        }
+        for (size_t i = b + 1; i < size(); ++i) {
+            std::swap(at(i, a), at(i, b));
+        }
+        std::swap(at(a, a), at(b, b));
+    }
+
+    void solve_in_place(full_matrix<T>& x) const {
+        if(_singular) {
+            throw std::runtime_error("singular matrix");
+        }
+        const size_t n = size();
+        const size_t m = x.width();
+        const triangular::diagonal d = _method == method::cholesky ? triangular::diagonal::stored
+                                                                    : triangular::diagonal::unit;
+        if(_method == method::cholesky) {
+            solve_lower(x, d);
+            solve_upper(x, d);
+            return;
+        }
+        auto swap_rows = [&](size_t i, size_t j) {
+            if(i != j) {
+                std::swap_ranges(x.data() + i * x.stride(), x.data() + i * x.stride() + m, x.data() + j * x.stride());
+            }
+        };
+        for (size_t i = 0; i < n; ++i) {
+            swap_rows(i, _pivots[i]);
+        }
+        solve_lower(x, d);
+        for (size_t i = 0; i < n; ++i) {
+            T* r = x.data() + i * x.stride();
+            if(_block_size[i] == 1) {
+                for (size_t j = 0; j < m; ++j) {
+                    r[j] /= at(i, i);
+                }
+            } else if(_block_size[i] == 2) {
+                T* s = r + x.stride();
+                const T d11 = at(i, i);
+                const T d21 = _off_diagonal[i];
+                const T d22 = at(i + 1, i + 1);
+                const T det = d11 * d22 - d21 * d21;
+                for (size_t j = 0; j < m; ++j) {
+                    T u = r[j];
+                    T v = s[j];
+                    r[j] = (d22 * u - d21 * v) / det;
+                    s[j] = (d11 * v - d21 * u) / det;
+                }
+            }
+        }
+        solve_upper(x, d);
+        for (size_t i = n; i-- > 0;) {
+            swap_rows(i, _pivots[i]);
+        }
+    }
+
+    // L X = B in place, a panel at a time
+    void solve_lower(full_matrix<T>& x, triangular::diagonal d) const {
+        const size_t m = x.width();
+        for (size_t b = 0; b < _panel.size(); ++b) {
+            const size_t kb = b * _block;
+            const size_t nb = width(b);
+            dense_view<T, true> solved = x.block(kb, 0, nb, m);
+            triangular::solve_lower(panel(b, kb, nb), solved, d, _block);
+            if(kb + nb < _n) {
+                dense_view<T, true> rest = x.block(kb + nb, 0, _n - kb - nb, m);
+                rest.store(rest - panel(b, kb + nb, _n - kb - nb).dotProduct(solved));
+            }
+        }
+    }
+
+    // Lᵀ X = B in place, a panel at a time from the last; a panel read
+    // with swapped strides is its transpose
+    void solve_upper(full_matrix<T>& x, triangular::diagonal d) const {
+        const size_t m = x.width();
+        for (size_t b = _panel.size(); b-- > 0;) {
+            const size_t kb = b * _block;
+            const size_t nb = width(b);
+            dense_view<T, true> solved = x.block(kb, 0, nb, m);
+            if(kb + nb < _n) {
+                dense_view<T, false> below (row(kb + nb, b), nb, _n - kb - nb, 1, nb);
+                solved.store(solved - below.dotProduct(x.block(kb + nb, 0, _n - kb - nb, m)));
+            }
+            triangular::solve_upper(dense_view<T, false>(row(kb, b), nb, nb, 1, nb), solved, d, _block);
+        }
+    }
+};
+
+template < typename T > constexpr size_t symmetric_factorization<T>::default_block;
+
+template < typename T, typename M >
+symmetric_factorization<T> cholesky(const matrix_expression<T, M>& a,
+                                    size_t block = symmetric_factorization<T>::default_block) {
+    return symmetric_factorization<T>(a, block);
+}
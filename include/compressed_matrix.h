@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "matrix.h"
+#include "sparse_matrix.h"
+
+// Compressed sparse storage. With RowMajor (CSR) the nonzeros of row r are
+// values()[offsets()[r] .. offsets()[r + 1]) with their columns in indices(),
+// sorted; without it (CSC) the same holds for columns and their rows.
+// Missing entries are zero, and zeros are never stored.
+template < typename T, bool RowMajor >
+class compressed_matrix : public matrix<T, compressed_matrix<T, RowMajor>> {
+public:
+
+    using index_list = std::vector<size_t>;
+
+    using value_list = std::vector<T>;
+
+    class nonzero_iterator : public std::iterator<std::input_iterator_tag, matrix_entry<T>> {
+    public:
+        nonzero_iterator(const compressed_matrix* m, size_t major, size_t pos) : _matrix(m), _major(major), _pos(pos) {
+            skip_finished();
+        }
+
+        matrix_entry<T> operator*() const {
+            size_t minor = _matrix->_indices[_pos];
+            return {RowMajor ? _major : minor, RowMajor ? minor : _major, _matrix->_values[_pos]};
+        }
+
+        nonzero_iterator& operator++() {
+            ++_pos;
+            skip_finished();
+            return *this;
+        }
+
+        bool operator==(const nonzero_iterator& other) const {
+            return _pos == other._pos;
+        }
+
+        bool operator!=(const nonzero_iterator& other) const {
+            return ! operator==(other);
+        }
+
+    private:
+        const compressed_matrix* _matrix;
+        size_t _major;
+        size_t _pos;
+
+        void skip_finished() {
+            while (_major < _matrix->major_size() && _pos >= _matrix->_offsets[_major + 1]) {
+                ++_major;
+            }
+        }
+    };
+
+    compressed_matrix(const compressed_matrix&) noexcept = default;
+
+    compressed_matrix(compressed_matrix&&) noexcept = default;
+
+    compressed_matrix& operator=(const compressed_matrix& other) {
+        return this->assign(other);
+    }
+
+    compressed_matrix& operator=(compressed_matrix&&) noexcept = default;
+
+    template < typename Other >
+    compressed_matrix& operator=(const matrix_expression<T, Other>& other) {
+        return this->assign(other);
+    }
+
+    template < typename Other >
+    compressed_matrix(const matrix_expression<T, Other>& other) noexcept : h(other.height()), w(other.width()) {
+        MATRIX_TIME_MATERIALIZATION("compressed_matrix", Other, h, w);
+        compress(other.derived());
+    }
+
+    // expressions over sparse operands only compute the entries they produce
+    template < typename E, typename std::enable_if<std::is_base_of<matrix_expression<T, E>, E>::value &&
+            sparse_expression<E>::value && !is_sparse<E>::value, int>::type = 0 >
+    compressed_matrix(const E& expr) : compressed_matrix(evaluate(expr)) {}
+
+    template < typename Alloc >
+    compressed_matrix(const sparse_matrix<T, Alloc>& other) : h(other.height()), w(other.width()) { // NOLINT(google-explicit-constructor)
+        // missing entries that do not read as zero are stored like any other
+        if(other.default_value() != static_cast<T>(0)) {
+            compress(other);
+            return;
+        }
+        // bucket the (row, col)-ordered entries by major index, which keeps
+        // the minor indices of each bucket sorted; missing entries read as zero
+        _offsets.assign(major_size() + 1, 0);
+        for (const auto& e : other.entries()) {
+            ++_offsets[major_of(e.first.first, e.first.second) + 1];
+        }
+        for (size_t i = 0; i < major_size(); ++i) {
+            _offsets[i + 1] += _offsets[i];
+        }
+        _indices.resize(_offsets.back());
+        _values.resize(_offsets.back());
+        index_list next(_offsets.begin(), _offsets.end() - 1);
+        for (const auto& e : other.entries()) {
+            size_t pos = next[major_of(e.first.first, e.first.second)]++;
+            _indices[pos] = minor_of(e.first.first, e.first.second);
+            _values[pos] = e.second;
+        }
+    }
+
+    explicit compressed_matrix(const compressed_matrix<T, !RowMajor>& other) : h(other.height()), w(other.width()) {
+        // the other orientation's minor index is our major one
+        _offsets.assign(major_size() + 1, 0);
+        for (size_t idx : other.indices()) {
+            ++_offsets[idx + 1];
+        }
+        for (size_t i = 0; i < major_size(); ++i) {
+            _offsets[i + 1] += _offsets[i];
+        }
+        _indices.resize(other.nnz());
+        _values.resize(other.nnz());
+        index_list next(_offsets.begin(), _offsets.end() - 1);
+        for (size_t major = 0; major < minor_size(); ++major) {
+            for (size_t k = other.offsets()[major]; k < other.offsets()[major + 1]; ++k) {
+                size_t pos = next[other.indices()[k]]++;
+                _indices[pos] = major;
+                _values[pos] = other.values()[k];
+            }
+        }
+    }
+
+    compressed_matrix(size_t height, size_t width) : h(height), w(width), _offsets(major_size() + 1, 0) {}
+
+    // adopts already compressed arrays, which must follow the layout above
+    compressed_matrix(size_t height, size_t width, index_list offsets, index_list indices, value_list values)
+            : h(height), w(width), _offsets(std::move(offsets)), _indices(std::move(indices)), _values(std::move(values)) {
+        assert(_offsets.size() == major_size() + 1);
+        assert(_indices.size() == _offsets.back() && _values.size() == _offsets.back());
+    }
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(compressed_matrix);
+        size_t major = major_of(row, col);
+        auto first = _indices.begin() + _offsets[major];
+        auto last = _indices.begin() + _offsets[major + 1];
+        auto it = std::lower_bound(first, last, minor_of(row, col));
+        if(it == last || *it != minor_of(row, col)) {
+            return static_cast<T>(0);
+        }
+        return _values[it - _indices.begin()];
+    }
+
+    // updates in place, but inserting or removing an entry shifts every
+    // entry after it: build whole matrices through the constructors instead
+    void set(size_t row, size_t col, const T& val) {
+        size_t major = major_of(row, col);
+        size_t minor = minor_of(row, col);
+        auto first = _indices.begin() + _offsets[major];
+        auto last = _indices.begin() + _offsets[major + 1];
+        auto it = std::lower_bound(first, last, minor);
+        auto pos = it - _indices.begin();
+        if(it != last && *it == minor) {
+            if(val != static_cast<T>(0)) {
+                _values[pos] = val;
+                return;
+            }
+            _indices.erase(it);
+            _values.erase(_values.begin() + pos);
+            for (size_t i = major + 1; i < _offsets.size(); ++i) {
+                --_offsets[i];
+            }
+        } else if(val != static_cast<T>(0)) {
+            _indices.insert(it, minor);
+            _values.insert(_values.begin() + pos, val);
+            for (size_t i = major + 1; i < _offsets.size(); ++i) {
+                ++_offsets[i];
+            }
+        }
+    }
+
+    // see matrix::assign; the arrays are rebuilt, so src may read this anywhere
+    template < typename Other >
+    void store(const Other& src) {
+        compressed_matrix result(src);
+        h = result.h;
+        w = result.w;
+        _offsets.swap(result._offsets);
+        _indices.swap(result._indices);
+        _values.swap(result._values);
+    }
+
+    size_t height() const {
+        return h;
+    }
+
+    size_t width() const {
+        return w;
+    }
+
+    size_t nnz() const {
+        return _values.size();
+    }
+
+    // stored entries, by row for CSR and by column for CSC
+    entry_range<nonzero_iterator> nonzeros() const {
+        return {nonzero_iterator(this, 0, 0), nonzero_iterator(this, major_size(), nnz())};
+    }
+
+    // raw compressed arrays
+
+    const index_list& offsets() const {
+        return _offsets;
+    }
+
+    const index_list& indices() const {
+        return _indices;
+    }
+
+    const value_list& values() const {
+        return _values;
+    }
+
+    // special generators
+
+    static compressed_matrix zero(size_t size) {
+        return compressed_matrix(size, size);
+    }
+
+    static compressed_matrix identity(size_t size) {
+        index_list offsets(size + 1);
+        index_list indices(size);
+        for (size_t i = 0; i < size; ++i) {
+            offsets[i + 1] = i + 1;
+            indices[i] = i;
+        }
+        return compressed_matrix(size, size, std::move(offsets), std::move(indices), value_list(size, static_cast<T>(1)));
+    }
+
+private:
+    size_t h;
+    size_t w;
+    index_list _offsets;
+    index_list _indices;
+    value_list _values;
+
+    size_t major_size() const {
+        return RowMajor ? h : w;
+    }
+
+    size_t minor_size() const {
+        return RowMajor ? w : h;
+    }
+
+    static size_t major_of(size_t row, size_t col) {
+        return RowMajor ? row : col;
+    }
+
+    static size_t minor_of(size_t row, size_t col) {
+        return RowMajor ? col : row;
+    }
+
+    // every element of src, keeping the non-zero ones
+    template < typename Src >
+    void compress(const Src& src) {
+        _offsets.reserve(major_size() + 1);
+        _offsets.push_back(0);
+        for (size_t major = 0; major < major_size(); ++major) {
+            for (size_t minor = 0; minor < minor_size(); ++minor) {
+                T val = RowMajor ? src.get(major, minor) : src.get(minor, major);
+                if(val != static_cast<T>(0)) {
+                    _indices.push_back(minor);
+                    _values.push_back(val);
+                }
+            }
+            _offsets.push_back(_indices.size());
+        }
+    }
+
+    template < typename E >
+    static compressed_matrix<T, true> evaluate(const E& expr) {
+        MATRIX_TIME_MATERIALIZATION("sparse expression", E, expr.height(), expr.width());
+        return sparse_expression<E>::evaluate(expr);
+    }
+};
+
+template < typename T, bool RowMajor >
+struct is_sparse<compressed_matrix<T, RowMajor>> : std::true_type {};
+
+template < typename T >
+using csr_matrix = compressed_matrix<T, true>;
+
+template < typename T >
+using csc_matrix = compressed_matrix<T, false>;
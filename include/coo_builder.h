@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "compressed_matrix.h"
+
+// Collects (row, col, value) triplets in any order and assembles them into a
+// compressed matrix in one pass: entries are bucketed by row, each row is
+// sorted by column, duplicates are summed in insertion order and zeros
+// (given or cancelled out) are dropped.
+//
+// Single entries go through an unsynchronized insert, whole batches through
+// a locked one, so threads should fill their own batch and hand it over.
+template < typename T >
+class coo_builder {
+public:
+
+    struct triplet {
+        size_t row;
+        size_t col;
+        T value;
+    };
+
+    using batch = std::vector<triplet>;
+
+    coo_builder(size_t height, size_t width) : h(height), w(width) {}
+
+    void reserve(size_t entries) {
+        _entries.reserve(entries);
+    }
+
+    void insert(size_t row, size_t col, const T& val) {
+        assert(row < h && col < w);
+        _entries.push_back({row, col, val});
+    }
+
+    // safe to call concurrently
+    void insert(batch entries) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _batches.push_back(std::move(entries));
+    }
+
+    size_t size() const {
+        size_t total = _entries.size();
+        for (const batch& b : _batches) {
+            total += b.size();
+        }
+        return total;
+    }
+
+    // assembles every inserted entry and leaves the builder empty
+    csr_matrix<T> build() {
+        using index_list = typename csr_matrix<T>::index_list;
+        using value_list = typename csr_matrix<T>::value_list;
+
+        index_list offsets(h + 1, 0);
+        for_each_entry([&](const triplet& t) {
+            ++offsets[t.row + 1];
+        });
+        for (size_t i = 0; i < h; ++i) {
+            offsets[i + 1] += offsets[i];
+        }
+
+        std::vector<std::pair<size_t, T>> by_row(offsets.back());
+        index_list next(offsets.begin(), offsets.end() - 1);
+        for_each_entry([&](const triplet& t) {
+            by_row[next[t.row]++] = std::make_pair(t.col, t.value);
+        });
+        _entries = batch();
+        _batches.clear();
+
+        index_list indices;
+        value_list values;
+        indices.reserve(by_row.size());
+        values.reserve(by_row.size());
+        size_t first = 0;
+        for (size_t i = 0; i < h; ++i) {
+            size_t last = offsets[i + 1];
+            std::stable_sort(by_row.begin() + first, by_row.begin() + last,
+                             [](const std::pair<size_t, T>& a, const std::pair<size_t, T>& b) {
+                                 return a.first < b.first;
+                             });
+            for (size_t k = first; k < last;) {
+                size_t col = by_row[k].first;
+                T sum = by_row[k].second;
+                for (++k; k < last && by_row[k].first == col; ++k) {
+                    sum += by_row[k].second;
+                }
+                if(sum != static_cast<T>(0)) {
+                    indices.push_back(col);
+                    values.push_back(sum);
+                }
+            }
+            first = last;
+            offsets[i + 1] = indices.size();
+        }
+        return csr_matrix<T>(h, w, std::move(offsets), std::move(indices), std::move(values));
+    }
+
+private:
+    size_t h;
+    size_t w;
+    batch _entries;
+    std::vector<batch> _batches;
+    std::mutex _mutex;
+
+    template < typename F >
+    void for_each_entry(F f) const {
+        for (const triplet& t : _entries) {
+            f(t);
+        }
+        for (const batch& b : _batches) {
+            for (const triplet& t : b) {
+                assert(t.row < h && t.col < w);
+                f(t);
+            }
+        }
+    }
+};
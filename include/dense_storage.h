@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include "instrumentation.h"
+
+// alignment of every dense buffer and of the start of each of its rows,
+// one cache line (which is also the width of the widest SIMD registers)
+constexpr size_t matrix_alignment = 64;
+
+template < typename T, size_t Align = matrix_alignment >
+class aligned_allocator {
+public:
+    static_assert((Align & (Align - 1)) == 0, "Alignment must be a power of two");
+
+    using value_type = T;
+
+    template < typename U >
+    struct rebind {
+        using other = aligned_allocator<U, Align>;
+    };
+
+    aligned_allocator() noexcept = default;
+
+    template < typename U >
+    aligned_allocator(const aligned_allocator<U, Align>&) noexcept {} // NOLINT(google-explicit-constructor)
+
+    T* allocate(size_t n) {
+        // over-allocate and keep the original pointer right before the aligned block
+        size_t bytes = n * sizeof(T) + Align + sizeof(void*);
+        auto raw = static_cast<char*>(::operator new(bytes));
+        auto addr = reinterpret_cast<uintptr_t>(raw + sizeof(void*));
+        auto aligned = reinterpret_cast<char*>((addr + Align - 1) & ~uintptr_t(Align - 1));
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        MATRIX_COUNT_ALLOCATION(n * sizeof(T));
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T* p, size_t n) noexcept {
+        if(p != nullptr) {
+            MATRIX_COUNT_DEALLOCATION(n * sizeof(T));
+            ::operator delete(reinterpret_cast<void**>(p)[-1]);
+        }
+    }
+
+    template < typename U >
+    bool operator==(const aligned_allocator<U, Align>&) const noexcept {
+        return true;
+    }
+
+    template < typename U >
+    bool operator!=(const aligned_allocator<U, Align>&) const noexcept {
+        return false;
+    }
+};
+
+// Buffer of n elements kept by each thread between uses, so code running in a
+// loop only allocates when it needs more room than before. Tag tells apart
+// buffers of different uses. A thread waiting for a parallel loop runs other
+// tasks, which may need the same buffer; they get one of their own while the
+// kept one is in use.
+template < typename Buffer, typename Tag >
+class scratch {
+public:
+    explicit scratch(size_t n) : _kept(!in_use()), _buffer(_kept ? kept() : _own) {
+        if(_kept) {
+            in_use() = true;
+        }
+        _buffer.resize(n);
+    }
+
+    scratch(const scratch&) = delete;
+
+    scratch& operator=(const scratch&) = delete;
+
+    ~scratch() {
+        if(_kept) {
+            in_use() = false;
+        }
+    }
+
+    // the same buffer from any thread, e.g. the tasks of a parallel loop
+    Buffer& buffer() const noexcept {
+        return _buffer;
+    }
+
+    typename Buffer::value_type* data() const noexcept {
+        return _buffer.data();
+    }
+
+private:
+    bool _kept;
+    Buffer _own;
+    Buffer& _buffer;
+
+    static Buffer& kept() {
+        static thread_local Buffer b;
+        return b;
+    }
+
+    static bool& in_use() {
+        static thread_local bool used = false;
+        return used;
+    }
+};
+
+// Single row-major buffer with padded rows: element (r, c) lives at
+// data()[r * stride() + c], and every row starts on an aligned address as
+// long as the allocator returns aligned memory.
+template < typename T, typename Alloc = aligned_allocator<T> >
+class dense_storage {
+public:
+    using buffer = std::vector<T, Alloc>;
+
+    dense_storage() = default;
+
+    dense_storage(size_t h, size_t w, const T& def = {}, const Alloc& alloc = Alloc())
+            : _h(h), _w(w), _stride(padded_stride(w)), _data(h * _stride, T{}, alloc) {
+        for (size_t i = 0; i < _h; ++i) {
+            std::fill(row_data(i), row_data(i) + _w, def);
+        }
+    }
+
+    T& operator()(size_t row, size_t col) {
+        return _data[row * _stride + col];
+    }
+
+    const T& operator()(size_t row, size_t col) const {
+        return _data[row * _stride + col];
+    }
+
+    T* data() noexcept {
+        return _data.data();
+    }
+
+    const T* data() const noexcept {
+        return _data.data();
+    }
+
+    T* row_data(size_t row) noexcept {
+        return data() + row * _stride;
+    }
+
+    const T* row_data(size_t row) const noexcept {
+        return data() + row * _stride;
+    }
+
+    size_t height() const noexcept {
+        return _h;
+    }
+
+    size_t width() const noexcept {
+        return _w;
+    }
+
+    size_t stride() const noexcept {
+        return _stride;
+    }
+
+    Alloc get_allocator() const {
+        return _data.get_allocator();
+    }
+
+    // rows are padded to a whole number of aligned blocks whenever T packs evenly into one
+    static size_t padded_stride(size_t w) {
+        constexpr size_t lanes = matrix_alignment % sizeof(T) == 0 ? matrix_alignment / sizeof(T) : 1;
+        return (w + lanes - 1) / lanes * lanes;
+    }
+
+private:
+    size_t _h = 0;
+    size_t _w = 0;
+    size_t _stride = 0;
+    buffer _data;
+};
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "matrix.h"
+#include "parallel.h"
+#include "vectors.h"
+
+// Dominant eigenpairs A v = λ v of large (sparse) matrices, from products
+// with A through its product_kernel and vector passes over buffers
+// allocated once per call.
+//
+// power_iteration finds one pair after another, each iterate kept
+// orthogonal to the vectors already found (projection deflation), which is
+// exact for symmetric A; for k = 1 it works for any A with a dominant real
+// eigenvalue, such as a PageRank matrix. lanczos finds the top k of a
+// symmetric A at once from a Krylov basis, fully reorthogonalized and
+// restarted from the best Ritz vectors when full (thick restart), and needs
+// far fewer products when eigenvalues are close.
+//
+// Both stop on residuals: a pair converges once ||A v - λ v|| <= tolerance |λ|,
+// with A deflated by the pairs found before for power iteration. Residuals
+// are reported for A itself, where later pairs also carry the error of the
+// earlier ones, so theirs can end up a little over the tolerance.
+namespace eigen {
+
+    struct options {
+        explicit options(size_t max_iterations = 1000, double tolerance = 1e-8, size_t subspace = 0)
+                : max_iterations(max_iterations), tolerance(tolerance), subspace(subspace) {}
+
+        // products with A per pair for power iteration, restarts for Lanczos
+        size_t max_iterations;
+        double tolerance;
+        // Lanczos basis size; 0 for max(2 k, k + 16)
+        size_t subspace;
+    };
+
+    template < typename T >
+    struct eigenpairs {
+        // by decreasing magnitude
+        vector<T> values;
+        // of unit length, vectors[i] for values[i]
+        std::vector<vector<T>> vectors;
+        // ||A v - λ v|| / |λ| for each pair
+        std::vector<double> residuals;
+        // products with A in all
+        size_t products = 0;
+        bool converged = false;
+    };
+
+    namespace detail {
+
+        inline size_t vector_grain() {
+            return parallel::grain_for(4);
+        }
+
+        // deterministic start, unlikely to miss any eigenvector
+        template < typename T >
+        void random_start(vector<T>& x, unsigned seed) {
+            std::mt19937 gen(seed);
+            std::uniform_real_distribution<double> dist(-1, 1);
+            for (T& v : x) {
+                v = static_cast<T>(dist(gen));
+            }
+        }
+
+        // x -= (v·x) v for the first `count` vectors of `basis`, twice, as
+        // once loses orthogonality when x is mostly in their span; returns
+        // ||x||² after, and leaves the coefficients in `coefficients`
+        template < typename T >
+        double orthogonalize(vector<T>& x, const std::vector<vector<T>>& basis, size_t count,
+                             std::vector<double>& coefficients, parallel::reducer& sums) {
+            std::fill(coefficients.begin(), coefficients.end(), 0.0);
+            double xx = 0;
+            for (int pass = 0; pass < (count > 0 ? 2 : 1); ++pass) {
+                const double* dots = sums.sum_each([&](size_t first, size_t last, double* s) {
+                    for (size_t j = 0; j < count; ++j) {
+                        const T* v = basis[j].data();
+                        double d = 0;
+                        for (size_t i = first; i < last; ++i) {
+                            d += static_cast<double>(v[i]) * x[i];
+                        }
+                        s[j] = d;
+                    }
+                });
+                for (size_t j = 0; j < count; ++j) {
+                    coefficients[j] += dots[j];
+                }
+                // all the vectors subtracted in one pass, which also yields
+                // ||x||²; dots stay valid until this pass is done
+                xx = *sums.sum_each([&](size_t first, size_t last, double* s) {
+                    double norm = 0;
+                    for (size_t i = first; i < last; ++i) {
+                        T xi = x[i];
+                        for (size_t j = 0; j < count; ++j) {
+                            xi -= static_cast<T>(dots[j]) * basis[j][i];
+                        }
+                        x[i] = xi;
+                        norm += static_cast<double>(xi) * xi;
+                    }
+                    s[0] = norm;
+                });
+            }
+            return xx;
+        }
+
+        template < typename T >
+        void scale(vector<T>& x, double factor, parallel::reducer& sums) {
+            const T f = static_cast<T>(factor);
+            sums.sum([&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    x[i] *= f;
+                }
+                return 0.0;
+            });
+        }
+
+        // ||A v - λ v|| / |λ|, with `work` for A v
+        template < typename T, typename M >
+        double residual(const M& a, const vector<T>& v, T lambda, vector<T>& work, parallel::reducer& sums) {
+            product_kernel<M>::multiply(a, v, work);
+            double r = sums.sum([&](size_t first, size_t last) {
+                double s = 0;
+                for (size_t i = first; i < last; ++i) {
+                    double d = static_cast<double>(work[i]) - static_cast<double>(lambda) * v[i];
+                    s += d * d;
+                }
+                return s;
+            });
+            return std::sqrt(r) / std::max<double>(std::abs(lambda), std::numeric_limits<double>::min());
+        }
+
+        // Eigenvalues and vectors of the symmetric s x s matrix a (row stride
+        // m, destroyed) by cyclic Jacobi rotations: values on the diagonal
+        // of a, vectors in the columns of v. Small s only.
+        inline void symmetric_eigen(double* a, double* v, size_t s, size_t m) {
+            for (size_t i = 0; i < s; ++i) {
+                std::fill(v + i * m, v + i * m + s, 0.0);
+                v[i * m + i] = 1;
+            }
+            for (int sweep = 0; sweep < 64; ++sweep) {
+                double off = 0;
+                double diagonal = 0;
+                for (size_t i = 0; i < s; ++i) {
+                    diagonal += a[i * m + i] * a[i * m + i];
+                    for (size_t j = i + 1; j < s; ++j) {
+                        off += a[i * m + j] * a[i * m + j];
+                    }
+                }
+                if(off <= 1e-32 * diagonal || off == 0) {
+                    return;
+                }
+                for (size_t p = 0; p < s; ++p) {
+                    for (size_t q = p + 1; q < s; ++q) {
+                        const double apq = a[p * m + q];
+                        if(apq == 0) {
+                            continue;
+                        }
+                        const double theta = (a[q * m + q] - a[p * m + p]) / (2 * apq);
+                        const double t = (theta >= 0 ? 1 : -1) / (std::abs(theta) + std::sqrt(theta * theta + 1));
+                        const double c = 1 / std::sqrt(t * t + 1);
+                        const double sn = t * c;
+                        for (size_t k = 0; k < s; ++k) {
+                            const double akp = a[k * m + p];
+                            const double akq = a[k * m + q];
+                            a[k * m + p] = c * akp - sn * akq;
+                            a[k * m + q] = sn * akp + c * akq;
+                        }
+                        for (size_t k = 0; k < s; ++k) {
+                            const double apk = a[p * m + k];
+                            const double aqk = a[q * m + k];
+                            a[p * m + k] = c * apk - sn * aqk;
+                            a[q * m + k] = sn * apk + c * aqk;
+                        }
+                        for (size_t k = 0; k < s; ++k) {
+                            const double vkp = v[k * m + p];
+                            const double vkq = v[k * m + q];
+                            v[k * m + p] = c * vkp - sn * vkq;
+                            v[k * m + q] = sn * vkp + c * vkq;
+                        }
+                    }
+                }
+            }
+        }
+
+        // throws std::runtime_error unless a is square and 0 < k <= its size
+        template < typename T, typename M >
+        void check(const matrix_expression<T, M>& a, size_t k) {
+            if(a.height() != a.width()) {
+                throw std::runtime_error("eigenpairs of a non-square matrix");
+            }
+            if(k == 0 || k > a.height()) {
+                throw std::runtime_error("number of eigenpairs out of range");
+            }
+        }
+    }
+
+    // The k dominant eigenpairs by power iteration: x <- A x / ||A x||
+    // until the residual of the Rayleigh quotient λ = xᵀ A x is small, with
+    // x kept orthogonal to the vectors found before. Per iteration: one
+    // product with A, and two passes over vectors, the second computing the
+    // residual while normalizing, plus two for the deflation.
+    // Converges as |λ₂ / λ₁| per iteration, slowly when those are close.
+    template < typename T, typename M >
+    eigenpairs<T> power_iteration(const matrix_expression<T, M>& a, size_t k = 1, const options& opts = options()) {
+        static_assert(std::is_floating_point<T>::value, "eigenpairs need a floating point type");
+        detail::check(a, k);
+        const M& m = a.derived();
+        const size_t n = a.height();
+        eigenpairs<T> result;
+        result.values.assign(k, T{0});
+        result.vectors.assign(k, vector<T>(n));
+        result.residuals.assign(k, 0);
+        result.converged = true;
+        parallel::reducer sums (n, detail::vector_grain(), std::max<size_t>(k, 2));
+        std::vector<double> coefficients (k);
+        vector<T> y (n);
+        for (size_t p = 0; p < k; ++p) {
+            vector<T>& x = result.vectors[p];
+            detail::random_start(x, static_cast<unsigned>(p + 1));
+            detail::scale(x, 1 / std::sqrt(detail::orthogonalize(x, result.vectors, p, coefficients, sums)), sums);
+            bool converged = false;
+            for (size_t iteration = 0; iteration < opts.max_iterations && !converged; ++iteration) {
+                product_kernel<M>::multiply(m, x, y);
+                ++result.products;
+                std::pair<double, double> xy_yy = sums.sum_pair([&](size_t first, size_t last) {
+                    double xy = 0;
+                    double yy = 0;
+                    for (size_t i = first; i < last; ++i) {
+                        xy += static_cast<double>(x[i]) * y[i];
+                        yy += static_cast<double>(y[i]) * y[i];
+                    }
+                    return std::make_pair(xy, yy);
+                });
+                const double lambda = xy_yy.first;
+                if(xy_yy.second == 0) {
+                    // x is in the null space: λ = 0 exactly
+                    result.values[p] = T{0};
+                    result.residuals[p] = 0;
+                    converged = true;
+                    break;
+                }
+                // ||y - λ x||² for the residual of x, while y becomes the
+                // next iterate y / ||y||, deflated first past the first pair
+                const T inverse = static_cast<T>(p == 0 ? 1 / std::sqrt(xy_yy.second) : 1);
+                double rr = sums.sum([&](size_t first, size_t last) {
+                    double s = 0;
+                    for (size_t i = first; i < last; ++i) {
+                        double d = static_cast<double>(y[i]) - lambda * x[i];
+                        s += d * d;
+                        y[i] *= inverse;
+                    }
+                    return s;
+                });
+                result.values[p] = static_cast<T>(lambda);
+                result.residuals[p] = std::sqrt(rr) / std::abs(lambda);
+                double deflated = rr;
+                if(p > 0) {
+                    // x is orthogonal to the pairs found, so what A x has of
+                    // them adds to the residual squared: without it remains
+                    // the residual for the deflated matrix
+                    double yy = detail::orthogonalize(y, result.vectors, p, coefficients, sums);
+                    for (size_t j = 0; j < p; ++j) {
+                        deflated -= coefficients[j] * coefficients[j];
+                    }
+                    detail::scale(y, 1 / std::sqrt(yy), sums);
+                }
+                converged = std::sqrt(std::max(deflated, 0.0)) <= opts.tolerance * std::abs(lambda);
+                // x stays the vector the residual is for
+                if(!converged) {
+                    x.swap(y);
+                }
+            }
+            result.converged = result.converged && converged;
+        }
+        return result;
+    }
+
+    // The k eigenpairs of largest magnitude of a symmetric matrix by
+    // thick-restart Lanczos. The basis grows by one product with A per step,
+    // each new vector orthogonalized against all the others in one fused
+    // pass (twice), so the projected matrix H = Vᵀ A V is exact and its
+    // eigenpairs, the Ritz pairs, come from a small dense solve. A Ritz pair
+    // (θ, V s) has residual |β s_last|, β the norm of the last new vector,
+    // without touching A. When the basis is full and the top k have not
+    // converged, it restarts from the best Ritz vectors, which keeps their
+    // progress. Only A's lower triangle needs to be right in exact
+    // arithmetic, but products use all of it.
+    template < typename T, typename M >
+    eigenpairs<T> lanczos(const matrix_expression<T, M>& a, size_t k = 1, const options& opts = options()) {
+        static_assert(std::is_floating_point<T>::value, "eigenpairs need a floating point type");
+        detail::check(a, k);
+        const M& m = a.derived();
+        const size_t n = a.height();
+        const size_t size = std::min(n, std::max(k + 1, opts.subspace ? opts.subspace : std::max(2 * k, k + 16)));
+        // kept across a restart: the wanted pairs and half the rest
+        const size_t keep = std::min(size - 1, k + (size - k) / 2);
+
+        std::vector<vector<T>> basis (size + 1, vector<T>(n));
+        std::vector<vector<T>> ritz (size, vector<T>(n));
+        std::vector<double> h (size * size, 0.0);
+        std::vector<double> projected (size * size);
+        std::vector<double> s (size * size);
+        std::vector<double> coefficients (size + 1);
+        std::vector<size_t> order (size);
+        parallel::reducer sums (n, detail::vector_grain(), size + 1);
+
+        eigenpairs<T> result;
+        detail::random_start(basis[0], 1);
+        detail::scale(basis[0], 1 / std::sqrt(detail::orthogonalize(basis[0], basis, 0, coefficients, sums)), sums);
+        size_t start = 0;
+        size_t filled = size;
+        double beta = 0;
+        for (size_t restart = 0; ; ++restart) {
+            filled = size;
+            for (size_t j = start; j < size; ++j) {
+                vector<T>& w = basis[j + 1];
+                product_kernel<M>::multiply(m, basis[j], w);
+                ++result.products;
+                double ww = detail::orthogonalize(w, basis, j + 1, coefficients, sums);
+                for (size_t i = 0; i <= j; ++i) {
+                    h[i * size + j] = coefficients[i];
+                    h[j * size + i] = coefficients[i];
+                }
+                beta = std::sqrt(ww);
+                if(beta <= std::numeric_limits<double>::epsilon() * std::abs(h[j * size + j])) {
+                    // an invariant subspace: its Ritz pairs are exact
+                    beta = 0;
+                    filled = j + 1;
+                    break;
+                }
+                if(j + 1 < size) {
+                    detail::scale(w, 1 / beta, sums);
+                }
+            }
+
+            std::copy(h.begin(), h.end(), projected.begin());
+            detail::symmetric_eigen(projected.data(), s.data(), filled, size);
+            std::iota(order.begin(), order.begin() + filled, 0);
+            std::sort(order.begin(), order.begin() + filled, [&](size_t x, size_t y) {
+                return std::abs(projected[x * size + x]) > std::abs(projected[y * size + y]);
+            });
+            bool converged = filled >= k;
+            for (size_t i = 0; i < std::min(k, filled); ++i) {
+                const double theta = projected[order[i] * size + order[i]];
+                converged = converged && beta * std::abs(s[(filled - 1) * size + order[i]]) <= opts.tolerance * std::abs(theta);
+            }
+            const bool last = converged || filled < size || restart == opts.max_iterations;
+            const size_t count = last ? std::min(k, filled) : keep;
+
+            // Ritz vectors V s for the chosen pairs, all in one pass over the basis
+            parallel::for_range(0, n, detail::vector_grain() / std::max<size_t>(filled, 1) + 1, [&](size_t first, size_t last_row) {
+                for (size_t i = first; i < last_row; ++i) {
+                    for (size_t c = 0; c < count; ++c) {
+                        const double* column = s.data() + order[c];
+                        double val = 0;
+                        for (size_t l = 0; l < filled; ++l) {
+                            val += column[l * size] * basis[l][i];
+                        }
+                        ritz[c][i] = static_cast<T>(val);
+                    }
+                }
+            });
+
+            if(last) {
+                result.values.resize(count);
+                result.vectors.resize(count);
+                result.residuals.resize(count);
+                result.converged = converged;
+                for (size_t c = 0; c < count; ++c) {
+                    result.values[c] = static_cast<T>(projected[order[c] * size + order[c]]);
+                    result.vectors[c].swap(ritz[c]);
+                    result.residuals[c] = detail::residual(m, result.vectors[c], result.values[c], basis[0], sums);
+                    ++result.products;
+                }
+                return result;
+            }
+
+            // restart: H becomes diag(θ), and the last new vector continues
+            // the basis; its first step fills in the couplings β s_last
+            for (size_t c = 0; c < keep; ++c) {
+                basis[c].swap(ritz[c]);
+            }
+            basis[keep].swap(basis[size]);
+            detail::scale(basis[keep], 1 / beta, sums);
+            std::fill(h.begin(), h.end(), 0.0);
+            for (size_t c = 0; c < keep; ++c) {
+                h[c * size + c] = projected[order[c] * size + order[c]];
+            }
+            start = keep;
+        }
+    }
+}
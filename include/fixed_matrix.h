@@ -0,0 +1,222 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include "matrix_expr.h"
+
+// Loops with a trip count known at compile time, expanded by recursion so
+// that every iteration is a separate call the compiler inlines, whatever
+// its unrolling heuristics. f is called with 0, 1, ..., N - 1 in order.
+namespace unrolled {
+
+    template < size_t N >
+    struct loop {
+        template < typename F >
+        static void run(F& f) {
+            loop<N - 1>::run(f);
+            f(N - 1);
+        }
+    };
+
+    template <>
+    struct loop<0> {
+        template < typename F >
+        static void run(F&) {}
+    };
+
+    template < size_t N, typename F >
+    void for_each(F f) {
+        loop<N>::run(f);
+    }
+}
+
+template < typename T, size_t H, size_t W >
+class fixed_matrix;
+
+template < typename T, size_t H, size_t W >
+struct static_shape<fixed_matrix<T, H, W>> {
+    static constexpr size_t height = H;
+    static constexpr size_t width = W;
+};
+
+// H x W matrix stored inline, like std::array, for the small sizes of
+// geometry code. It is a matrix_expression like any other, but its
+// dimensions are part of its type: sums, differences and products of fixed
+// operands check them at compile time (see static_shape), and its own
+// products, transposes and norms are fully unrolled and computed eagerly.
+template < typename T, size_t H, size_t W >
+class fixed_matrix : public matrix_expression<T, fixed_matrix<T, H, W>> {
+public:
+    static_assert(H > 0 && W > 0, "Fixed matrices must be non-empty");
+
+    using value_type = T;
+    using row_type = std::array<T, W>;
+
+    static constexpr size_t rows = H;
+    static constexpr size_t cols = W;
+
+    // zero
+    fixed_matrix() : _rows() {}
+
+    explicit fixed_matrix(const std::array<std::array<T, W>, H>& arr) : _rows(arr) {}
+
+    template < typename Other >
+    fixed_matrix(const matrix_expression<T, Other>& other) { // NOLINT(google-explicit-constructor)
+        static_assert(extents_match(static_shape<Other>::height, H) && extents_match(static_shape<Other>::width, W),
+                      "Expression dimensions do not match the fixed matrix");
+        const Other& src = other.derived();
+        assert(src.height() == H && src.width() == W);
+        unrolled::for_each<H>([&](size_t i) {
+            unrolled::for_each<W>([&](size_t j) {
+                _rows[i][j] = src.get(i, j);
+            });
+        });
+    }
+
+    template < typename Other >
+    fixed_matrix& operator=(const matrix_expression<T, Other>& other) {
+        // small enough to always evaluate aside, so any aliasing is fine
+        return *this = fixed_matrix(other);
+    }
+
+    template < typename S, typename Other >
+    fixed_matrix& operator+=(const matrix_expression<S, Other>& other) {
+        return *this = *this + other.derived();
+    }
+
+    template < typename S, typename Other >
+    fixed_matrix& operator-=(const matrix_expression<S, Other>& other) {
+        return *this = *this - other.derived();
+    }
+
+    template < typename S >
+    fixed_matrix& operator*=(const S& scalar) {
+        return *this = *this * scalar;
+    }
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(fixed_matrix);
+        return _rows[row][col];
+    }
+
+    void set(size_t row, size_t col, const T& val) {
+        _rows[row][col] = val;
+    }
+
+    row_type& operator[](size_t row) {
+        return _rows[row];
+    }
+
+    const row_type& operator[](size_t row) const {
+        return _rows[row];
+    }
+
+    static constexpr size_t height() {
+        return H;
+    }
+
+    static constexpr size_t width() {
+        return W;
+    }
+
+    static constexpr bool isSquared() {
+        return H == W;
+    }
+
+    T* data() noexcept {
+        return _rows[0].data();
+    }
+
+    const T* data() const noexcept {
+        return _rows[0].data();
+    }
+
+    // stored matrices are already evaluated
+    const fixed_matrix& eval() const {
+        return *this;
+    }
+
+    using matrix_expression<T, fixed_matrix>::dotProduct;
+
+    template < size_t K >
+    fixed_matrix<T, H, K> dotProduct(const fixed_matrix<T, W, K>& that) const {
+        fixed_matrix<T, H, K> result;
+        unrolled::for_each<H>([&](size_t i) {
+            unrolled::for_each<K>([&](size_t j) {
+                T val {0};
+                unrolled::for_each<W>([&](size_t k) {
+                    val += _rows[i][k] * that[k][j];
+                });
+                result[i][j] = val;
+            });
+        });
+        return result;
+    }
+
+    fixed_matrix<T, W, H> transpose() const {
+        fixed_matrix<T, W, H> result;
+        unrolled::for_each<H>([&](size_t i) {
+            unrolled::for_each<W>([&](size_t j) {
+                result[j][i] = _rows[i][j];
+            });
+        });
+        return result;
+    }
+
+    // norms with the same meaning as matrix's
+
+    double infinityNorm() const {
+        double result = _rows[0][0];
+        for_each_element([&](T val) {
+            if (result < val) {
+                result = val;
+            }
+        });
+        return result;
+    }
+
+    double twoNorm() const {
+        double result = 0;
+        for_each_element([&](T val) {
+            result += double(val) * double(val);
+        });
+        return std::sqrt(result);
+    }
+
+    double singleNorm() const {
+        double result = 0;
+        for_each_element([&](T val) {
+            result += double(val);
+        });
+        return result;
+    }
+
+    static fixed_matrix identity() {
+        static_assert(H == W, "Identity matrices are square");
+        fixed_matrix mx;
+        unrolled::for_each<H>([&](size_t i) {
+            mx._rows[i][i] = 1;
+        });
+        return mx;
+    }
+
+private:
+    std::array<std::array<T, W>, H> _rows;
+
+    template < typename F >
+    void for_each_element(F f) const {
+        unrolled::for_each<H>([&](size_t i) {
+            unrolled::for_each<W>([&](size_t j) {
+                f(_rows[i][j]);
+            });
+        });
+    }
+};
+
+template < typename T, size_t H, size_t W >
+constexpr size_t fixed_matrix<T, H, W>::rows;
+
+template < typename T, size_t H, size_t W >
+constexpr size_t fixed_matrix<T, H, W>::cols;
@@ -1,30 +1,56 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <vector>
 #include <valarray>
+#include "dense_storage.h"
+#include "gemm.h"
 #include "matrix.h"
+#include "parallel.h"
+#include "simd.h"
 
-template < typename T >
-class full_matrix : public matrix<T, full_matrix<T>> {
-public:
+template < typename T, typename Alloc >
+struct view_traits<full_matrix<T, Alloc>> {
+    using type = dense_view<T, true>;
+    using const_type = dense_view<T, false>;
+};
 
-    using row = std::vector<T>;
+// Dense row-major matrix. Its buffer comes from Alloc, e.g. an
+// arena_allocator to keep the temporaries of a loop off the heap.
+template < typename T, typename Alloc >
+class full_matrix : public matrix<T, full_matrix<T, Alloc>> {
+public:
 
-    using grid = std::vector< row >;
+    using storage = dense_storage<T, Alloc>;
+    using allocator_type = Alloc;
 
     full_matrix(const full_matrix&) noexcept = default;
 
     full_matrix(full_matrix&&) noexcept = default;
 
+    full_matrix& operator=(const full_matrix& other) {
+        return this->assign(other);
+    }
+
+    full_matrix& operator=(full_matrix&&) noexcept = default;
+
+    template < typename Other >
+    full_matrix& operator=(const matrix_expression<T, Other>& other) {
+        return this->assign(other);
+    }
+
     template < typename Other >
-    full_matrix(const matrix_expression<T, Other>& other) noexcept : _grid(other.height(), row(other.width(), {}))  {
-        this->copy_from(other);
+    full_matrix(const matrix_expression<T, Other>& other, const Alloc& alloc = Alloc()) noexcept // NOLINT(google-explicit-constructor)
+            : _storage(other.height(), other.width(), T{}, alloc)  {
+        MATRIX_TIME_MATERIALIZATION("full_matrix", Other, height(), width());
+        evaluate(static_cast<const Other&>(other));
     }
 
-    full_matrix(size_t h, size_t w, T def = {}) : _grid(h, row(w, def)) {}
+    full_matrix(size_t h, size_t w, T def = {}, const Alloc& alloc = Alloc()) : _storage(h, w, def, alloc) {}
 
     template < size_t H, size_t W >
-    explicit full_matrix(const std::array<std::array<T, W>, H>& arr) : _grid(H, row(W, {})) {
+    explicit full_matrix(const std::array<std::array<T, W>, H>& arr) {
         static_assert(H > 0 && W > 0, "Arrays for matrix initialization must be-non empty");
         init(arr, H, W);
     }
@@ -35,26 +61,53 @@ public:
         }
     }
 
-    full_matrix(const std::initializer_list<vector<T>> list) : _grid(list) {
+    full_matrix(const std::initializer_list<vector<T>> list) {
+        init(std::vector<vector<T>>(list), list.size(), list.size() > 0 ? list.begin()->size() : 0);
     }
 
-    T get(size_t row, size_t col) const override {
-        return _grid[row][col];
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(full_matrix);
+        return _storage(row, col);
     }
 
-    void set(size_t row, size_t col, const T& val) override {
-        _grid[row][col] = val;
+    void set(size_t row, size_t col, const T& val) {
+        _storage(row, col) = val;
     }
 
-    size_t height() const override {
-        return _grid.size();
+    // see matrix::assign, which checks that src only reads this element-wise
+    template < typename Other >
+    void store(const Other& src) {
+        if(height() != src.height() || width() != src.width()) {
+            _storage = storage(src.height(), src.width(), T{}, _storage.get_allocator());
+        }
+        MATRIX_TIME_MATERIALIZATION("full_matrix assign", Other, height(), width());
+        evaluate(src);
     }
 
-    size_t width() const override {
-        if(_grid.empty()) {
-            return 0;
-        }
-        return _grid[0].size();
+    size_t height() const {
+        return _storage.height();
+    }
+
+    size_t width() const {
+        return _storage.width();
+    }
+
+    // raw storage access, element (r, c) is at data()[r * stride() + c]
+
+    T* data() noexcept {
+        return _storage.data();
+    }
+
+    const T* data() const noexcept {
+        return _storage.data();
+    }
+
+    size_t stride() const noexcept {
+        return _storage.stride();
+    }
+
+    Alloc get_allocator() const {
+        return _storage.get_allocator();
     }
 
     // special generators
@@ -72,16 +125,199 @@ public:
     }
 
 private:
-    grid _grid;
+    storage _storage;
+
+    template < typename M >
+    using element_of = typename std::decay<decltype(std::declval<const M&>().get(0, 0))>::type;
+
+    // element-wise expressions are evaluated a row at a time straight into
+    // the buffer, which the compiler can fuse into a single vectorized loop;
+    // blocks of rows go to different threads once they cost enough to evaluate
+    template < typename Other >
+    void evaluate(const matrix_expression<T, Other>& other) {
+        const Other& src = other.derived();
+        const size_t w = width();
+        parallel::for_range(0, height(), parallel::grain_for(w * src.element_cost()), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                T* out = _storage.row_data(i);
+                for (size_t j = 0; j < w; ++j) {
+                    out[j] = src.get(i, j);
+                }
+            }
+        });
+    }
+
+    // whole stored operands are combined a row at a time by the vectorized kernels
+
+    template < typename A1, typename A2 >
+    void evaluate(const matrix_sum<T, full_matrix<T, A1>, full_matrix<T, A2>>& sum) {
+        const full_matrix<T, A1>& a = sum.lhs();
+        const full_matrix<T, A2>& b = sum.rhs();
+        for_each_row([&](size_t i, T* out) {
+            simd::add(width(), a.data() + i * a.stride(), b.data() + i * b.stride(), out);
+        });
+    }
+
+    template < typename A1, typename A2 >
+    void evaluate(const matrix_difference<T, full_matrix<T, A1>, full_matrix<T, A2>>& difference) {
+        const full_matrix<T, A1>& a = difference.lhs();
+        const full_matrix<T, A2>& b = difference.rhs();
+        for_each_row([&](size_t i, T* out) {
+            simd::sub(width(), a.data() + i * a.stride(), b.data() + i * b.stride(), out);
+        });
+    }
+
+    template < typename A >
+    void evaluate(const matrix_scalar_product<T, full_matrix<T, A>, T>& product) {
+        const full_matrix<T, A>& a = product.lhs();
+        const T s = product.rhs();
+        for_each_row([&](size_t i, T* out) {
+            simd::scale(width(), a.data() + i * a.stride(), s, out);
+        });
+    }
+
+    // each thread writes a block of rows, reading the matching source columns
+    template < typename A >
+    void evaluate(const matrix_transpose<T, full_matrix<T, A>>& transpose) {
+        const full_matrix<T, A>& a = transpose.operand();
+        parallel::for_range(0, height(), parallel::grain_for(width()), [&](size_t first, size_t last) {
+            simd::transpose(a.height(), last - first, a.data() + first, a.stride(), data() + first * stride(), stride());
+        });
+    }
+
+    // products accumulate into the buffer, which may hold an earlier value
+    void clear() {
+        for_each_row([&](size_t, T* out) {
+            std::fill(out, out + width(), T{});
+        });
+    }
+
+    template < typename F >
+    void for_each_row(F f) {
+        parallel::for_range(0, height(), parallel::grain_for(width()), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                f(i, _storage.row_data(i));
+            }
+        });
+    }
+
+    // products of operands holding T go through the blocked kernel instead of
+    // computing every element as an independent dot product
+    template < typename M, typename S >
+    void evaluate(const matrix_vector_product<T, M, S>& product) {
+        scratch<vector<T>, full_matrix> result(height());
+        vector<T>& res = result.buffer();
+        product_kernel<M>::multiply(product.lhs(), product.rhs(), res);
+        for (size_t i = 0; i < height(); ++i) {
+            _storage(i, 0) = res[i];
+        }
+    }
+
+    template < typename M1, typename M2 >
+    using blocked_product = std::integral_constant<bool,
+            std::is_same<element_of<M1>, T>::value && std::is_same<element_of<M2>, T>::value &&
+            !product_kernel<M1>::has_matrix_product>;
+
+    template < typename M1, typename M2 >
+    using kernel_product = std::integral_constant<bool,
+            std::is_same<element_of<M1>, T>::value && std::is_same<element_of<M2>, T>::value &&
+            product_kernel<M1>::has_matrix_product>;
+
+    // sparse left operands multiply a dense right operand by their stored entries only
+    template < typename M1, typename M2 >
+    typename std::enable_if<kernel_product<M1, M2>::value>::type
+    evaluate(const matrix_dot_product<T, M1, M2>& product) {
+        clear();
+        const product_operand<M2>& rhs = product.rhs();
+        if(rhs.evaluated()) {
+            product_kernel<M1>::multiply(product.lhs().expression(), *rhs.evaluated(), *this);
+        } else {
+            multiply_kernel(product.lhs().expression(), rhs.expression());
+        }
+    }
+
+    template < typename M1, typename A >
+    void multiply_kernel(const M1& a, const full_matrix<T, A>& b) {
+        product_kernel<M1>::multiply(a, b, *this);
+    }
+
+    template < typename M1, typename M2 >
+    void multiply_kernel(const M1& a, const M2& b) {
+        product_kernel<M1>::multiply(a, full_matrix(b), *this);
+    }
+
+    template < typename M1, typename M2 >
+    typename std::enable_if<blocked_product<M1, M2>::value>::type
+    evaluate(const matrix_dot_product<T, M1, M2>& product) {
+        clear();
+        const product_operand<M1>& lhs = product.lhs();
+        if(lhs.evaluated()) {
+            multiply_by(gemm_source(*lhs.evaluated()), product.rhs(), lhs.width());
+        } else {
+            multiply_by(gemm_source(lhs.expression()), product.rhs(), lhs.width());
+        }
+    }
+
+    template < typename SrcA, typename M >
+    void multiply_by(const SrcA& a, const product_operand<M>& b, size_t k) {
+        if(b.evaluated()) {
+            gemm::multiply<T>(height(), width(), k, a, gemm_source(*b.evaluated()), data(), stride());
+        } else {
+            gemm::multiply<T>(height(), width(), k, a, gemm_source(b.expression()), data(), stride());
+        }
+    }
 
     template < typename Iterable >
     void init(const Iterable& container, size_t height, size_t width) {
-        _grid.resize(height);
-        for (auto i = 0; i < height; ++i) {
-            _grid[i].resize(width);
-            for (auto j = 0; j < width; ++j) {
-                (*this)[i][j] = container[i][j];
+        _storage = storage(height, width);
+        for (size_t i = 0; i < height; ++i) {
+            for (size_t j = 0; j < width; ++j) {
+                _storage(i, j) = container[i][j];
             }
         }
     }
 };
+
+template < typename T, typename Alloc >
+struct is_contiguous<full_matrix<T, Alloc>> : std::true_type {};
+
+template < typename T, typename Alloc >
+struct product_kernel<full_matrix<T, Alloc>> {
+    static constexpr bool has_matrix_product = false;
+
+    template < typename S >
+    static void multiply(const full_matrix<T, Alloc>& a, const vector<S>& x, vector<T>& y) {
+        parallel::for_range(0, a.height(), parallel::grain_for(a.width()), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                const T* row = a.data() + i * a.stride();
+                T val {0};
+                for (size_t k = 0; k < x.size(); ++k) {
+                    val += row[k] * x[k];
+                }
+                y[i] = val;
+            }
+        });
+    }
+};
+
+template < typename T, typename Alloc >
+gemm::strided_source<T> gemm_source(const full_matrix<T, Alloc>& m) {
+    return {m.data(), m.stride(), 1};
+}
+
+template < typename T, typename Alloc >
+gemm::strided_source<T> gemm_source(const matrix_transpose<T, full_matrix<T, Alloc>>& m) {
+    return {m.operand().data(), 1, m.operand().stride()};
+}
+
+// by memory, so that views of the same buffer are recognized
+
+template < typename T, typename Alloc >
+alias_target alias_target_of(const full_matrix<T, Alloc>& m) {
+    return dense_target(&m, m.data(), m.height(), m.width(), m.stride(), 1);
+}
+
+template < typename T, typename Alloc >
+aliasing alias_of(const full_matrix<T, Alloc>& m, const alias_target& target) {
+    return alias_of_dense(m.data(), m.height(), m.width(), m.stride(), 1, target);
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "dense_storage.h"
+#include "parallel.h"
+
+// Blocked matrix product C += A * B in the GotoBLAS/BLIS layout: B is packed
+// into KC x NC panels (sized for L3), A into MC x KC blocks (sized for L2),
+// and an MR x NR register tile is accumulated from those packed panels (L1).
+// Each element of C still sums its k terms in increasing k order starting
+// from the value already in C, so results are the same as the lazy product.
+// The MR-row slivers of A under each packed B panel are split across threads,
+// each packing its own blocks of A.
+namespace gemm {
+
+    template < typename T >
+    struct blocking {
+        static constexpr size_t MR = 4;
+        static constexpr size_t NR = matrix_alignment / sizeof(T) < 4 ? 4 :
+                                     matrix_alignment / sizeof(T) > 16 ? 16 : matrix_alignment / sizeof(T);
+        static constexpr size_t KC = 256;
+        static constexpr size_t MC = (256 * 1024 / (KC * sizeof(T)) + MR - 1) / MR * MR;
+        static constexpr size_t NC = 4096;
+    };
+
+    template < typename T > constexpr size_t blocking<T>::MR;
+    template < typename T > constexpr size_t blocking<T>::NR;
+    template < typename T > constexpr size_t blocking<T>::KC;
+    template < typename T > constexpr size_t blocking<T>::MC;
+    template < typename T > constexpr size_t blocking<T>::NC;
+
+    template < typename T >
+    using buffer = std::vector<T, aligned_allocator<T>>;
+
+    // tags of the packing buffers each thread keeps between products
+    struct a_panel {};
+    struct b_panel {};
+
+    // operand read straight from memory with arbitrary row and column strides
+    template < typename T >
+    struct strided_source {
+        const T* data;
+        size_t row_stride;
+        size_t col_stride;
+
+        T operator()(size_t row, size_t col) const {
+            return data[row * row_stride + col * col_stride];
+        }
+    };
+
+    // operand read through the expression interface, once per packing
+    template < typename T, typename M >
+    struct expr_source {
+        const M& m;
+
+        T operator()(size_t row, size_t col) const {
+            return m.get(row, col);
+        }
+    };
+
+    // another source with its sign flipped, for C -= A * B
+    template < typename T, typename Src >
+    struct negated_source {
+        Src src;
+
+        T operator()(size_t row, size_t col) const {
+            return -src(row, col);
+        }
+    };
+
+    // mc x kc block of A starting at (ic, pc), as MR-row slivers stored column by column
+    template < typename T, typename Src >
+    void pack_a(const Src& a, size_t ic, size_t pc, size_t mc, size_t kc, T* dst) {
+        constexpr size_t MR = blocking<T>::MR;
+        for (size_t ir = 0; ir < mc; ir += MR) {
+            size_t mr = std::min(MR, mc - ir);
+            for (size_t p = 0; p < kc; ++p) {
+                for (size_t i = 0; i < MR; ++i) {
+                    *dst++ = i < mr ? a(ic + ir + i, pc + p) : T{0};
+                }
+            }
+        }
+    }
+
+    // kc x nc panel of B starting at (pc, jc), as NR-column slivers stored row by row
+    template < typename T, typename Src >
+    void pack_b(const Src& b, size_t pc, size_t jc, size_t kc, size_t nc, T* dst) {
+        constexpr size_t NR = blocking<T>::NR;
+        for (size_t jr = 0; jr < nc; jr += NR) {
+            size_t nr = std::min(NR, nc - jr);
+            for (size_t p = 0; p < kc; ++p) {
+                for (size_t j = 0; j < NR; ++j) {
+                    *dst++ = j < nr ? b(pc + p, jc + jr + j) : T{0};
+                }
+            }
+        }
+    }
+
+    template < typename T >
+    void micro_kernel(size_t kc, const T* a, const T* b, T* c, size_t ldc, size_t mr, size_t nr) {
+        constexpr size_t MR = blocking<T>::MR;
+        constexpr size_t NR = blocking<T>::NR;
+        T acc[MR][NR];
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                acc[i][j] = i < mr && j < nr ? c[i * ldc + j] : T{0};
+            }
+        }
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < MR; ++i) {
+                for (size_t j = 0; j < NR; ++j) {
+                    acc[i][j] += a[i] * b[j];
+                }
+            }
+            a += MR;
+            b += NR;
+        }
+        for (size_t i = 0; i < mr; ++i) {
+            for (size_t j = 0; j < nr; ++j) {
+                c[i * ldc + j] = acc[i][j];
+            }
+        }
+    }
+
+    // C (m x n, row-major with leading dimension ldc) += A (m x k) * B (k x n)
+    template < typename T, typename SrcA, typename SrcB >
+    void multiply(size_t m, size_t n, size_t k, const SrcA& a, const SrcB& b, T* c, size_t ldc) {
+        using blk = blocking<T>;
+        if(m == 0 || n == 0 || k == 0) {
+            return;
+        }
+        size_t nc_max = std::min(blk::NC, (n + blk::NR - 1) / blk::NR * blk::NR);
+        size_t kc_max = std::min(blk::KC, k);
+        size_t slivers = (m + blk::MR - 1) / blk::MR;
+        scratch<buffer<T>, b_panel> b_pack(kc_max * nc_max);
+
+        for (size_t jc = 0; jc < n; jc += blk::NC) {
+            size_t nc = std::min(blk::NC, n - jc);
+            for (size_t pc = 0; pc < k; pc += blk::KC) {
+                size_t kc = std::min(blk::KC, k - pc);
+                pack_b<T>(b, pc, jc, kc, nc, b_pack.data());
+                parallel::for_range(0, slivers, parallel::grain_for(blk::MR * kc * nc), [&](size_t first, size_t last) {
+                    size_t m_first = first * blk::MR;
+                    size_t m_last = std::min(m, last * blk::MR);
+                    scratch<buffer<T>, a_panel> a_pack(std::min(blk::MC, (last - first) * blk::MR) * kc);
+                    for (size_t ic = m_first; ic < m_last; ic += blk::MC) {
+                        size_t mc = std::min(blk::MC, m_last - ic);
+                        pack_a<T>(a, ic, pc, mc, kc, a_pack.data());
+                        for (size_t jr = 0; jr < nc; jr += blk::NR) {
+                            for (size_t ir = 0; ir < mc; ir += blk::MR) {
+                                micro_kernel<T>(kc, a_pack.data() + ir * kc, b_pack.data() + jr * kc,
+                                                c + (ic + ir) * ldc + jc + jr, ldc,
+                                                std::min(blk::MR, mc - ir), std::min(blk::NR, nc - jr));
+                            }
+                        }
+                    }
+                });
+            }
+        }
+    }
+}
@@ -0,0 +1,296 @@
+#pragma once
+
+// Opt-in profiling of expression evaluation. Building with
+// MATRIX_INSTRUMENTATION defined counts every get() per expression node and
+// storage type, counts the allocations and bytes of dense buffers, and times
+// every materialization (evaluating an expression into storage). Without it
+// the hooks below expand to nothing.
+//
+// The macro changes inline code, so every translation unit of a program
+// must be built with the same setting.
+
+#ifdef MATRIX_INSTRUMENTATION
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <typeinfo>
+#include <vector>
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#endif
+
+namespace instrumentation {
+
+    template < typename T >
+    std::string type_name() {
+        const char* mangled = typeid(T).name();
+#if defined(__GNUC__)
+        int status = 0;
+        std::unique_ptr<char, void (*)(void*)> demangled(
+                abi::__cxa_demangle(mangled, nullptr, nullptr, &status), std::free);
+        if(status == 0) {
+            return demangled.get();
+        }
+#endif
+        return mangled;
+    }
+
+    // one evaluation of an expression into storage
+    struct materialization {
+        std::string kind;
+        std::string expression;
+        size_t height;
+        size_t width;
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        size_t thread;
+    };
+
+    struct node_counter {
+        explicit node_counter(std::string type) : name(std::move(type)) {}
+
+        std::string name;
+        std::atomic<uint64_t> evaluations {0};
+    };
+
+    class registry {
+    public:
+        static registry& instance() {
+            static registry r;
+            return r;
+        }
+
+        node_counter& add_node(std::string name) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _nodes.emplace_back(new node_counter(std::move(name)));
+            return *_nodes.back();
+        }
+
+        void allocated(size_t bytes) {
+            ++_allocations;
+            _bytes += bytes;
+            uint64_t live = _live += bytes;
+            uint64_t peak = _peak.load();
+            while (live > peak && !_peak.compare_exchange_weak(peak, live)) {}
+        }
+
+        void deallocated(size_t bytes) {
+            _live -= bytes;
+        }
+
+        void record(materialization m) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _materializations.push_back(std::move(m));
+        }
+
+        uint64_t now_ns() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - _epoch).count();
+        }
+
+        size_t thread_index() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _threads.emplace(std::this_thread::get_id(), _threads.size()).first;
+            return it->second;
+        }
+
+        // evaluations per node type, summed over types with the same name
+        std::map<std::string, uint64_t> evaluations() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::map<std::string, uint64_t> result;
+            for (const auto& node : _nodes) {
+                result[node->name] += node->evaluations.load();
+            }
+            return result;
+        }
+
+        std::vector<materialization> materializations() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _materializations;
+        }
+
+        uint64_t allocations() const {
+            return _allocations;
+        }
+
+        uint64_t allocated_bytes() const {
+            return _bytes;
+        }
+
+        uint64_t peak_bytes() const {
+            return _peak;
+        }
+
+        // clears every count except the bytes still allocated
+        void reset() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for (const auto& node : _nodes) {
+                node->evaluations = 0;
+            }
+            _materializations.clear();
+            _allocations = 0;
+            _bytes = 0;
+            _peak = _live.load();
+        }
+
+    private:
+        registry() : _epoch(std::chrono::steady_clock::now()) {}
+
+        mutable std::mutex _mutex;
+        std::vector<std::unique_ptr<node_counter>> _nodes;
+        std::vector<materialization> _materializations;
+        std::map<std::thread::id, size_t> _threads;
+        std::atomic<uint64_t> _allocations {0};
+        std::atomic<uint64_t> _bytes {0};
+        std::atomic<uint64_t> _live {0};
+        std::atomic<uint64_t> _peak {0};
+        std::chrono::steady_clock::time_point _epoch;
+    };
+
+    template < typename Node >
+    node_counter& counter() {
+        static node_counter& c = registry::instance().add_node(type_name<Node>());
+        return c;
+    }
+
+    template < typename Node >
+    void count_evaluation() {
+        counter<Node>().evaluations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // records the time between its construction and destruction
+    class scoped_timer {
+    public:
+        scoped_timer(const char* kind, std::string expression, size_t height, size_t width)
+                : _m{kind, std::move(expression), height, width, registry::instance().now_ns(), 0, 0} {}
+
+        scoped_timer(const scoped_timer&) = delete;
+
+        ~scoped_timer() {
+            registry& r = registry::instance();
+            _m.duration_ns = r.now_ns() - _m.start_ns;
+            _m.thread = r.thread_index();
+            r.record(std::move(_m));
+        }
+
+    private:
+        materialization _m;
+    };
+
+    inline void reset() {
+        registry::instance().reset();
+    }
+
+    // Human-readable summary: allocation totals, element evaluations per
+    // node type (most first) and materializations grouped by kind and type.
+    inline void report(std::ostream& out) {
+        registry& r = registry::instance();
+        out << "allocations: " << r.allocations() << ", bytes: " << r.allocated_bytes()
+            << ", peak live bytes: " << r.peak_bytes() << "\n";
+
+        std::map<std::string, uint64_t> counts = r.evaluations();
+        std::vector<std::pair<std::string, uint64_t>> nodes(counts.begin(), counts.end());
+        std::stable_sort(nodes.begin(), nodes.end(),
+                         [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+                             return a.second > b.second;
+                         });
+        out << "element evaluations:\n";
+        for (const auto& node : nodes) {
+            if(node.second > 0) {
+                out << "  " << node.second << "  " << node.first << "\n";
+            }
+        }
+
+        struct total {
+            size_t count = 0;
+            uint64_t ns = 0;
+            uint64_t max_ns = 0;
+        };
+        std::map<std::string, total> totals;
+        for (const materialization& m : r.materializations()) {
+            total& t = totals[m.kind + "  " + m.expression];
+            ++t.count;
+            t.ns += m.duration_ns;
+            t.max_ns = std::max(t.max_ns, m.duration_ns);
+        }
+        out << "materializations (count, total ms, max ms):\n";
+        for (const auto& entry : totals) {
+            out << "  " << entry.second.count << "  " << entry.second.ns / 1e6 << "  " << entry.second.max_ns / 1e6
+                << "  " << entry.first << "\n";
+        }
+    }
+
+    inline std::string json_escape(const std::string& s) {
+        std::string result;
+        for (char c : s) {
+            if(c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+
+    // microseconds with a fixed three-digit fraction, exact however long the
+    // program has run, where a double would lose digits or turn scientific
+    inline void write_microseconds(std::ostream& out, uint64_t ns) {
+        char fill = out.fill('0');
+        out << ns / 1000 << '.' << std::setw(3) << ns % 1000;
+        out.fill(fill);
+    }
+
+    // Materializations in the Chrome trace event format, for chrome://tracing
+    // or Perfetto, with the final evaluation counts as metadata.
+    inline void write_trace(std::ostream& out) {
+        registry& r = registry::instance();
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (const materialization& m : r.materializations()) {
+            out << (first ? "" : ",") << "\n{\"name\":\"" << json_escape(m.kind)
+                << "\",\"cat\":\"matrix\",\"ph\":\"X\",\"pid\":0,\"tid\":" << m.thread
+                << ",\"ts\":";
+            write_microseconds(out, m.start_ns);
+            out << ",\"dur\":";
+            write_microseconds(out, m.duration_ns);
+            out << ",\"args\":{\"expression\":\"" << json_escape(m.expression)
+                << "\",\"height\":" << m.height << ",\"width\":" << m.width << "}}";
+            first = false;
+        }
+        out << "\n],\"metadata\":{\"allocations\":" << r.allocations() << ",\"allocated_bytes\":" << r.allocated_bytes()
+            << ",\"peak_bytes\":" << r.peak_bytes() << ",\"evaluations\":{";
+        first = true;
+        for (const auto& node : r.evaluations()) {
+            out << (first ? "" : ",") << "\n\"" << json_escape(node.first) << "\":" << node.second;
+            first = false;
+        }
+        out << "\n}}}\n";
+    }
+}
+
+#define MATRIX_COUNT_EVALUATION(Node) ::instrumentation::count_evaluation<Node>()
+#define MATRIX_COUNT_ALLOCATION(bytes) ::instrumentation::registry::instance().allocated(bytes)
+#define MATRIX_COUNT_DEALLOCATION(bytes) ::instrumentation::registry::instance().deallocated(bytes)
+#define MATRIX_TIME_MATERIALIZATION(kind, Expression, height, width) \
+    ::instrumentation::scoped_timer matrix_materialization_timer(  \
+            kind, ::instrumentation::type_name<Expression>(), height, width)
+
+#else
+
+#define MATRIX_COUNT_EVALUATION(Node) ((void) 0)
+// the arguments are still named, so parameters only passed here stay used
+#define MATRIX_COUNT_ALLOCATION(bytes) ((void) (bytes))
+#define MATRIX_COUNT_DEALLOCATION(bytes) ((void) (bytes))
+#define MATRIX_TIME_MATERIALIZATION(kind, Expression, height, width) ((void) (kind), (void) (height), (void) (width))
+
+#endif
@@ -0,0 +1,723 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "compressed_matrix.h"
+#include "full_matrix.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "sparse_matrix.h"
+#include "sparse_ops.h"
+#include "vectors.h"
+
+// Iterative solvers for A x = b, with x holding the initial guess and left
+// with the result: the stationary Jacobi and SOR iterations (Gauss-Seidel
+// for omega = 1), conjugate gradients for symmetric positive definite A and
+// BiCGSTAB for general A, the last two with a preconditioner M ~ A.
+//
+// A is any matrix: products go through its product_kernel, and the
+// stationary methods walk its rows, stored entries only for full_matrix,
+// csr_matrix and sparse_matrix. Every vector is allocated before the first
+// iteration and the history reserved for all of them, so iterating
+// allocates nothing. Each vector update is one pass that also accumulates
+// the dot products the next step needs, summed by parallel::reducer so results
+// do not depend on how threads pick up the work.
+namespace iterative {
+
+    struct options {
+        explicit options(size_t max_iterations = 1000, double tolerance = 1e-8, double omega = 1)
+                : max_iterations(max_iterations), tolerance(tolerance), omega(omega) {}
+
+        size_t max_iterations;
+        // stop once ||b - A x|| <= tolerance ||b||
+        double tolerance;
+        // SOR relaxation factor, in (0, 2)
+        double omega;
+    };
+
+    struct convergence {
+        bool converged = false;
+        size_t iterations = 0;
+        // relative residual ||b - A x|| / ||b|| of the result
+        double residual = 0;
+        // the relative residual before the first iteration and after each;
+        // sor records an estimate until the last (see there)
+        std::vector<double> history;
+    };
+
+    namespace detail {
+
+        // elements of a vector pass worth a chunk
+        inline size_t vector_grain() {
+            return parallel::grain_for(4);
+        }
+
+        template < typename T >
+        double dot(const vector<T>& a, const vector<T>& b, parallel::reducer& sums) {
+            return sums.sum([&](size_t first, size_t last) {
+                double s = 0;
+                for (size_t i = first; i < last; ++i) {
+                    s += static_cast<double>(a[i]) * b[i];
+                }
+                return s;
+            });
+        }
+
+        // f(col, value) for the entries of a row, in increasing column order
+
+        template < typename T, typename A, typename F >
+        void for_each_in_row(const full_matrix<T, A>& a, size_t i, F f) {
+            const T* row = a.data() + i * a.stride();
+            for (size_t j = 0; j < a.width(); ++j) {
+                f(j, row[j]);
+            }
+        }
+
+        template < typename T, typename F >
+        void for_each_in_row(const compressed_matrix<T, true>& a, size_t i, F f) {
+            for (size_t k = a.offsets()[i]; k < a.offsets()[i + 1]; ++k) {
+                f(a.indices()[k], a.values()[k]);
+            }
+        }
+
+        template < typename T, typename A, typename F >
+        void for_each_in_row(const sparse_matrix<T, A>& a, size_t i, F f) {
+            // missing entries that do not read as zero are entries too
+            if(a.default_value() != T{0}) {
+                for (size_t j = 0; j < a.width(); ++j) {
+                    f(j, a.get(i, j));
+                }
+                return;
+            }
+            auto end = a.entries().lower_bound(coord(i + 1, 0));
+            for (auto it = a.entries().lower_bound(coord(i, 0)); it != end; ++it) {
+                f(it->first.second, it->second);
+            }
+        }
+
+        template < typename T, typename M, typename F >
+        void for_each_in_row(const matrix_expression<T, M>& a, size_t i, F f) {
+            for (size_t j = 0; j < a.width(); ++j) {
+                T val = a.derived().get(i, j);
+                if(val != T{0}) {
+                    f(j, val);
+                }
+            }
+        }
+
+        // element reads per row, to size chunks of row passes
+
+        template < typename T, typename M >
+        double row_cost(const matrix_expression<T, M>& a) {
+            return a.width() * a.element_cost();
+        }
+
+        template < typename T >
+        double row_cost(const compressed_matrix<T, true>& a) {
+            return a.height() == 0 ? 1 : static_cast<double>(a.values().size()) / a.height();
+        }
+
+        template < typename T, typename A >
+        double row_cost(const sparse_matrix<T, A>& a) {
+            // plus the seek to the row, or to every entry with a non-zero default
+            const double seek = std::log2(a.entries().size() + 1.0);
+            if(a.default_value() != T{0}) {
+                return a.width() * seek;
+            }
+            return a.height() == 0 ? 1 : static_cast<double>(a.entries().size()) / a.height() + seek;
+        }
+
+        // 1 / a_ii; throws std::runtime_error on a zero diagonal entry
+        template < typename T, typename M >
+        void inverse_diagonal(const M& a, vector<T>& d) {
+            d.assign(a.height(), T{0});
+            for (size_t i = 0; i < a.height(); ++i) {
+                for_each_in_row(a, i, [&](size_t j, T val) {
+                    if(j == i) {
+                        d[i] = val;
+                    }
+                });
+                if(d[i] == T{0}) {
+                    throw std::runtime_error("zero diagonal entry");
+                }
+                d[i] = T{1} / d[i];
+            }
+        }
+
+        // throws std::runtime_error if a is not square or b does not match it;
+        // an x of another size starts from zero
+        template < typename T, typename M >
+        void check(const matrix_expression<T, M>& a, const vector<T>& b, vector<T>& x) {
+            if(a.height() != a.width()) {
+                throw std::runtime_error("iterative solve with a non-square matrix");
+            }
+            if(b.size() != a.height()) {
+                throw std::runtime_error("right-hand side size does not match the matrix");
+            }
+            if(x.size() != b.size()) {
+                x.assign(b.size(), T{0});
+            }
+        }
+
+        // ||b||, or 0 after setting x to the zero solution
+        template < typename T >
+        double start(const vector<T>& b, vector<T>& x, const options& opts, convergence& result, parallel::reducer& sums) {
+            result.history.reserve(opts.max_iterations + 1);
+            double b_norm = std::sqrt(dot(b, b, sums));
+            if(b_norm == 0) {
+                std::fill(x.begin(), x.end(), T{0});
+                result.converged = true;
+                result.history.push_back(0);
+            }
+            return b_norm;
+        }
+
+        inline bool record(convergence& result, double residual, const options& opts) {
+            result.residual = residual;
+            result.history.push_back(residual);
+            result.converged = residual <= opts.tolerance;
+            return result.converged;
+        }
+
+        // z = M v, returning r·z when r is given; pointwise preconditioners
+        // do it in the same pass
+
+        template < typename T, typename P >
+        double precondition(const P& m, const vector<T>& v, vector<T>& z, const vector<T>* r, parallel::reducer& sums, std::true_type) {
+            return sums.sum([&](size_t first, size_t last) {
+                double s = 0;
+                for (size_t i = first; i < last; ++i) {
+                    z[i] = m.at(i, v[i]);
+                    if(r) {
+                        s += static_cast<double>((*r)[i]) * z[i];
+                    }
+                }
+                return s;
+            });
+        }
+
+        template < typename T, typename P >
+        double precondition(const P& m, const vector<T>& v, vector<T>& z, const vector<T>* r, parallel::reducer& sums, std::false_type) {
+            m.apply(v, z);
+            return r ? dot(*r, z, sums) : 0;
+        }
+
+        // M r for element i, inside another pass, when M is pointwise
+
+        template < typename T, typename P >
+        T pointwise_at(const P& m, size_t i, T r, std::true_type) {
+            return m.at(i, r);
+        }
+
+        template < typename T, typename P >
+        T pointwise_at(const P&, size_t, T r, std::false_type) {
+            return r;
+        }
+    }
+
+    // M = I
+    template < typename T >
+    struct identity_preconditioner {
+        static constexpr bool pointwise = true;
+
+        T at(size_t, T r) const {
+            return r;
+        }
+
+        void apply(const vector<T>& r, vector<T>& z) const {
+            std::copy(r.begin(), r.end(), z.begin());
+        }
+    };
+
+    // M = diag(A); throws std::runtime_error on a zero diagonal entry
+    template < typename T >
+    class jacobi_preconditioner {
+    public:
+        static constexpr bool pointwise = true;
+
+        template < typename M >
+        explicit jacobi_preconditioner(const matrix_expression<T, M>& a) {
+            detail::inverse_diagonal(a.derived(), _inverse);
+        }
+
+        T at(size_t i, T r) const {
+            return _inverse[i] * r;
+        }
+
+        void apply(const vector<T>& r, vector<T>& z) const {
+            for (size_t i = 0; i < r.size(); ++i) {
+                z[i] = _inverse[i] * r[i];
+            }
+        }
+
+    private:
+        vector<T> _inverse;
+    };
+
+    // M = L U with the sparsity of A: the LU factorization keeping only the
+    // entries A has, in CSR. Throws std::runtime_error if A lacks a diagonal
+    // entry or a pivot comes out zero.
+    template < typename T >
+    class ilu0_preconditioner {
+    public:
+        static constexpr bool pointwise = false;
+
+        template < typename M >
+        explicit ilu0_preconditioner(const matrix_expression<T, M>& a) {
+            csr_matrix<T> csr (a.derived());
+            _offsets = csr.offsets();
+            _indices = csr.indices();
+            _values = csr.values();
+            const size_t n = csr.height();
+            const size_t none = _values.size();
+            _diagonal.assign(n, none);
+            // positions of the entries of row i by column
+            std::vector<size_t> position (n, none);
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t k = _offsets[i]; k < _offsets[i + 1]; ++k) {
+                    position[_indices[k]] = k;
+                }
+                _diagonal[i] = position[i];
+                if(_diagonal[i] == none) {
+                    throw std::runtime_error("ILU(0) of a matrix missing a diagonal entry");
+                }
+                for (size_t k = _offsets[i]; k < _diagonal[i]; ++k) {
+                    const size_t row = _indices[k];
+                    _values[k] /= _values[_diagonal[row]];
+                    for (size_t kj = _diagonal[row] + 1; kj < _offsets[row + 1]; ++kj) {
+                        if(position[_indices[kj]] != none) {
+                            _values[position[_indices[kj]]] -= _values[k] * _values[kj];
+                        }
+                    }
+                }
+                if(_values[_diagonal[i]] == T{0}) {
+                    throw std::runtime_error("zero pivot in ILU(0)");
+                }
+                for (size_t k = _offsets[i]; k < _offsets[i + 1]; ++k) {
+                    position[_indices[k]] = none;
+                }
+            }
+        }
+
+        void apply(const vector<T>& r, vector<T>& z) const {
+            const size_t n = _diagonal.size();
+            for (size_t i = 0; i < n; ++i) {
+                T s = r[i];
+                for (size_t k = _offsets[i]; k < _diagonal[i]; ++k) {
+                    s -= _values[k] * z[_indices[k]];
+                }
+                z[i] = s;
+            }
+            for (size_t i = n; i-- > 0;) {
+                T s = z[i];
+                for (size_t k = _diagonal[i] + 1; k < _offsets[i + 1]; ++k) {
+                    s -= _values[k] * z[_indices[k]];
+                }
+                z[i] = s / _values[_diagonal[i]];
+            }
+        }
+
+    private:
+        std::vector<size_t> _offsets;
+        std::vector<size_t> _indices;
+        std::vector<T> _values;
+        std::vector<size_t> _diagonal;
+    };
+
+    // M = L Lᵀ with L having the sparsity of the lower triangle of A, for
+    // symmetric positive definite A (only its lower triangle is read).
+    // Throws std::runtime_error if A lacks a diagonal entry or a pivot is not
+    // positive, which can happen for some positive definite matrices too.
+    template < typename T >
+    class ic0_preconditioner {
+    public:
+        static constexpr bool pointwise = false;
+
+        template < typename M >
+        explicit ic0_preconditioner(const matrix_expression<T, M>& a) {
+            csr_matrix<T> csr (a.derived());
+            const size_t n = csr.height();
+            _offsets.assign(1, 0);
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t k = csr.offsets()[i]; k < csr.offsets()[i + 1] && csr.indices()[k] <= i; ++k) {
+                    _indices.push_back(csr.indices()[k]);
+                    _values.push_back(csr.values()[k]);
+                }
+                _offsets.push_back(_indices.size());
+                // the diagonal entry ends each row
+                if(_offsets[i + 1] == _offsets[i] || _indices[_offsets[i + 1] - 1] != i) {
+                    throw std::runtime_error("incomplete Cholesky of a matrix missing a diagonal entry");
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t k = _offsets[i]; k < _offsets[i + 1]; ++k) {
+                    const size_t row = _indices[k];
+                    // a_ik minus l_ij l_kj over the columns j < k both rows have
+                    T s = _values[k];
+                    size_t p = _offsets[i];
+                    size_t q = _offsets[row];
+                    const size_t q_end = _offsets[row + 1] - 1;
+                    while (p < k && q < q_end) {
+                        if(_indices[p] < _indices[q]) {
+                            ++p;
+                        } else if(_indices[q] < _indices[p]) {
+                            ++q;
+                        } else {
+                            s -= _values[p++] * _values[q++];
+                        }
+                    }
+                    if(row < i) {
+                        _values[k] = s / _values[q_end];
+                    } else if(s > T{0}) {
+                        _values[k] = std::sqrt(s);
+                    } else {
+                        throw std::runtime_error("non-positive pivot in incomplete Cholesky");
+                    }
+                }
+            }
+        }
+
+        void apply(const vector<T>& r, vector<T>& z) const {
+            const size_t n = _offsets.size() - 1;
+            for (size_t i = 0; i < n; ++i) {
+                T s = r[i];
+                const size_t last = _offsets[i + 1] - 1;
+                for (size_t k = _offsets[i]; k < last; ++k) {
+                    s -= _values[k] * z[_indices[k]];
+                }
+                z[i] = s / _values[last];
+            }
+            // Lᵀ by the rows of L, scattering each solved value upwards
+            for (size_t i = n; i-- > 0;) {
+                const size_t last = _offsets[i + 1] - 1;
+                z[i] /= _values[last];
+                for (size_t k = _offsets[i]; k < last; ++k) {
+                    z[_indices[k]] -= _values[k] * z[i];
+                }
+            }
+        }
+
+    private:
+        std::vector<size_t> _offsets;
+        std::vector<size_t> _indices;
+        std::vector<T> _values;
+    };
+
+    template < typename T > constexpr bool identity_preconditioner<T>::pointwise;
+    template < typename T > constexpr bool jacobi_preconditioner<T>::pointwise;
+    template < typename T > constexpr bool ilu0_preconditioner<T>::pointwise;
+    template < typename T > constexpr bool ic0_preconditioner<T>::pointwise;
+
+    // x_i += (b - A x)_i / a_ii for all i at once, the rows split over
+    // threads; converges for strictly diagonally dominant A. Throws
+    // std::runtime_error on a zero diagonal entry.
+    template < typename T, typename M >
+    convergence jacobi(const matrix_expression<T, M>& a, const vector<T>& b, vector<T>& x,
+                       const options& opts = options()) {
+        static_assert(std::is_floating_point<T>::value, "iterative solvers need a floating point type");
+        detail::check(a, b, x);
+        const M& m = a.derived();
+        const size_t n = b.size();
+        convergence result;
+        parallel::reducer sums (n, detail::vector_grain());
+        const double b_norm = detail::start(b, x, opts, result, sums);
+        if(b_norm == 0) {
+            return result;
+        }
+        vector<T> inverse;
+        detail::inverse_diagonal(m, inverse);
+        vector<T> next (n);
+        parallel::reducer rows (n, parallel::grain_for(detail::row_cost(m)));
+        while (true) {
+            // the residual of x, and the next iterate from it
+            double rr = rows.sum([&](size_t first, size_t last) {
+                double s = 0;
+                for (size_t i = first; i < last; ++i) {
+                    T ri = b[i];
+                    detail::for_each_in_row(m, i, [&](size_t j, T val) {
+                        ri -= val * x[j];
+                    });
+                    next[i] = x[i] + ri * inverse[i];
+                    s += static_cast<double>(ri) * ri;
+                }
+                return s;
+            });
+            if(detail::record(result, std::sqrt(rr) / b_norm, opts) || result.iterations == opts.max_iterations) {
+                return result;
+            }
+            x.swap(next);
+            ++result.iterations;
+        }
+    }
+
+    // Successive over-relaxation: x_i += omega (b - A x)_i / a_ii one row
+    // after another, each seeing the rows updated before it; Gauss-Seidel
+    // for omega = 1. Serial, as every row depends on the previous ones. The
+    // history starts with the residual of the initial x, then holds the norm
+    // of the row residuals met during each sweep, which tends to the true
+    // residual as the iteration settles, so no extra product is needed per
+    // sweep. That is only an estimate, not a bound for omega != 1, so once
+    // it passes the tolerance, and after the last sweep, the true residual
+    // is computed, recorded instead and decides convergence. Throws
+    // std::runtime_error on a zero diagonal entry.
+    template < typename T, typename M >
+    convergence sor(const matrix_expression<T, M>& a, const vector<T>& b, vector<T>& x,
+                    const options& opts = options()) {
+        static_assert(std::is_floating_point<T>::value, "iterative solvers need a floating point type");
+        detail::check(a, b, x);
+        const M& m = a.derived();
+        const size_t n = b.size();
+        convergence result;
+        parallel::reducer sums (n, detail::vector_grain());
+        const double b_norm = detail::start(b, x, opts, result, sums);
+        if(b_norm == 0) {
+            return result;
+        }
+        vector<T> inverse;
+        detail::inverse_diagonal(m, inverse);
+        parallel::reducer rows (n, parallel::grain_for(detail::row_cost(m)));
+        auto residual = [&] {
+            double rr = rows.sum([&](size_t first, size_t last) {
+                double s = 0;
+                for (size_t i = first; i < last; ++i) {
+                    T ri = b[i];
+                    detail::for_each_in_row(m, i, [&](size_t j, T val) {
+                        ri -= val * x[j];
+                    });
+                    s += static_cast<double>(ri) * ri;
+                }
+                return s;
+            });
+            return std::sqrt(rr) / b_norm;
+        };
+        if(detail::record(result, residual(), opts) || opts.max_iterations == 0) {
+            return result;
+        }
+        const T omega = static_cast<T>(opts.omega);
+        while (true) {
+            double rr = 0;
+            for (size_t i = 0; i < n; ++i) {
+                T ri = b[i];
+                detail::for_each_in_row(m, i, [&](size_t j, T val) {
+                    ri -= val * x[j];
+                });
+                x[i] += omega * ri * inverse[i];
+                rr += static_cast<double>(ri) * ri;
+            }
+            ++result.iterations;
+            const bool last = result.iterations == opts.max_iterations;
+            double estimate = std::sqrt(rr) / b_norm;
+            if(estimate <= opts.tolerance || last) {
+                estimate = residual();
+            }
+            if(detail::record(result, estimate, opts) || last) {
+                return result;
+            }
+        }
+    }
+
+    template < typename T, typename M >
+    convergence gauss_seidel(const matrix_expression<T, M>& a, const vector<T>& b, vector<T>& x,
+                             const options& opts = options()) {
+        options gs = opts;
+        gs.omega = 1;
+        return sor(a, b, x, gs);
+    }
+
+    // Preconditioned conjugate gradients, for symmetric positive definite A
+    // and M. Per iteration: one product with A, one application of M, and
+    // three passes over vectors, x, r and z updated in one of them. The
+    // residual is the updated one, which drifts from b - A x only at the
+    // level of rounding. Stops unconverged if pᵀ A p <= 0, A not being
+    // positive definite.
+    template < typename T, typename M, typename P = identity_preconditioner<T> >
+    convergence cg(const matrix_expression<T, M>& a, const vector<T>& b, vector<T>& x,
+                   const options& opts = options(), const P& precond = P()) {
+        static_assert(std::is_floating_point<T>::value, "iterative solvers need a floating point type");
+        using pointwise = std::integral_constant<bool, P::pointwise>;
+        detail::check(a, b, x);
+        const M& m = a.derived();
+        const size_t n = b.size();
+        convergence result;
+        parallel::reducer sums (n, detail::vector_grain());
+        const double b_norm = detail::start(b, x, opts, result, sums);
+        if(b_norm == 0) {
+            return result;
+        }
+        vector<T> r (n), z (n), p (n), q (n);
+        product_kernel<M>::multiply(m, x, q);
+        double rr = sums.sum([&](size_t first, size_t last) {
+            double s = 0;
+            for (size_t i = first; i < last; ++i) {
+                r[i] = b[i] - q[i];
+                s += static_cast<double>(r[i]) * r[i];
+            }
+            return s;
+        });
+        double rz = detail::precondition(precond, r, z, &r, sums, pointwise());
+        p = z;
+        while (!detail::record(result, std::sqrt(rr) / b_norm, opts) && result.iterations < opts.max_iterations) {
+            product_kernel<M>::multiply(m, p, q);
+            double pq = detail::dot(p, q, sums);
+            if(!(pq > 0)) {
+                break;
+            }
+            const T alpha = static_cast<T>(rz / pq);
+            double rz_next = 0;
+            std::pair<double, double> sums_rr_rz = sums.sum_pair([&](size_t first, size_t last) {
+                double s = 0;
+                double t = 0;
+                for (size_t i = first; i < last; ++i) {
+                    x[i] += alpha * p[i];
+                    r[i] -= alpha * q[i];
+                    s += static_cast<double>(r[i]) * r[i];
+                    if(pointwise::value) {
+                        z[i] = detail::pointwise_at(precond, i, r[i], pointwise());
+                        t += static_cast<double>(r[i]) * z[i];
+                    }
+                }
+                return std::make_pair(s, t);
+            });
+            rr = sums_rr_rz.first;
+            rz_next = pointwise::value ? sums_rr_rz.second : detail::precondition(precond, r, z, &r, sums, pointwise());
+            ++result.iterations;
+            const T beta = static_cast<T>(rz_next / rz);
+            rz = rz_next;
+            sums.sum([&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    p[i] = z[i] + beta * p[i];
+                }
+                return 0.0;
+            });
+        }
+        return result;
+    }
+
+    // BiCGSTAB, right-preconditioned (A M⁻¹ y = b, x = M⁻¹ y), for general
+    // A. Per iteration: two products with A, two applications of M, and
+    // five passes over vectors; the last one updates x and r together and
+    // yields both dot products the next iteration starts from. Stops
+    // unconverged on a breakdown, when rho or omega vanish.
+    template < typename T, typename M, typename P = identity_preconditioner<T> >
+    convergence bicgstab(const matrix_expression<T, M>& a, const vector<T>& b, vector<T>& x,
+                         const options& opts = options(), const P& precond = P()) {
+        static_assert(std::is_floating_point<T>::value, "iterative solvers need a floating point type");
+        using pointwise = std::integral_constant<bool, P::pointwise>;
+        detail::check(a, b, x);
+        const M& m = a.derived();
+        const size_t n = b.size();
+        convergence result;
+        parallel::reducer sums (n, detail::vector_grain());
+        const double b_norm = detail::start(b, x, opts, result, sums);
+        if(b_norm == 0) {
+            return result;
+        }
+        // r is also s, the residual half way through an iteration
+        vector<T> r (n), r_hat (n), p (n), v (n), y (n), z (n), t (n);
+        product_kernel<M>::multiply(m, x, v);
+        double rr = sums.sum([&](size_t first, size_t last) {
+            double s = 0;
+            for (size_t i = first; i < last; ++i) {
+                r[i] = b[i] - v[i];
+                r_hat[i] = r[i];
+                v[i] = T{0};
+                s += static_cast<double>(r[i]) * r[i];
+            }
+            return s;
+        });
+        double rho = rr;
+        double rho_previous = 1;
+        double alpha = 1;
+        double omega = 1;
+        while (!detail::record(result, std::sqrt(rr) / b_norm, opts) && result.iterations < opts.max_iterations) {
+            if(rho == 0) {
+                break;
+            }
+            // p = r + beta (p - omega v), and y = M p
+            const T beta = static_cast<T>((rho / rho_previous) * (alpha / omega));
+            const T beta_omega = static_cast<T>((rho / rho_previous) * alpha);
+            sums.sum([&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    p[i] = r[i] + beta * p[i] - beta_omega * v[i];
+                    y[i] = detail::pointwise_at(precond, i, p[i], pointwise());
+                }
+                return 0.0;
+            });
+            if(!pointwise::value) {
+                precond.apply(p, y);
+            }
+            product_kernel<M>::multiply(m, y, v);
+            const double rv = detail::dot(r_hat, v, sums);
+            if(rv == 0) {
+                break;
+            }
+            alpha = rho / rv;
+            const T alpha_t = static_cast<T>(alpha);
+            // s = r - alpha v, and z = M s
+            double ss = sums.sum([&](size_t first, size_t last) {
+                double s = 0;
+                for (size_t i = first; i < last; ++i) {
+                    r[i] -= alpha_t * v[i];
+                    z[i] = detail::pointwise_at(precond, i, r[i], pointwise());
+                    s += static_cast<double>(r[i]) * r[i];
+                }
+                return s;
+            });
+            if(std::sqrt(ss) / b_norm <= opts.tolerance) {
+                sums.sum([&](size_t first, size_t last) {
+                    for (size_t i = first; i < last; ++i) {
+                        x[i] += alpha_t * y[i];
+                    }
+                    return 0.0;
+                });
+                ++result.iterations;
+                rr = ss;
+                continue;
+            }
+            if(!pointwise::value) {
+                precond.apply(r, z);
+            }
+            product_kernel<M>::multiply(m, z, t);
+            std::pair<double, double> ts_tt = sums.sum_pair([&](size_t first, size_t last) {
+                double ts = 0;
+                double tt = 0;
+                for (size_t i = first; i < last; ++i) {
+                    ts += static_cast<double>(t[i]) * r[i];
+                    tt += static_cast<double>(t[i]) * t[i];
+                }
+                return std::make_pair(ts, tt);
+            });
+            if(ts_tt.second == 0) {
+                break;
+            }
+            omega = ts_tt.first / ts_tt.second;
+            const T omega_t = static_cast<T>(omega);
+            // x += alpha y + omega z and r = s - omega t, with r·r and r̂·r
+            std::pair<double, double> rr_rho = sums.sum_pair([&](size_t first, size_t last) {
+                double s = 0;
+                double h = 0;
+                for (size_t i = first; i < last; ++i) {
+                    x[i] += alpha_t * y[i] + omega_t * z[i];
+                    r[i] -= omega_t * t[i];
+                    s += static_cast<double>(r[i]) * r[i];
+                    h += static_cast<double>(r_hat[i]) * r[i];
+                }
+                return std::make_pair(s, h);
+            });
+            ++result.iterations;
+            rr = rr_rho.first;
+            rho_previous = rho;
+            rho = rr_rho.second;
+            if(omega == 0) {
+                detail::record(result, std::sqrt(rr) / b_norm, opts);
+                break;
+            }
+        }
+        return result;
+    }
+}
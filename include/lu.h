@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "full_matrix.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "triangular.h"
+
+// LU factorization with partial pivoting, P A = L U with L unit lower
+// triangular, kept to solve any number of systems with the same matrix.
+//
+// Right-looking and blocked as LAPACK's getrf: a panel of `block` columns is
+// factored by columns, choosing as pivot the largest entry left in each and
+// swapping whole rows; the block row of U right of the panel is solved
+// against its L; and the trailing matrix is updated by one product through
+// the blocked kernel, which also spreads it over threads. Almost all the
+// work is in those products once the matrix is several blocks wide.
+template < typename T >
+class lu_factorization {
+public:
+    static_assert(std::is_floating_point<T>::value, "LU factorization needs a floating point type");
+
+    static constexpr size_t default_block = triangular::default_block;
+
+    // throws std::runtime_error if a is not square
+    template < typename M >
+    explicit lu_factorization(const matrix_expression<T, M>& a, size_t block = default_block)
+            : _lu(a.derived()), _pivots(_lu.height()), _block(std::max<size_t>(block, 1)) {
+        if(_lu.height() != _lu.width()) {
+            throw std::runtime_error("LU factorization of a non-square matrix");
+        }
+        factor();
+    }
+
+    size_t size() const {
+        return _lu.height();
+    }
+
+    // whether a pivot was zero; the factors are complete, but nothing can be solved
+    bool singular() const {
+        return _singular;
+    }
+
+    // X with A X = B, for the columns of B at once; throws std::runtime_error
+    // if A is singular or B has another height
+    template < typename M >
+    full_matrix<T> solve(const matrix_expression<T, M>& b) const {
+        full_matrix<T> x (b.derived());
+        if(x.height() != size()) {
+            throw std::runtime_error("right-hand side height does not match the matrix");
+        }
+        solve_in_place(x);
+        return x;
+    }
+
+    vector<T> solve(const vector<T>& b) const {
+        full_matrix<T> x (b.size(), 1);
+        for (size_t i = 0; i < b.size(); ++i) {
+            x.set(i, 0, b[i]);
+        }
+        if(x.height() != size()) {
+            throw std::runtime_error("right-hand side height does not match the matrix");
+        }
+        solve_in_place(x);
+        vector<T> result(b.size());
+        for (size_t i = 0; i < b.size(); ++i) {
+            result[i] = x.get(i, 0);
+        }
+        return result;
+    }
+
+    T determinant() const {
+        T det = 1;
+        for (size_t i = 0; i < size(); ++i) {
+            det *= _pivots[i] == i ? _lu.get(i, i) : -_lu.get(i, i);
+        }
+        return det;
+    }
+
+    // L below the diagonal (its unit diagonal not stored) and U on and above it
+    const full_matrix<T>& factors() const {
+        return _lu;
+    }
+
+    // row i was swapped with row pivots()[i] >= i, in increasing order of i
+    const std::vector<size_t>& pivots() const {
+        return _pivots;
+    }
+
+    full_matrix<T> lower() const {
+        full_matrix<T> l (size(), size());
+        for (size_t i = 0; i < size(); ++i) {
+            for (size_t j = 0; j < i; ++j) {
+                l.set(i, j, _lu.get(i, j));
+            }
+            l.set(i, i, 1);
+        }
+        return l;
+    }
+
+    full_matrix<T> upper() const {
+        full_matrix<T> u (size(), size());
+        for (size_t i = 0; i < size(); ++i) {
+            for (size_t j = i; j < size(); ++j) {
+                u.set(i, j, _lu.get(i, j));
+            }
+        }
+        return u;
+    }
+
+private:
+    full_matrix<T> _lu;
+    std::vector<size_t> _pivots;
+    size_t _block;
+    bool _singular = false;
+
+    T* row(size_t i) {
+        return _lu.data() + i * _lu.stride();
+    }
+
+    void factor() {
+        const size_t n = size();
+        for (size_t kb = 0; kb < n; kb += _block) {
+            size_t nb = std::min(_block, n - kb);
+            factor_panel(kb, nb);
+            size_t rest = n - kb - nb;
+            if(rest > 0) {
+                triangular::solve_lower(_lu.block(kb, kb, nb, nb), _lu.block(kb, kb + nb, nb, rest),
+                                        triangular::diagonal::unit, _block);
+                // the three blocks are disjoint, so the product is subtracted in place
+                dense_view<T, true> trailing = _lu.block(kb + nb, kb + nb, rest, rest);
+                trailing.store(trailing - _lu.block(kb + nb, kb, rest, nb).dotProduct(_lu.block(kb, kb + nb, nb, rest)));
+            }
+        }
+    }
+
+    // columns kb to kb + nb of the rows from kb down, the rows below each
+    // pivot split over threads
+    void factor_panel(size_t kb, size_t nb) {
+        const size_t n = size();
+        const size_t end = kb + nb;
+        for (size_t j = kb; j < end; ++j) {
+            size_t p = j;
+            for (size_t i = j + 1; i < n; ++i) {
+                if(std::abs(row(i)[j]) > std::abs(row(p)[j])) {
+                    p = i;
+                }
+            }
+            _pivots[j] = p;
+            if(row(p)[j] == T{}) {
+                _singular = true;
+                continue;
+            }
+            if(p != j) {
+                std::swap_ranges(row(j), row(j) + n, row(p));
+            }
+            const T* pivot_row = row(j);
+            const T pivot = pivot_row[j];
+            parallel::for_range(j + 1, n, parallel::grain_for(end - j), [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    T* r = row(i);
+                    r[j] /= pivot;
+                    const T l = r[j];
+                    for (size_t c = j + 1; c < end; ++c) {
+                        r[c] -= l * pivot_row[c];
+                    }
+                }
+            });
+        }
+    }
+
+    void solve_in_place(full_matrix<T>& x) const {
+        if(_singular) {
+            throw std::runtime_error("singular matrix");
+        }
+        const size_t m = x.width();
+        for (size_t i = 0; i < size(); ++i) {
+            if(_pivots[i] != i) {
+                T* a = x.data() + i * x.stride();
+                std::swap_ranges(a, a + m, x.data() + _pivots[i] * x.stride());
+            }
+        }
+        dense_view<T, true> b = x.block(0, 0, size(), m);
+        triangular::solve_lower(_lu.block(0, 0, size(), size()), b, triangular::diagonal::unit, _block);
+        triangular::solve_upper(_lu.block(0, 0, size(), size()), b, triangular::diagonal::stored, _block);
+    }
+};
+
+template < typename T > constexpr size_t lu_factorization<T>::default_block;
+
+template < typename T, typename M >
+lu_factorization<T> lu(const matrix_expression<T, M>& a, size_t block = lu_factorization<T>::default_block) {
+    return lu_factorization<T>(a, block);
+}
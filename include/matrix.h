@@ -1,9 +1,180 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <memory>
 #include <type_traits>
 #include "matrix_expr.h"
+#include "simd.h"
+
+// a stored entry, as visited by the nonzeros() ranges of sparse storage types
+template < typename T >
+struct matrix_entry {
+    size_t row;
+    size_t col;
+    T value;
+};
+
+template < typename It >
+class entry_range {
+public:
+    entry_range(It first, It last) : _first(first), _last(last) {}
+
+    It begin() const {
+        return _first;
+    }
+
+    It end() const {
+        return _last;
+    }
+
+private:
+    It _first;
+    It _last;
+};
+
+// Storage types that only keep some of their entries specialize this and
+// provide nnz() and nonzeros(), a range over their stored entries.
+// Reductions and predicates then visit only those, unless the type has a
+// default_value() that is not zero, in which case they read every entry.
+template < typename M >
+struct is_sparse : std::false_type {};
+
+// Dense storage types whose rows are contiguous arrays specialize this and
+// provide data() and stride(), row r starting at data() + r * stride().
+// Norms then run the vectorized kernels over whole rows.
+template < typename M >
+struct is_contiguous : std::false_type {};
+
+// How an expression reads a matrix it is being assigned to: not at all, only
+// at the position being written, or at other positions. Nodes combine what
+// their operands report, and nodes that read an operand elsewhere than at
+// the position they produce (transposes, products) turn any read into
+// `other`. Expressions without an alias_of overload (see the end of
+// this file) are assumed to read anywhere.
+enum class aliasing { none, element_wise, other };
+
+inline aliasing alias_either(aliasing a, aliasing b) {
+    return a > b ? a : b;
+}
+
+inline aliasing alias_elsewhere(aliasing a) {
+    return a == aliasing::none ? aliasing::none : aliasing::other;
+}
+
+// What an assignment writes to, as seen by alias_of: the matrix object and,
+// for dense storage, where its elements lie in memory, so that views sharing
+// a buffer are recognized whichever of them is assigned to. Element (i, j)
+// is at origin + i * row_stride + j * col_stride; first and last bound all
+// of them and are null for storage that is not dense.
+struct alias_target {
+    const void* object;
+    bool whole;             // false if element (i, j) of the target is not element (i, j) of object
+    uintptr_t first;
+    uintptr_t last;
+    const void* origin;
+    size_t height;
+    size_t width;
+    size_t row_stride;
+    size_t col_stride;
+};
+
+inline alias_target object_target(const void* object) {
+    return {object, true, 0, 0, nullptr, 0, 0, 0, 0};
+}
+
+template < typename T >
+alias_target dense_target(const void* object, const T* origin, size_t h, size_t w, size_t row_stride, size_t col_stride) {
+    if(h == 0 || w == 0) {
+        return object_target(object);
+    }
+    return {object, true, reinterpret_cast<uintptr_t>(origin),
+            reinterpret_cast<uintptr_t>(origin + (h - 1) * row_stride + (w - 1) * col_stride + 1),
+            origin, h, w, row_stride, col_stride};
+}
+
+// Whether two dense layouts of elements of `size` bytes with the same
+// strides, each row within one row stride, share no element although their
+// bounds overlap, as side-by-side blocks of one matrix do. b's elements are
+// placed in the rows and columns of a's frame: they share none when either
+// ranges do not meet.
+inline bool disjoint_layouts(const alias_target& a, const alias_target& b, size_t size) {
+    const size_t r = a.row_stride;
+    const size_t c = a.col_stride;
+    if(r != b.row_stride || c != b.col_stride || c == 0 || (a.width - 1) * c >= r || (b.width - 1) * c >= r) {
+        return false;
+    }
+    const uintptr_t first = reinterpret_cast<uintptr_t>(a.origin);
+    const uintptr_t second = reinterpret_cast<uintptr_t>(b.origin);
+    const uintptr_t bytes = second >= first ? second - first : first - second;
+    if(bytes % size != 0) {
+        return false;
+    }
+    // b's origin at row `row`, column `col` of a's frame, 0 <= col < r
+    const size_t offset = bytes / size;
+    ptrdiff_t row = static_cast<ptrdiff_t>(offset / r);
+    size_t col = offset % r;
+    if(second < first) {
+        row = -row;
+        if(col != 0) {
+            --row;
+            col = r - col;
+        }
+    }
+    if(col + (b.width - 1) * c >= r) {
+        return false;
+    }
+    bool rows_apart = row >= static_cast<ptrdiff_t>(a.height) || row + static_cast<ptrdiff_t>(b.height) <= 0;
+    bool columns_apart = col % c != 0 || col > (a.width - 1) * c;
+    return rows_apart || columns_apart;
+}
+
+// how dense elements laid out as in alias_target are read by an assignment to t
+template < typename T >
+aliasing alias_of_dense(const T* origin, size_t h, size_t w, size_t row_stride, size_t col_stride, const alias_target& t) {
+    alias_target self = dense_target(nullptr, origin, h, w, row_stride, col_stride);
+    if(self.first == 0 || t.first == 0 || self.last <= t.first || t.last <= self.first ||
+       disjoint_layouts(t, self, sizeof(T))) {
+        return aliasing::none;
+    }
+    bool same = t.whole && t.origin == self.origin && t.height == h && t.width == w &&
+                t.row_stride == row_stride && t.col_stride == col_stride;
+    return same ? aliasing::element_wise : aliasing::other;
+}
+
+// Where element (i, j) of a view lies in the matrix it views: at row
+// row + i * row_step and column col + j * col_step + i * shear. Blocks and
+// strided slices have no shear, diagonals are a column with shear 1.
+struct view_layout {
+    size_t row;
+    size_t col;
+    size_t height;
+    size_t width;
+    size_t row_step;
+    size_t col_step;
+    size_t shear;
+};
+
+template < typename M >
+class indexed_view;
+
+// The views a matrix type hands out, writable and read-only. Views read and
+// write through the viewed matrix's get() and set() unless its type
+// specializes this, as dense storage does with strided views of its buffer.
+template < typename M >
+struct view_traits {
+    using type = indexed_view<M>;
+    using const_type = indexed_view<const M>;
+};
+
+// Storage an expression is evaluated into first when it reads the matrix it
+// is assigned to elsewhere than element-wise; views specialize it, since
+// they cannot hold a copy of their own.
+template < typename M >
+struct assignment_temporary {
+    using type = M;
+};
 
 template < typename T, typename Derived >
 class matrix : public matrix_expression<T, Derived> {
@@ -28,7 +199,7 @@ public:
         }
 
         wrapper& operator=(value_type val) {
-            _matrix->set(_r, _c, val);
+            static_cast<Derived*>(_matrix)->set(_r, _c, val);
             return *this;
         }
 
@@ -238,7 +409,126 @@ public:
         return const_row_list(this);
     }
 
+    // stored matrices are already evaluated
+    const Derived& eval() const {
+        return static_cast<const Derived&>(*this);
+    }
+
+    // Evaluates `other` into this matrix, reusing its storage when the shapes
+    // match. Expressions may read this matrix at the position being written
+    // (x = x * 2 + y); any other read of it (x = a.dotProduct(x), x = x.transpose())
+    // goes through a temporary, since positions already written would be
+    // read back.
+    template < typename Other >
+    Derived& assign(const matrix_expression<T, Other>& other) {
+        Derived& self = static_cast<Derived&>(*this);
+        const Other& src = other.derived();
+        if(alias_of(src, alias_target_of(self)) == aliasing::other) {
+            self.store(typename assignment_temporary<Derived>::type(src));
+        } else {
+            self.store(src);
+        }
+        return self;
+    }
+
+    // Views of part of this matrix (see matrix_view.h), which read and write
+    // its elements in place. They are assignable and take part in
+    // expressions like any matrix, and must not outlive it.
+
+    using view_type = typename view_traits<Derived>::type;
+    using const_view_type = typename view_traits<Derived>::const_type;
+
+    view_type block(size_t row, size_t col, size_t h, size_t w) {
+        return view_type(static_cast<Derived&>(*this), {row, col, h, w, 1, 1, 0});
+    }
+
+    const_view_type block(size_t row, size_t col, size_t h, size_t w) const {
+        return const_view_type(this->derived(), {row, col, h, w, 1, 1, 0});
+    }
+
+    view_type row_view(size_t row) {
+        return block(row, 0, 1, width());
+    }
+
+    const_view_type row_view(size_t row) const {
+        return block(row, 0, 1, width());
+    }
+
+    view_type column_view(size_t col) {
+        return block(0, col, height(), 1);
+    }
+
+    const_view_type column_view(size_t col) const {
+        return block(0, col, height(), 1);
+    }
+
+    // the main diagonal, as a column
+    view_type diagonal() {
+        return view_type(static_cast<Derived&>(*this), {0, 0, std::min(height(), width()), 1, 1, 1, 1});
+    }
+
+    const_view_type diagonal() const {
+        return const_view_type(this->derived(), {0, 0, std::min(height(), width()), 1, 1, 1, 1});
+    }
+
+    // every row_step-th row and col_step-th column, h x w of them from (row, col)
+    view_type strided(size_t row, size_t col, size_t h, size_t w, size_t row_step, size_t col_step) {
+        return view_type(static_cast<Derived&>(*this), {row, col, h, w, row_step, col_step, 0});
+    }
+
+    const_view_type strided(size_t row, size_t col, size_t h, size_t w, size_t row_step, size_t col_step) const {
+        return const_view_type(this->derived(), {row, col, h, w, row_step, col_step, 0});
+    }
+
+    template < typename S, typename Other >
+    Derived& operator+=(const matrix_expression<S, Other>& other) {
+        return assign(this->derived() + other.derived());
+    }
+
+    template < typename S, typename Other >
+    Derived& operator-=(const matrix_expression<S, Other>& other) {
+        return assign(this->derived() - other.derived());
+    }
+
+    template < typename S >
+    Derived& operator*=(const S& scalar) {
+        return assign(this->derived() * scalar);
+    }
+
     double infinityNorm() const {
+        return infinityNorm(is_sparse<Derived>(), is_contiguous<Derived>());
+    }
+
+    double twoNorm() const {
+        return twoNorm(is_sparse<Derived>(), is_contiguous<Derived>());
+    }
+
+    double singleNorm() const {
+        return singleNorm(is_sparse<Derived>(), is_contiguous<Derived>());
+    }
+
+    bool isSquared() const {
+        return height() == width();
+    }
+
+    bool isDiagonal() const {
+        return isDiagonal(is_sparse<Derived>());
+    }
+
+    bool isLowerTriangular() const {
+        return isLowerTriangular(is_sparse<Derived>());
+    }
+
+    bool isUpperTriangular() const {
+        return isUpperTriangular(is_sparse<Derived>());
+    }
+
+    bool isSymmetric() const {
+        return isSymmetric(is_sparse<Derived>());
+    }
+
+private:
+    double infinityNorm(std::false_type, std::false_type) const {
         assert(height() > 0 && width() > 0);
         double result = get(0,0);
         for (size_t i = 0; i < height(); ++i) {
@@ -251,7 +541,7 @@ public:
         return result;
     }
 
-    double twoNorm() const {
+    double twoNorm(std::false_type, std::false_type) const {
         double result = 0;
         for (size_t i = 0; i < height(); ++i) {
             double c = 0.0;
@@ -266,7 +556,7 @@ public:
         return sqrt(result);
     }
 
-    double singleNorm() const {
+    double singleNorm(std::false_type, std::false_type) const {
         double result = 0;
         for (size_t i = 0; i < height(); ++i) {
             double c = 0.0;
@@ -281,11 +571,49 @@ public:
         return result;
     }
 
-    bool isSquared() const {
-        return height() == width();
+    // contiguous versions, which reduce a whole row per kernel call and
+    // combine the row results as above
+
+    double infinityNorm(std::false_type, std::true_type) const {
+        assert(height() > 0 && width() > 0);
+        const Derived& self = this->derived();
+        double result = get(0,0);
+        for (size_t i = 0; i < height(); ++i) {
+            double row_max = simd::max(width(), self.data() + i * self.stride());
+            if (result < row_max) {
+                result = row_max;
+            }
+        }
+        return result;
     }
 
-    bool isDiagonal() const {
+    double twoNorm(std::false_type, std::true_type) const {
+        const Derived& self = this->derived();
+        double result = 0;
+        double c = 0.0;
+        for (size_t i = 0; i < height(); ++i) {
+            double y = simd::sum_squares(width(), self.data() + i * self.stride()) - c;
+            double t = result + y;
+            c = (t - result) - y;
+            result = t;
+        }
+        return sqrt(result);
+    }
+
+    double singleNorm(std::false_type, std::true_type) const {
+        const Derived& self = this->derived();
+        double result = 0;
+        double c = 0.0;
+        for (size_t i = 0; i < height(); ++i) {
+            double y = simd::sum(width(), self.data() + i * self.stride()) - c;
+            double t = result + y;
+            c = (t - result) - y;
+            result = t;
+        }
+        return result;
+    }
+
+    bool isDiagonal(std::false_type) const {
         if(!isSquared()) {
             return false;
         }
@@ -299,7 +627,7 @@ public:
         return true;
     }
 
-    bool isLowerTriangular() const {
+    bool isLowerTriangular(std::false_type) const {
         if(!isSquared()) {
             return false;
         }
@@ -313,7 +641,7 @@ public:
         return true;
     }
 
-    bool isUpperTriangular() const {
+    bool isUpperTriangular(std::false_type) const {
         if(!isSquared()) {
             return false;
         }
@@ -327,7 +655,7 @@ public:
         return true;
     }
 
-    bool isSymmetric() const {
+    bool isSymmetric(std::false_type) const {
         if(!isSquared()) {
             return false;
         }
@@ -341,17 +669,185 @@ public:
         return true;
     }
 
-protected:
-    matrix() noexcept = default;
+    // whether the sparse versions below are exact, i.e. missing entries read
+    // as zero; types with a default_value() may be built with another one
+    template < typename M >
+    static auto stored_only(const M& m, int) -> decltype(m.default_value() == static_cast<T>(0)) {
+        return m.default_value() == static_cast<T>(0);
+    }
+
+    template < typename M >
+    static bool stored_only(const M&, long) {
+        return true;
+    }
 
-    virtual void set(size_t row, size_t col, const T& val) = 0;
+    // sparse versions, which only visit the stored entries
 
-    template < typename Other >
-    void copy_from(const matrix_expression<T, Other>& other) noexcept {
-        for (size_t i = 0; i < other.height(); ++i) {
-            for (size_t j = 0; j < other.width(); ++j) {
-                (*this)[i][j] = other.get(i, j);
+    double infinityNorm(std::true_type, std::false_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return infinityNorm(std::false_type(), std::false_type());
+        }
+        assert(height() > 0 && width() > 0);
+        const Derived& self = this->derived();
+        bool all_stored = self.nnz() == height() * width();
+        double result = all_stored ? double(get(0,0)) : 0.0;
+        for (const matrix_entry<T>& e : self.nonzeros()) {
+            if (result < e.value) {
+                result = e.value;
+            }
+        }
+        return result;
+    }
+
+    double twoNorm(std::true_type, std::false_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return twoNorm(std::false_type(), std::false_type());
+        }
+        double result = 0;
+        double c = 0.0;
+        for (const matrix_entry<T>& e : this->derived().nonzeros()) {
+            double y = std::pow(e.value, 2) - c;
+            double t = result + y;
+            c = (t - result) - y;
+            result = t;
+        }
+        return sqrt(result);
+    }
+
+    double singleNorm(std::true_type, std::false_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return singleNorm(std::false_type(), std::false_type());
+        }
+        double result = 0;
+        double c = 0.0;
+        for (const matrix_entry<T>& e : this->derived().nonzeros()) {
+            double y = double(e.value) - c;
+            double t = result + y;
+            c = (t - result) - y;
+            result = t;
+        }
+        return result;
+    }
+
+    bool isDiagonal(std::true_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return isDiagonal(std::false_type());
+        }
+        if(!isSquared()) {
+            return false;
+        }
+        for (const matrix_entry<T>& e : this->derived().nonzeros()) {
+            if (e.row != e.col && e.value != 0) {
+                return false;
             }
         }
+        return true;
     }
+
+    bool isLowerTriangular(std::true_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return isLowerTriangular(std::false_type());
+        }
+        if(!isSquared()) {
+            return false;
+        }
+        for (const matrix_entry<T>& e : this->derived().nonzeros()) {
+            if (e.col > e.row && e.value != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool isUpperTriangular(std::true_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return isUpperTriangular(std::false_type());
+        }
+        if(!isSquared()) {
+            return false;
+        }
+        for (const matrix_entry<T>& e : this->derived().nonzeros()) {
+            if (e.col < e.row && e.value != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // every stored entry must be mirrored, which also catches entries
+    // whose mirror is missing
+    bool isSymmetric(std::true_type) const {
+        if(!stored_only(this->derived(), 0)) {
+            return isSymmetric(std::false_type());
+        }
+        if(!isSquared()) {
+            return false;
+        }
+        for (const matrix_entry<T>& e : this->derived().nonzeros()) {
+            if (e.row != e.col && get(e.col, e.row) != e.value) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+protected:
+    matrix() noexcept = default;
+
+    // subclasses also define set(row, col, val), which is called statically,
+    // and store(src), which evaluates an expression that reads this matrix at
+    // most element-wise into it, resizing it if needed
 };
+
+// alias_target_of(matrix assigned to), alias_of(expression, alias_target)
+
+template < typename T, typename Derived >
+alias_target alias_target_of(const matrix<T, Derived>& m) {
+    return object_target(&m.derived());
+}
+
+template < typename T, typename Other >
+aliasing alias_of(const matrix_expression<T, Other>&, const alias_target&) {
+    return aliasing::other;
+}
+
+template < typename T, typename Derived >
+aliasing alias_of(const matrix<T, Derived>& m, const alias_target& target) {
+    if(static_cast<const void*>(&m.derived()) != target.object) {
+        return aliasing::none;
+    }
+    return target.whole ? aliasing::element_wise : aliasing::other;
+}
+
+template < typename T, typename M1, typename M2 >
+aliasing alias_of(const matrix_sum<T, M1, M2>& e, const alias_target& target) {
+    return alias_either(alias_of(e.lhs(), target), alias_of(e.rhs(), target));
+}
+
+template < typename T, typename M1, typename M2 >
+aliasing alias_of(const matrix_difference<T, M1, M2>& e, const alias_target& target) {
+    return alias_either(alias_of(e.lhs(), target), alias_of(e.rhs(), target));
+}
+
+template < typename T, typename M, typename S >
+aliasing alias_of(const matrix_scalar_product<T, M, S>& e, const alias_target& target) {
+    return alias_of(e.lhs(), target);
+}
+
+template < typename T, typename M >
+aliasing alias_of(const matrix_transpose<T, M>& e, const alias_target& target) {
+    return alias_elsewhere(alias_of(e.operand(), target));
+}
+
+template < typename T, typename M, typename S >
+aliasing alias_of(const matrix_vector_product<T, M, S>& e, const alias_target& target) {
+    return alias_elsewhere(alias_of(e.lhs(), target));
+}
+
+template < typename T, typename M1, typename M2 >
+aliasing alias_of(const matrix_dot_product<T, M1, M2>& e, const alias_target& target) {
+    return alias_elsewhere(alias_either(alias_of(e.lhs().expression(), target), alias_of(e.rhs().expression(), target)));
+}
+
+// included last: views derive from matrix
+#include "matrix_view.h"
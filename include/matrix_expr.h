@@ -1,20 +1,44 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include "dense_storage.h"
+#include "instrumentation.h"
 #include "matrix_ops.h"
 #include "vectors.h"
 
 template < class T, class Derived >
 class matrix_expression;
 
+template < typename T, typename Alloc = aligned_allocator<T> >
+class full_matrix;
+
+// Expressions whose operands are all sparse, which sparse_ops.h specializes
+// to evaluate(e) into a CSR matrix by merging the operands' nonzeros instead
+// of reading every position.
+template < typename E, typename Enable = void >
+struct sparse_expression : std::false_type {};
+
 template < typename T, typename M, typename Op, typename Derived >
 class matrix_single_expr : public matrix_expression<T, Derived> {
 public:
     explicit matrix_single_expr(const M& m) : _m(m), _op() {}
 
-    T get(size_t row, size_t col) const override {
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(Derived);
         return _op(_m, row, col);
     }
 
+    double element_cost() const {
+        return _m.element_cost();
+    }
+
+    const M& operand() const {
+        return _m;
+    }
+
 protected:
     const M& _m;
     const Op _op;
@@ -25,18 +49,31 @@ class matrix_scalar_expr : public matrix_expression<T, Derived> {
 public:
     matrix_scalar_expr(const M& a, const S& b) : _a(a), _b(b), _op() {}
 
-    T get(size_t row, size_t col) const override {
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(Derived);
         return _op(_a, _b, row, col);
     }
 
-    size_t height() const override {
+    size_t height() const {
         return _a.height();
     }
 
-    size_t width() const override {
+    size_t width() const {
         return _a.width();
     }
 
+    double element_cost() const {
+        return _a.element_cost() + 1;
+    }
+
+    const M& lhs() const {
+        return _a;
+    }
+
+    const S& rhs() const {
+        return _b;
+    }
+
 protected:
     const M& _a;
     const S _b;
@@ -50,30 +87,42 @@ public:
         _op.assert_sizes(_a, _b);
     }
 
+    // a temporary vector is kept alive by the node and its copies
+    matrix_vector_expr(const M& a, vector<S>&& b)
+            : _a(a), _owned(std::make_shared<const vector<S>>(std::move(b))), _b(*_owned), _op() {
+        _op.assert_sizes(_a, _b);
+    }
+
 
-    T get(size_t row, size_t col) const override {
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(Derived);
         return _op(_a, _b, row, col);
     }
 
-    size_t height() const override {
+    size_t height() const {
         return _a.height();
     }
 
-    size_t width() const override {
+    size_t width() const {
         return 1;
     }
 
-    operator vector<T>() {
-        vector<T> res(height());
-        for (size_t i = 0; i < height(); ++i) {
-            res[i] = get(i, 0);
-        }
-        return res;
+    double element_cost() const {
+        return _b.size() * (_a.element_cost() + 1);
+    }
+
+    const M& lhs() const {
+        return _a;
+    }
+
+    const vector<S>& rhs() const {
+        return _b;
     }
 
 protected:
     const M& _a;
-    const vector<S> _b;
+    std::shared_ptr<const vector<S>> _owned;
+    const vector<S>& _b;
     const Op _op;
 };
 
@@ -84,18 +133,31 @@ public:
         _op.assert_sizes(_a, _b);
     }
 
-    T get(size_t row, size_t col) const override {
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(Derived);
         return _op(_a, _b, row, col);
     }
 
-    size_t height() const override {
+    size_t height() const {
         return _a.height();
     }
 
-    size_t width() const override {
+    size_t width() const {
         return _a.width();
     }
 
+    double element_cost() const {
+        return _a.element_cost() + _b.element_cost() + 1;
+    }
+
+    const M1& lhs() const {
+        return _a;
+    }
+
+    const M2& rhs() const {
+        return _b;
+    }
+
 protected:
     const M1& _a;
     const M2& _b;
@@ -142,18 +204,17 @@ class matrix_vector_product : public matrix_vector_expr<
         T, M, S,
         matrix_vector_product_op<T,M,S>,
         matrix_vector_product<T, M, S>> {
+public:
     using matrix_vector_expr<
             T, M, S,
             matrix_vector_product_op<T,M,S>,
             matrix_vector_product<T, M, S>>
     ::matrix_vector_expr;
 
-    size_t height() const override {
-        return this->_a.height();
-    }
-
-    size_t width() const override {
-        return this->_b.width();
+    operator vector<T>() const { // NOLINT(google-explicit-constructor)
+        vector<T> res(this->height());
+        product_kernel<M>::multiply(this->_a, this->_b, res);
+        return res;
     }
 };
 
@@ -169,39 +230,173 @@ public:
             matrix_transpose<T, M>>
     ::matrix_single_expr;
 
-    size_t height() const override {
+    size_t height() const {
         return this->_m.width();
     }
 
-    size_t width() const override {
+    size_t width() const {
         return this->_m.height();
     }
 };
 
+// Writing an element to a temporary and reading it back costs about this many
+// element reads, so an operand read `reuse` times is worth evaluating once
+// when re-reading it lazily would cost more than that.
+constexpr double materialization_cost = 4.0;
+
+inline bool worth_materializing(double element_cost, size_t reuse) {
+    return reuse > 1 && element_cost * (reuse - 1) > materialization_cost * reuse;
+}
+
+// Operand of a product, which reads each of its elements once per element of
+// the other operand's free dimension. Expensive operands (nested products,
+// long element-wise chains) are evaluated into a dense temporary when the
+// product is first evaluated, which later evaluations of the same product
+// reuse. Sparse expressions are left alone: the sparse kernels read their
+// nonzeros.
+template < typename M >
+class product_operand {
+public:
+    using value_type = typename M::value_type;
+    using evaluated_type = full_matrix<value_type>;
+
+    product_operand(const M& m, size_t reuse) : _m(m) {
+        if(!sparse_expression<M>::value && worth_materializing(m.element_cost(), reuse)) {
+            _cache = std::make_shared<cache>();
+        }
+    }
+
+    value_type get(size_t row, size_t col) const {
+        return _cache ? evaluated()->get(row, col) : _m.get(row, col);
+    }
+
+    size_t height() const {
+        return _m.height();
+    }
+
+    size_t width() const {
+        return _m.width();
+    }
+
+    double element_cost() const {
+        return _cache ? 1 : _m.element_cost();
+    }
+
+    const M& expression() const {
+        return _m;
+    }
+
+    // the temporary, evaluated by the first caller; null for operands read
+    // in place
+    const evaluated_type* evaluated() const {
+        if(!_cache) {
+            return nullptr;
+        }
+        const evaluated_type* value = _cache->ready.load(std::memory_order_acquire);
+        if(value == nullptr) {
+            std::lock_guard<std::mutex> lock(_cache->mutex);
+            value = _cache->ready.load(std::memory_order_relaxed);
+            if(value == nullptr) {
+                MATRIX_TIME_MATERIALIZATION("product operand", M, _m.height(), _m.width());
+                _cache->value.reset(new evaluated_type(_m));
+                value = _cache->value.get();
+                _cache->ready.store(value, std::memory_order_release);
+            }
+        }
+        return value;
+    }
+
+private:
+    // shared by the copies of the expression
+    struct cache {
+        std::mutex mutex;
+        std::unique_ptr<const evaluated_type> value;
+        std::atomic<const evaluated_type*> ready {nullptr};
+    };
+
+    const M& _m;
+    std::shared_ptr<cache> _cache;
+};
+
 template < typename T, typename M1, typename M2 >
 class matrix_dot_product : public matrix_matrix_expr<
         T, M1, M2,
         matrix_dot_product_op<T,M1,M2>,
         matrix_dot_product<T, M1, M2>> {
 public:
-    using matrix_matrix_expr<
+    matrix_dot_product(const M1& a, const M2& b) : matrix_matrix_expr<
             T, M1, M2,
             matrix_dot_product_op<T,M1,M2>,
-            matrix_dot_product<T, M1, M2>>
-    ::matrix_matrix_expr;
+            matrix_dot_product<T, M1, M2>>(a, b),
+            _lhs(a, b.width()), _rhs(b, a.height()) {}
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(matrix_dot_product);
+        return this->_op(_lhs, _rhs, row, col);
+    }
 
-    size_t height() const override {
+    size_t height() const {
         return this->_a.height();
     }
 
-    size_t width() const override {
+    size_t width() const {
         return this->_b.width();
     }
+
+    double element_cost() const {
+        return _lhs.width() * (_lhs.element_cost() + _rhs.element_cost() + 1);
+    }
+
+    const product_operand<M1>& lhs() const {
+        return _lhs;
+    }
+
+    const product_operand<M2>& rhs() const {
+        return _rhs;
+    }
+
+private:
+    product_operand<M1> _lhs;
+    product_operand<M2> _rhs;
+};
+
+// compile-time dimensions of the nodes, from those of their operands
+
+template < typename T, typename M1, typename M2 >
+struct static_shape<matrix_sum<T, M1, M2>> {
+    static constexpr size_t height = static_shape<M1>::height ? static_shape<M1>::height : static_shape<M2>::height;
+    static constexpr size_t width = static_shape<M1>::width ? static_shape<M1>::width : static_shape<M2>::width;
+};
+
+template < typename T, typename M1, typename M2 >
+struct static_shape<matrix_difference<T, M1, M2>> : static_shape<matrix_sum<T, M1, M2>> {};
+
+template < typename T, typename M, typename S >
+struct static_shape<matrix_scalar_product<T, M, S>> : static_shape<M> {};
+
+template < typename T, typename M >
+struct static_shape<matrix_transpose<T, M>> {
+    static constexpr size_t height = static_shape<M>::width;
+    static constexpr size_t width = static_shape<M>::height;
+};
+
+template < typename T, typename M, typename S >
+struct static_shape<matrix_vector_product<T, M, S>> {
+    static constexpr size_t height = static_shape<M>::height;
+    static constexpr size_t width = 1;
+};
+
+template < typename T, typename M1, typename M2 >
+struct static_shape<matrix_dot_product<T, M1, M2>> {
+    static constexpr size_t height = static_shape<M1>::height;
+    static constexpr size_t width = static_shape<M2>::width;
 };
 
 template < class T, class Derived >
 class matrix_expression {
 public:
+    using value_type = T;
+
     template < typename S, typename Other >
     matrix_sum<T, Derived, Other> operator+(const matrix_expression<S, Other> &that) const {
         return matrix_sum<T, Derived, Other>(
@@ -237,6 +432,13 @@ public:
                 that);
     }
 
+    template < typename S >
+    matrix_vector_product<T, Derived, S> dotProduct(vector<S> &&that) const {
+        return matrix_vector_product<T, Derived, S>(
+                static_cast<const Derived&>(*this),
+                std::move(that));
+    }
+
     matrix_transpose<T, Derived> transpose() const {
         return matrix_transpose<T, Derived>(
                 static_cast<const Derived&>(*this));
@@ -244,12 +446,14 @@ public:
 
     template < typename S, typename Other >
     bool operator==(const matrix_expression<S, Other>& other) const {
-        if(height() != other.height() || width() != other.width()) {
+        const Derived& self = derived();
+        const Other& that = other.derived();
+        if(self.height() != that.height() || self.width() != that.width()) {
             return false;
         }
-        for (size_t i = 0; i < height(); ++i) {
-            for (size_t j = 0; j < width(); ++j) {
-                if(get(i,j) != other.get(i,j)) {
+        for (size_t i = 0; i < self.height(); ++i) {
+            for (size_t j = 0; j < self.width(); ++j) {
+                if(self.get(i,j) != that.get(i,j)) {
                     return false;
                 }
             }
@@ -257,11 +461,32 @@ public:
         return true;
     }
 
-    // basic operations for subclasses
+    // evaluates the expression into a dense temporary, so that it is computed
+    // only once no matter how many times the result is read
+    full_matrix<T> eval() const {
+        return full_matrix<T>(static_cast<const Derived&>(*this));
+    }
+
+    // estimated cost of reading one element, in element reads of a stored matrix
+    double element_cost() const {
+        return 1;
+    }
+
+    const Derived& derived() const {
+        return static_cast<const Derived&>(*this);
+    }
+
+    // basic operations, resolved statically: every subclass must define them
 
-    virtual T get(size_t row, size_t col) const = 0;
+    T get(size_t row, size_t col) const {
+        return derived().get(row, col);
+    }
 
-    virtual size_t height() const = 0;
+    size_t height() const {
+        return derived().height();
+    }
 
-    virtual size_t width() const = 0;
+    size_t width() const {
+        return derived().width();
+    }
 };
\ No newline at end of file
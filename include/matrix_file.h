@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "full_matrix.h"
+#include "matrix.h"
+
+// Binary file format for dense matrices: a 64-byte header followed by the
+// rows exactly as full_matrix keeps them in memory, padding included, so
+// saving is one write of the buffer and loading one read into it. The data
+// starts at an aligned offset and rows keep their aligned stride, so a
+// mapped_matrix can use the file's pages in place. Files are read on hosts
+// of the byte order they were written on.
+namespace binary {
+
+    constexpr uint32_t version = 1;
+
+    // read back as written only on hosts of the same byte order
+    constexpr uint32_t byte_order_mark = 0x01020304;
+
+    enum class element_kind : uint32_t { signed_integer = 1, unsigned_integer = 2, floating_point = 3 };
+
+    // row_major: rows of `stride` elements one after the other;
+    // tiled: stride x stride tiles, each row-major, stored by rows of tiles
+    enum class layout : uint32_t { row_major = 1, tiled = 2 };
+
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t kind;          // element_kind
+        uint32_t element_size;  // bytes
+        uint32_t layout;
+        uint32_t alignment;     // bytes, of the data offset and of the row stride
+        uint64_t height;
+        uint64_t width;
+        uint64_t stride;        // elements from the start of one row to the next, or the tile side
+        uint64_t data_offset;   // bytes from the start of the file
+    };
+
+    static_assert(sizeof(header) == 64, "The header is laid out without padding");
+
+    constexpr char magic[8] = {'M', 'A', 'T', 'R', 'I', 'X', '\r', '\n'};
+
+    template < typename T >
+    constexpr element_kind kind_of() {
+        static_assert(std::is_arithmetic<T>::value, "Only matrices of arithmetic types are saved");
+        return std::is_floating_point<T>::value ? element_kind::floating_point :
+               std::is_signed<T>::value ? element_kind::signed_integer : element_kind::unsigned_integer;
+    }
+
+    template < typename T >
+    header make_header(size_t height, size_t width, size_t stride, layout kind = layout::row_major) {
+        header h {};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.byte_order = byte_order_mark;
+        h.kind = static_cast<uint32_t>(kind_of<T>());
+        h.element_size = sizeof(T);
+        h.layout = static_cast<uint32_t>(kind);
+        h.alignment = matrix_alignment;
+        h.height = height;
+        h.width = width;
+        h.stride = stride;
+        h.data_offset = (sizeof(header) + matrix_alignment - 1) / matrix_alignment * matrix_alignment;
+        return h;
+    }
+
+    // a * b, unless that does not fit in 64 bits
+    inline bool product_fits(uint64_t a, uint64_t b, uint64_t& product) {
+        if(a != 0 && b > UINT64_MAX / a) {
+            return false;
+        }
+        product = a * b;
+        return true;
+    }
+
+    // elements stored after the header; false when a corrupt header describes
+    // more of them than 64 bits count
+    inline bool stored_elements(const header& h, uint64_t& count) {
+        if(h.layout == static_cast<uint32_t>(layout::tiled)) {
+            uint64_t side = h.stride == 0 ? 1 : h.stride;
+            uint64_t tile_rows = h.height / side + (h.height % side != 0);
+            uint64_t tile_cols = h.width / side + (h.width % side != 0);
+            uint64_t tile = 0;
+            return product_fits(side, side, tile) && product_fits(tile_rows, tile_cols, count) &&
+                   product_fits(count, tile, count);
+        }
+        return product_fits(h.height, h.stride, count);
+    }
+
+    // throws std::runtime_error unless h describes a matrix of T with the
+    // given layout that fits in a file of `size` bytes
+    template < typename T >
+    void check(const header& h, uint64_t size, const std::string& path, layout kind = layout::row_major) {
+        auto fail = [&](const std::string& why) {
+            throw std::runtime_error(path + ": " + why);
+        };
+        if(std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+            fail("not a binary matrix file");
+        }
+        if(h.version != version) {
+            fail("unsupported format version " + std::to_string(h.version));
+        }
+        if(h.byte_order != byte_order_mark) {
+            fail("written with another byte order");
+        }
+        if(h.kind != static_cast<uint32_t>(kind_of<T>()) || h.element_size != sizeof(T)) {
+            fail("elements are not of the requested type");
+        }
+        if(h.layout != static_cast<uint32_t>(kind)) {
+            fail("unsupported layout");
+        }
+        bool tiled = kind == layout::tiled;
+        if((tiled ? h.stride == 0 : h.stride < h.width) || h.data_offset < sizeof(header) || h.data_offset % alignof(T) != 0) {
+            fail("corrupt header");
+        }
+        uint64_t elements = 0;
+        if(!stored_elements(h, elements)) {
+            fail("corrupt header");
+        }
+        if(size < h.data_offset || (size - h.data_offset) / sizeof(T) < elements) {
+            fail("truncated");
+        }
+    }
+
+    inline header read_header(std::istream& in, const std::string& path) {
+        header h {};
+        if(!in.read(reinterpret_cast<char*>(&h), sizeof(h))) {
+            throw std::runtime_error(path + ": truncated");
+        }
+        return h;
+    }
+
+    // one streaming write of the header and the whole buffer
+    template < typename T, typename Alloc >
+    void save(const full_matrix<T, Alloc>& m, const std::string& path) {
+        header h = make_header<T>(m.height(), m.width(), m.stride());
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        char padding[matrix_alignment] = {};
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(padding, static_cast<std::streamsize>(h.data_offset - sizeof(h)));
+        out.write(reinterpret_cast<const char*>(m.data()), static_cast<std::streamsize>(m.height() * m.stride() * sizeof(T)));
+        out.close();
+        if(!out) {
+            throw std::runtime_error(path + ": write failed");
+        }
+    }
+
+    // other expressions are evaluated first
+    template < typename T, typename E >
+    void save(const matrix_expression<T, E>& e, const std::string& path) {
+        save(full_matrix<T>(e.derived()), path);
+    }
+
+    template < typename T, typename Alloc = aligned_allocator<T> >
+    full_matrix<T, Alloc> load(const std::string& path, const Alloc& alloc = Alloc()) {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if(!in) {
+            throw std::runtime_error(path + ": cannot open");
+        }
+        auto size = static_cast<uint64_t>(in.tellg());
+        in.seekg(0);
+        header h = read_header(in, path);
+        check<T>(h, size, path);
+        full_matrix<T, Alloc> m (h.height, h.width, T{}, alloc);
+        in.seekg(static_cast<std::streamoff>(h.data_offset));
+        if(h.stride == m.stride()) {
+            in.read(reinterpret_cast<char*>(m.data()), static_cast<std::streamsize>(h.height * h.stride * sizeof(T)));
+        } else {
+            for (size_t i = 0; i < h.height && in; ++i) {
+                in.seekg(static_cast<std::streamoff>(h.data_offset + i * h.stride * sizeof(T)));
+                in.read(reinterpret_cast<char*>(m.data() + i * m.stride()), static_cast<std::streamsize>(h.width * sizeof(T)));
+            }
+        }
+        if(!in) {
+            throw std::runtime_error(path + ": read failed");
+        }
+        return m;
+    }
+}
+
+// Read-only dense matrix backed by a memory-mapped binary file (see
+// binary::save). Opening only maps the file and checks its header; pages are
+// read in by the OS on first access, and processes mapping the same file
+// share one copy of them in the page cache. Rows are aligned as in a
+// full_matrix, so the vectorized norms and the blocked product read it in
+// place. POSIX only.
+template < typename T >
+class mapped_matrix : public matrix<T, mapped_matrix<T>> {
+public:
+    explicit mapped_matrix(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        struct stat st {};
+        if(::fstat(fd, &st) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+        _size = static_cast<size_t>(st.st_size);
+        if(_size < sizeof(binary::header)) {
+            ::close(fd);
+            throw std::runtime_error(path + ": truncated");
+        }
+        void* p = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        int error = errno;
+        ::close(fd);
+        if(p == MAP_FAILED) {
+            throw std::system_error(error, std::generic_category(), path);
+        }
+        _map = static_cast<const char*>(p);
+
+        binary::header h {};
+        std::memcpy(&h, _map, sizeof(h));
+        try {
+            binary::check<T>(h, _size, path);
+        } catch (...) {
+            unmap();
+            throw;
+        }
+        _data = reinterpret_cast<const T*>(_map + h.data_offset);
+        _h = h.height;
+        _w = h.width;
+        _stride = h.stride;
+    }
+
+    mapped_matrix(const mapped_matrix&) = delete;
+
+    mapped_matrix& operator=(const mapped_matrix&) = delete;
+
+    mapped_matrix(mapped_matrix&& other) noexcept
+            : _map(other._map), _size(other._size), _data(other._data), _h(other._h), _w(other._w), _stride(other._stride) {
+        other._map = nullptr;
+    }
+
+    mapped_matrix& operator=(mapped_matrix&& other) noexcept {
+        if(this != &other) {
+            unmap();
+            _map = other._map;
+            _size = other._size;
+            _data = other._data;
+            _h = other._h;
+            _w = other._w;
+            _stride = other._stride;
+            other._map = nullptr;
+        }
+        return *this;
+    }
+
+    ~mapped_matrix() override {
+        unmap();
+    }
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(mapped_matrix);
+        return _data[row * _stride + col];
+    }
+
+    // read-only: assignments to a mapped matrix do not compile
+    template < typename Other >
+    void store(const Other&) {
+        static_assert(sizeof(Other) == 0, "mapped_matrix is read-only; copy it into a full_matrix to modify it");
+    }
+
+    size_t height() const {
+        return _h;
+    }
+
+    size_t width() const {
+        return _w;
+    }
+
+    // raw storage access, element (r, c) is at data()[r * stride() + c]
+
+    const T* data() const noexcept {
+        return _data;
+    }
+
+    size_t stride() const noexcept {
+        return _stride;
+    }
+
+    // asks the OS to start reading the whole matrix in ahead of use
+    void will_need() const {
+        ::madvise(const_cast<char*>(_map), _size, MADV_WILLNEED);
+    }
+
+private:
+    const char* _map = nullptr;
+    size_t _size = 0;
+    const T* _data = nullptr;
+    size_t _h = 0;
+    size_t _w = 0;
+    size_t _stride = 0;
+
+    void unmap() noexcept {
+        if(_map != nullptr) {
+            ::munmap(const_cast<char*>(_map), _size);
+            _map = nullptr;
+        }
+    }
+};
+
+template < typename T >
+struct is_contiguous<mapped_matrix<T>> : std::true_type {};
+
+template < typename T >
+struct view_traits<mapped_matrix<T>> {
+    using type = dense_view<T, false>;
+    using const_type = dense_view<T, false>;
+};
+
+// lets assignments reach mapped_matrix::store, which refuses them
+template < typename T >
+struct assignment_temporary<mapped_matrix<T>> {
+    using type = full_matrix<T>;
+};
+
+template < typename T >
+gemm::strided_source<T> gemm_source(const mapped_matrix<T>& m) {
+    return {m.data(), m.stride(), 1};
+}
+
+template < typename T >
+gemm::strided_source<T> gemm_source(const matrix_transpose<T, mapped_matrix<T>>& m) {
+    return {m.operand().data(), 1, m.operand().stride()};
+}
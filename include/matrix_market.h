@@ -0,0 +1,468 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "compressed_matrix.h"
+#include "coo_builder.h"
+#include "matrix.h"
+#include "parallel.h"
+
+// Matrix Market (.mtx) files: the coordinate and array formats, with real,
+// integer or pattern entries and general, symmetric or skew-symmetric
+// storage. Reading goes through the file in chunks, parses the lines of each
+// chunk in parallel and hands the entries straight to a coo_builder, so
+// neither the text nor a sparse_matrix of it is ever held whole. Writing
+// streams one line per entry through a small buffer.
+namespace matrix_market {
+
+    enum class format { coordinate, array };
+
+    enum class field { real, integer, pattern };
+
+    enum class symmetry { general, symmetric, skew_symmetric };
+
+    struct header {
+        format fmt;
+        field values;
+        symmetry storage;
+        size_t height;
+        size_t width;
+        size_t entries;     // lines of entries that follow
+    };
+
+    namespace detail {
+
+        [[noreturn]] inline void fail(const std::string& why) {
+            throw std::runtime_error("Matrix Market: " + why);
+        }
+
+        inline std::string lower(std::string s) {
+            std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) {
+                return static_cast<char>(std::tolower(c));
+            });
+            return s;
+        }
+
+        template < typename T >
+        T parse_value(const char*& p, const char* end, field values) {
+            char* next = nullptr;
+            T val;
+            if(values == field::pattern) {
+                return static_cast<T>(1);
+            } else if(values == field::integer) {
+                val = static_cast<T>(std::strtoll(p, &next, 10));
+            } else {
+                val = static_cast<T>(std::strtod(p, &next));
+            }
+            if(next == p || next > end) {
+                fail("missing value");
+            }
+            p = next;
+            return val;
+        }
+
+        inline size_t parse_index(const char*& p, const char* end, size_t size) {
+            char* next = nullptr;
+            unsigned long long idx = std::strtoull(p, &next, 10);
+            if(next == p || next > end) {
+                fail("missing index");
+            }
+            if(idx == 0 || idx > size) {
+                fail("index " + std::to_string(idx) + " out of range");
+            }
+            p = next;
+            return static_cast<size_t>(idx - 1);
+        }
+
+        // calls f(first, end) for every line of [first, last) holding data
+        template < typename F >
+        void for_each_line(const char* first, const char* last, F f) {
+            while (first < last) {
+                auto end = static_cast<const char*>(std::memchr(first, '\n', last - first));
+                if(end == nullptr) {
+                    end = last;
+                }
+                const char* p = first;
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+                    ++p;
+                }
+                if(p < end && *p != '%') {
+                    f(p, end);
+                }
+                first = end + 1;
+            }
+        }
+
+        // start of the first line beginning at or after pos
+        inline size_t line_start(const char* text, size_t size, size_t pos) {
+            if(pos == 0 || pos >= size) {
+                return std::min(pos, size);
+            }
+            auto newline = static_cast<const char*>(std::memchr(text + pos - 1, '\n', size - pos + 1));
+            return newline == nullptr ? size : newline - text + 1;
+        }
+
+        // Parses the complete lines in text: pieces of at least min_piece
+        // bytes, split at line starts, go to parse(piece, first, last) in parallel.
+        template < typename F >
+        size_t parse_pieces(const char* text, size_t size, F parse) {
+            constexpr size_t min_piece = size_t(1) << 16;
+            size_t pieces = std::max<size_t>(1, std::min(size / min_piece, parallel::concurrency() * 8));
+            std::vector<size_t> starts(pieces + 1);
+            for (size_t i = 0; i < pieces; ++i) {
+                starts[i] = line_start(text, size, size / pieces * i);
+            }
+            starts[pieces] = size;
+            parallel::for_range(0, pieces, 1, [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    parse(i, text + starts[i], text + starts[i + 1]);
+                }
+            });
+            return pieces;
+        }
+
+        // Feeds whole lines of `in`, about chunk_bytes at a time, to
+        // process(text, size). The buffer only grows for longer lines. The
+        // text is followed by a '\0', which stops the strto* parsers on a last
+        // line without a newline; the buffer keeps a spare byte for it.
+        template < typename F >
+        void for_each_chunk(std::istream& in, size_t chunk_bytes, F process) {
+            size_t capacity = std::max<size_t>(chunk_bytes, 1);
+            std::unique_ptr<char[]> buffer(new char[capacity + 1]);
+            size_t kept = 0;
+            while (in) {
+                if(kept == capacity) {
+                    std::unique_ptr<char[]> larger(new char[2 * capacity + 1]);
+                    std::memcpy(larger.get(), buffer.get(), kept);
+                    buffer.swap(larger);
+                    capacity *= 2;
+                }
+                in.read(buffer.get() + kept, static_cast<std::streamsize>(capacity - kept));
+                size_t size = kept + static_cast<size_t>(in.gcount());
+                size_t cut = size;
+                if(in) {
+                    while (cut > 0 && buffer[cut - 1] != '\n') {
+                        --cut;
+                    }
+                }
+                if(cut > 0) {
+                    char next = buffer[cut];
+                    buffer[cut] = '\0';
+                    process(static_cast<const char*>(buffer.get()), cut);
+                    buffer[cut] = next;
+                }
+                kept = size - cut;
+                std::memmove(buffer.get(), buffer.get() + cut, kept);
+            }
+        }
+    }
+
+    // reads the banner, the comments and the size line
+    inline header read_header(std::istream& in) {
+        std::string line;
+        if(!std::getline(in, line)) {
+            detail::fail("empty input");
+        }
+        std::istringstream banner(detail::lower(line));
+        std::string tag, object, fmt, values, storage;
+        banner >> tag >> object >> fmt >> values >> storage;
+        if(tag != "%%matrixmarket" || object != "matrix") {
+            detail::fail("not a Matrix Market matrix");
+        }
+
+        header h {};
+        if(fmt == "coordinate") {
+            h.fmt = format::coordinate;
+        } else if(fmt == "array") {
+            h.fmt = format::array;
+        } else {
+            detail::fail("unsupported format " + fmt);
+        }
+        if(values == "real" || values == "double") {
+            h.values = field::real;
+        } else if(values == "integer") {
+            h.values = field::integer;
+        } else if(values == "pattern" && h.fmt == format::coordinate) {
+            h.values = field::pattern;
+        } else {
+            detail::fail("unsupported field " + values);
+        }
+        if(storage == "general") {
+            h.storage = symmetry::general;
+        } else if(storage == "symmetric") {
+            h.storage = symmetry::symmetric;
+        } else if(storage == "skew-symmetric") {
+            h.storage = symmetry::skew_symmetric;
+        } else {
+            detail::fail("unsupported symmetry " + storage);
+        }
+
+        while (std::getline(in, line) && (line.empty() || line[0] == '%' || line.find_first_not_of(" \t\r") == std::string::npos)) {}
+        std::istringstream size(line);
+        if(!(size >> h.height >> h.width)) {
+            detail::fail("missing size line");
+        }
+        if(h.fmt == format::coordinate) {
+            if(!(size >> h.entries)) {
+                detail::fail("missing entry count");
+            }
+        } else if(h.storage == symmetry::general) {
+            h.entries = h.height * h.width;
+        } else {
+            size_t n = h.height;
+            h.entries = h.storage == symmetry::symmetric ? n * (n + 1) / 2 : n * (n - 1) / 2;
+        }
+        if(h.storage != symmetry::general && h.height != h.width) {
+            detail::fail("symmetric matrices must be square");
+        }
+        return h;
+    }
+
+    // Reads a whole matrix from `in`, chunk_bytes of text at a time; entries
+    // repeated in coordinate files are summed. Throws std::runtime_error on
+    // malformed input.
+    template < typename T >
+    csr_matrix<T> read(std::istream& in, size_t chunk_bytes = size_t(1) << 24) {
+        using batch = typename coo_builder<T>::batch;
+        const header h = read_header(in);
+        coo_builder<T> builder (h.height, h.width);
+        std::atomic<size_t> lines(0);
+
+        // off-diagonal entries of symmetric storage stand for their mirror as well
+        auto add = [&h](batch& out, size_t row, size_t col, T val) {
+            if(val == static_cast<T>(0)) {
+                return;
+            }
+            out.push_back({row, col, val});
+            if(row != col && h.storage != symmetry::general) {
+                out.push_back({col, row, h.storage == symmetry::symmetric ? val : static_cast<T>(-val)});
+            }
+        };
+
+        if(h.fmt == format::coordinate) {
+            detail::for_each_chunk(in, chunk_bytes, [&](const char* text, size_t size) {
+                detail::parse_pieces(text, size, [&](size_t, const char* first, const char* last) {
+                    batch entries;
+                    size_t count = 0;
+                    detail::for_each_line(first, last, [&](const char* p, const char* end) {
+                        size_t row = detail::parse_index(p, end, h.height);
+                        size_t col = detail::parse_index(p, end, h.width);
+                        if(h.storage != symmetry::general && (col > row || (col == row && h.storage == symmetry::skew_symmetric))) {
+                            detail::fail("entry above the diagonal of a symmetric matrix");
+                        }
+                        add(entries, row, col, detail::parse_value<T>(p, end, h.values));
+                        ++count;
+                    });
+                    lines += count;
+                    builder.insert(std::move(entries));
+                });
+            });
+        } else {
+            // array entries are listed by column, so each piece needs to know
+            // how many come before it
+            const size_t skip = h.storage == symmetry::skew_symmetric ? 1 : 0;
+            auto position = [&h, skip](size_t k, size_t& row, size_t& col) {
+                if(h.storage == symmetry::general) {
+                    row = k % h.height;
+                    col = k / h.height;
+                    return;
+                }
+                col = 0;
+                for (size_t length = h.height - skip; length > 0 && k >= length; --length) {
+                    k -= length;
+                    ++col;
+                }
+                row = col + skip + k;
+            };
+            size_t done = 0;
+            detail::for_each_chunk(in, chunk_bytes, [&](const char* text, size_t size) {
+                std::vector<std::vector<T>> values (parallel::concurrency() * 8 + 1);
+                size_t pieces = detail::parse_pieces(text, size, [&](size_t piece, const char* first, const char* last) {
+                    detail::for_each_line(first, last, [&](const char* p, const char* end) {
+                        values[piece].push_back(detail::parse_value<T>(p, end, h.values));
+                    });
+                });
+                std::vector<size_t> starts(pieces + 1, done);
+                for (size_t i = 0; i < pieces; ++i) {
+                    starts[i + 1] = starts[i] + values[i].size();
+                }
+                done = starts[pieces];
+                if(done > h.entries) {
+                    detail::fail("more entries than the size line gives");
+                }
+                parallel::for_range(0, pieces, 1, [&](size_t first, size_t last) {
+                    for (size_t i = first; i < last; ++i) {
+                        batch entries;
+                        size_t row = 0, col = 0;
+                        position(starts[i], row, col);
+                        for (const T& val : values[i]) {
+                            add(entries, row, col, val);
+                            if(++row == h.height) {
+                                ++col;
+                                row = h.storage == symmetry::general ? 0 : col + skip;
+                            }
+                        }
+                        builder.insert(std::move(entries));
+                    }
+                });
+            });
+            lines = done;
+        }
+        if(lines != h.entries) {
+            detail::fail(std::to_string(h.entries) + " entries announced, " + std::to_string(lines.load()) + " found");
+        }
+        return builder.build();
+    }
+
+    template < typename T >
+    csr_matrix<T> read(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if(!in) {
+            throw std::runtime_error(path + ": cannot open");
+        }
+        return read<T>(in);
+    }
+
+    namespace detail {
+
+        // lines formatted into a fixed buffer that is handed to the stream when full
+        class line_writer {
+        public:
+            explicit line_writer(std::ostream& out) : _out(out) {}
+
+            line_writer(const line_writer&) = delete;
+
+            ~line_writer() {
+                flush();
+            }
+
+            template < typename T >
+            void entry(size_t row, size_t col, T val) {
+                reserve();
+                _used += std::snprintf(_buffer + _used, line_size, "%zu %zu ", row + 1, col + 1);
+                value(val);
+            }
+
+            template < typename T >
+            void value(T val) {
+                reserve();
+                _used += format(val);
+                _buffer[_used++] = '\n';
+            }
+
+            void flush() {
+                _out.write(_buffer, static_cast<std::streamsize>(_used));
+                _used = 0;
+            }
+
+        private:
+            static constexpr size_t buffer_size = size_t(1) << 16;
+            static constexpr size_t line_size = 128;
+
+            std::ostream& _out;
+            char _buffer[buffer_size];
+            size_t _used = 0;
+
+            void reserve() {
+                if(_used + line_size > buffer_size) {
+                    flush();
+                }
+            }
+
+            template < typename T >
+            typename std::enable_if<std::is_floating_point<T>::value, size_t>::type format(T val) {
+                return std::snprintf(_buffer + _used, line_size, "%.*g", std::numeric_limits<T>::max_digits10, double(val));
+            }
+
+            template < typename T >
+            typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, size_t>::type format(T val) {
+                return std::snprintf(_buffer + _used, line_size, "%lld", static_cast<long long>(val));
+            }
+
+            template < typename T >
+            typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, size_t>::type format(T val) {
+                return std::snprintf(_buffer + _used, line_size, "%llu", static_cast<unsigned long long>(val));
+            }
+        };
+
+        inline const char* name_of(symmetry storage) {
+            return storage == symmetry::general ? "general" : storage == symmetry::symmetric ? "symmetric" : "skew-symmetric";
+        }
+
+        // entries stored for the given symmetry, which is taken for granted
+        inline bool stored(symmetry storage, size_t row, size_t col) {
+            return storage == symmetry::general || row > col || (row == col && storage == symmetry::symmetric);
+        }
+
+        template < typename T >
+        const char* field_of() {
+            return std::is_integral<T>::value ? "integer" : "real";
+        }
+
+        // sparse matrices as coordinates, visiting their stored entries twice
+        template < typename T, typename M >
+        void write(std::ostream& out, const M& m, symmetry storage, std::true_type) {
+            size_t entries = 0;
+            for (const matrix_entry<T>& e : m.nonzeros()) {
+                entries += stored(storage, e.row, e.col) ? 1 : 0;
+            }
+            out << "%%MatrixMarket matrix coordinate " << field_of<T>() << " " << name_of(storage) << "\n"
+                << m.height() << " " << m.width() << " " << entries << "\n";
+            line_writer lines(out);
+            for (const matrix_entry<T>& e : m.nonzeros()) {
+                if(stored(storage, e.row, e.col)) {
+                    lines.entry(e.row, e.col, e.value);
+                }
+            }
+        }
+
+        // anything else as an array, column by column
+        template < typename T, typename M >
+        void write(std::ostream& out, const M& m, symmetry storage, std::false_type) {
+            out << "%%MatrixMarket matrix array " << field_of<T>() << " " << name_of(storage) << "\n"
+                << m.height() << " " << m.width() << "\n";
+            line_writer lines(out);
+            for (size_t j = 0; j < m.width(); ++j) {
+                for (size_t i = 0; i < m.height(); ++i) {
+                    if(stored(storage, i, j)) {
+                        lines.value(m.get(i, j));
+                    }
+                }
+            }
+        }
+    }
+
+    // Writes m as coordinates if it is a sparse storage type, as an array
+    // otherwise. With a symmetric `storage` only the lower triangle is
+    // written, m being assumed to have the symmetry.
+    template < typename T, typename M >
+    void write(std::ostream& out, const matrix_expression<T, M>& m, symmetry storage = symmetry::general) {
+        detail::write<T>(out, m.derived(), storage, is_sparse<M>());
+        if(!out) {
+            throw std::runtime_error("Matrix Market: write failed");
+        }
+    }
+
+    template < typename T, typename M >
+    void write(const std::string& path, const matrix_expression<T, M>& m, symmetry storage = symmetry::general) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if(!out) {
+            throw std::runtime_error(path + ": cannot open");
+        }
+        write(out, m, storage);
+    }
+}
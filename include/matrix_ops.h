@@ -1,12 +1,29 @@
 #pragma once
+#include <cassert>
 #include <cstddef>
 
 #include "matrix_expr.h"
 
 using std::vector;
 
+// Dimensions known at compile time, 0 where they are only known at run time.
+// Fixed-size storage specializes it and matrix_expr.h propagates it through
+// the expression nodes, so operands of mismatched fixed sizes fail to compile.
+template < typename M >
+struct static_shape {
+    static constexpr size_t height = 0;
+    static constexpr size_t width = 0;
+};
+
+constexpr bool extents_match(size_t a, size_t b) {
+    return a == 0 || b == 0 || a == b;
+}
+
 template < typename T, typename M1, typename M2 >
 struct matrix_plus {
+    static_assert(extents_match(static_shape<M1>::height, static_shape<M2>::height) &&
+                  extents_match(static_shape<M1>::width, static_shape<M2>::width),
+                  "Operands of a sum must have the same dimensions");
 
     T operator()(const M1& a, const M2& b, size_t row, size_t col) const {
         return a.get(row, col) + b.get(row, col);
@@ -20,6 +37,9 @@ struct matrix_plus {
 
 template < typename T, typename M1, typename M2 >
 struct matrix_minus {
+    static_assert(extents_match(static_shape<M1>::height, static_shape<M2>::height) &&
+                  extents_match(static_shape<M1>::width, static_shape<M2>::width),
+                  "Operands of a difference must have the same dimensions");
 
     T operator()(const M1& a, const M2& b, size_t row, size_t col) const {
         return a.get(row, col) - b.get(row, col);
@@ -42,23 +62,46 @@ struct matrix_scalar_times {
 template < typename T, typename M, typename S >
 struct matrix_vector_product_op {
 
-    T operator()(const M& a, const vector<S>& b, size_t row, size_t col) const {
+    T operator()(const M& a, const vector<S>& b, size_t row, size_t) const {
         T val {0};
-        for (size_t k = 0; k < b.height(); ++k) {
-            val += a.get(row,k) * b.get(k, col);
+        for (size_t k = 0; k < b.size(); ++k) {
+            val += a.get(row,k) * b[k];
         }
         return val;
     }
 
     void assert_sizes(const M& a, const vector<S>& b) const {
-        assert(a.width() = b.size());
+        assert(a.width() == b.size());
+    }
+};
+
+// Evaluates a whole matrix-vector product y = a * x at once. Storage types
+// that can do better than one get() per term specialize it, and those that
+// also multiply by a dense matrix faster than the blocked kernel set
+// has_matrix_product and provide multiply(a, b, c) for full_matrix b and c.
+template < typename M >
+struct product_kernel {
+    static constexpr bool has_matrix_product = false;
+
+    template < typename T, typename S >
+    static void multiply(const M& a, const vector<S>& x, vector<T>& y) {
+        for (size_t i = 0; i < a.height(); ++i) {
+            T val {0};
+            for (size_t k = 0; k < x.size(); ++k) {
+                val += a.get(i, k) * x[k];
+            }
+            y[i] = val;
+        }
     }
 };
 
 template < typename T, typename M1, typename M2 >
 struct matrix_dot_product_op {
+    static_assert(extents_match(static_shape<M1>::width, static_shape<M2>::height),
+                  "The width of the left operand of a product must be the height of the right one");
 
-    T operator()(const M1& a, const M2& b, size_t row, size_t col) const {
+    template < typename A, typename B >
+    T operator()(const A& a, const B& b, size_t row, size_t col) const {
         T val {0};
         for (size_t k = 0; k < b.height(); ++k) {
             val += a.get(row,k) * b.get(k, col);
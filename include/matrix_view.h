@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+#include "gemm.h"
+#include "matrix.h"
+#include "parallel.h"
+
+// Non-owning views of part of a matrix: blocks, rows, columns, diagonals
+// and strided slices, handed out by matrix::block() and friends. They are
+// matrices themselves, so they take part in expressions and can be
+// assigned to, which writes through to the viewed matrix; copying a view
+// copies the reference, not the elements. A view must not outlive the
+// matrix it views, nor a reallocation of it (full_matrix::store() to a
+// different shape).
+
+template < typename T, bool Writable >
+class dense_view;
+
+// View of any matrix through its get() and set(). M is const for read-only views.
+template < typename M >
+class indexed_view : public matrix<typename std::remove_const<M>::type::value_type, indexed_view<M>> {
+public:
+    using value_type = typename std::remove_const<M>::type::value_type;
+
+    indexed_view(M& m, const view_layout& layout) : _m(&m), _layout(layout) {
+        assert(layout.height == 0 || layout.width == 0 ||
+               (row_of(layout.height - 1) < m.height() && col_of(layout.height - 1, layout.width - 1) < m.width()));
+    }
+
+    // views of a view index the underlying matrix directly
+    template < typename N >
+    indexed_view(const indexed_view<N>& v, const view_layout& layout) : _m(&v.base()), _layout(compose(v.layout(), layout)) {}
+
+    indexed_view(const indexed_view&) = default;
+
+    indexed_view& operator=(const indexed_view& other) {
+        return this->assign(other);
+    }
+
+    template < typename Other >
+    indexed_view& operator=(const matrix_expression<value_type, Other>& other) {
+        return this->assign(other);
+    }
+
+    value_type get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(indexed_view);
+        return _m->get(row_of(row), col_of(row, col));
+    }
+
+    void set(size_t row, size_t col, const value_type& val) {
+        _m->set(row_of(row), col_of(row, col), val);
+    }
+
+    // see matrix::assign; set() need not be thread-safe, so this is serial
+    template < typename Other >
+    void store(const Other& src) {
+        assert(src.height() == height() && src.width() == width());
+        MATRIX_TIME_MATERIALIZATION("indexed_view assign", Other, height(), width());
+        for (size_t i = 0; i < height(); ++i) {
+            for (size_t j = 0; j < width(); ++j) {
+                set(i, j, src.get(i, j));
+            }
+        }
+    }
+
+    size_t height() const {
+        return _layout.height;
+    }
+
+    size_t width() const {
+        return _layout.width;
+    }
+
+    double element_cost() const {
+        return _m->element_cost();
+    }
+
+    M& base() const {
+        return *_m;
+    }
+
+    const view_layout& layout() const {
+        return _layout;
+    }
+
+private:
+    M* _m;
+    view_layout _layout;
+
+    size_t row_of(size_t row) const {
+        return _layout.row + row * _layout.row_step;
+    }
+
+    size_t col_of(size_t row, size_t col) const {
+        return _layout.col + col * _layout.col_step + row * _layout.shear;
+    }
+
+    // layout in the viewed matrix of `inner`, given relative to `outer`
+    static view_layout compose(const view_layout& outer, const view_layout& inner) {
+        return {outer.row + inner.row * outer.row_step,
+                outer.col + inner.col * outer.col_step + inner.row * outer.shear,
+                inner.height, inner.width,
+                inner.row_step * outer.row_step,
+                inner.col_step * outer.col_step,
+                inner.shear * outer.col_step + inner.row_step * outer.shear};
+    }
+};
+
+template < typename M >
+struct view_traits<indexed_view<M>> {
+    using type = indexed_view<M>;
+    using const_type = indexed_view<const M>;
+};
+
+template < typename M >
+struct assignment_temporary<indexed_view<M>> {
+    using type = typename std::remove_const<M>::type;
+};
+
+// View of dense storage, element (i, j) at data() + i * row_stride() +
+// j * col_stride(), so views of views are views again. Writable views
+// come from non-const matrices and read-only ones from const matrices.
+// Products assigned or added to a view with unit column stride run the
+// blocked kernel straight into the viewed buffer, as tiled algorithms need:
+// c.block(...) -= a.block(...).dotProduct(b.block(...)) copies nothing.
+template < typename T, bool Writable >
+class dense_view : public matrix<T, dense_view<T, Writable>> {
+public:
+    using pointer = typename std::conditional<Writable, T*, const T*>::type;
+
+    dense_view(pointer data, size_t h, size_t w, size_t row_stride, size_t col_stride)
+            : _data(data), _h(h), _w(w), _row_stride(row_stride), _col_stride(col_stride) {}
+
+    // views of storage with contiguous rows (see is_contiguous)
+    template < typename M, typename std::enable_if<is_contiguous<typename std::remove_const<M>::type>::value, int>::type = 0 >
+    dense_view(M& m, const view_layout& layout) : dense_view(m.data(), m.stride(), 1, layout) {
+        assert(in_bounds(layout, m.height(), m.width()));
+    }
+
+    template < bool W >
+    dense_view(const dense_view<T, W>& v, const view_layout& layout)
+            : dense_view(v.data(), v.row_stride(), v.col_stride(), layout) {
+        assert(in_bounds(layout, v.height(), v.width()));
+    }
+
+    dense_view(const dense_view&) = default;
+
+    dense_view& operator=(const dense_view& other) {
+        return this->assign(other);
+    }
+
+    template < typename Other >
+    dense_view& operator=(const matrix_expression<T, Other>& other) {
+        return this->assign(other);
+    }
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(dense_view);
+        return _data[row * _row_stride + col * _col_stride];
+    }
+
+    void set(size_t row, size_t col, const T& val) {
+        static_assert(Writable, "Read-only views cannot be written");
+        _data[row * _row_stride + col * _col_stride] = val;
+    }
+
+    // see matrix::assign; views cannot be resized
+    template < typename Other >
+    void store(const Other& src) {
+        static_assert(Writable, "Read-only views cannot be assigned to");
+        assert(src.height() == height() && src.width() == width());
+        MATRIX_TIME_MATERIALIZATION("dense_view assign", Other, height(), width());
+        evaluate(src);
+    }
+
+    size_t height() const {
+        return _h;
+    }
+
+    size_t width() const {
+        return _w;
+    }
+
+    pointer data() const noexcept {
+        return _data;
+    }
+
+    size_t row_stride() const noexcept {
+        return _row_stride;
+    }
+
+    size_t col_stride() const noexcept {
+        return _col_stride;
+    }
+
+private:
+    pointer _data;
+    size_t _h;
+    size_t _w;
+    size_t _row_stride;
+    size_t _col_stride;
+
+    template < typename M >
+    using element_of = typename std::decay<decltype(std::declval<const M&>().get(0, 0))>::type;
+
+    dense_view(pointer data, size_t row_stride, size_t col_stride, const view_layout& layout)
+            : _data(data + layout.row * row_stride + layout.col * col_stride),
+              _h(layout.height), _w(layout.width),
+              _row_stride(layout.row_step * row_stride + layout.shear * col_stride),
+              _col_stride(layout.col_step * col_stride) {}
+
+    static bool in_bounds(const view_layout& l, size_t h, size_t w) {
+        return l.height == 0 || l.width == 0 ||
+               (l.row + (l.height - 1) * l.row_step < h &&
+                l.col + (l.width - 1) * l.col_step + (l.height - 1) * l.shear < w);
+    }
+
+    pointer at(size_t row, size_t col) const {
+        return _data + row * _row_stride + col * _col_stride;
+    }
+
+    // blocks of rows go to different threads once they cost enough to evaluate
+    template < typename Other >
+    void evaluate(const matrix_expression<T, Other>& other) {
+        const Other& src = other.derived();
+        parallel::for_range(0, _h, parallel::grain_for(_w * src.element_cost()), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                for (size_t j = 0; j < _w; ++j) {
+                    *at(i, j) = src.get(i, j);
+                }
+            }
+        });
+    }
+
+    template < typename M1, typename M2 >
+    using blocked_product = std::integral_constant<bool,
+            std::is_same<element_of<M1>, T>::value && std::is_same<element_of<M2>, T>::value &&
+            !product_kernel<M1>::has_matrix_product>;
+
+    // the blocked kernel writes rows of unit column stride
+
+    template < typename M1, typename M2 >
+    typename std::enable_if<blocked_product<M1, M2>::value>::type
+    evaluate(const matrix_dot_product<T, M1, M2>& product) {
+        if(_col_stride != 1) {
+            evaluate(static_cast<const matrix_expression<T, matrix_dot_product<T, M1, M2>>&>(product));
+            return;
+        }
+        for (size_t i = 0; i < _h; ++i) {
+            std::fill(at(i, 0), at(i, 0) + _w, T{});
+        }
+        multiply_add(product, false);
+    }
+
+    template < bool W, typename M1, typename M2 >
+    typename std::enable_if<blocked_product<M1, M2>::value>::type
+    evaluate(const matrix_sum<T, dense_view<T, W>, matrix_dot_product<T, M1, M2>>& sum) {
+        if(!accumulates(sum.lhs())) {
+            evaluate(static_cast<const matrix_expression<T, matrix_sum<T, dense_view<T, W>, matrix_dot_product<T, M1, M2>>>&>(sum));
+            return;
+        }
+        multiply_add(sum.rhs(), false);
+    }
+
+    template < bool W, typename M1, typename M2 >
+    typename std::enable_if<blocked_product<M1, M2>::value>::type
+    evaluate(const matrix_difference<T, dense_view<T, W>, matrix_dot_product<T, M1, M2>>& difference) {
+        if(!accumulates(difference.lhs())) {
+            evaluate(static_cast<const matrix_expression<T, matrix_difference<T, dense_view<T, W>, matrix_dot_product<T, M1, M2>>>&>(difference));
+            return;
+        }
+        multiply_add(difference.rhs(), true);
+    }
+
+    // whether `v` is this view, so that the product can be added in place
+    template < bool W >
+    bool accumulates(const dense_view<T, W>& v) const {
+        return _col_stride == 1 && v.data() == _data && v.row_stride() == _row_stride &&
+               v.col_stride() == _col_stride && v.height() == _h && v.width() == _w;
+    }
+
+    template < typename M1, typename M2 >
+    void multiply_add(const matrix_dot_product<T, M1, M2>& product, bool subtract) {
+        const product_operand<M1>& lhs = product.lhs();
+        if(lhs.evaluated()) {
+            multiply_add(gemm_source(*lhs.evaluated()), product.rhs(), lhs.width(), subtract);
+        } else {
+            multiply_add(gemm_source(lhs.expression()), product.rhs(), lhs.width(), subtract);
+        }
+    }
+
+    template < typename SrcA, typename M >
+    void multiply_add(const SrcA& a, const product_operand<M>& b, size_t k, bool subtract) {
+        if(b.evaluated()) {
+            multiply_add(a, gemm_source(*b.evaluated()), k, subtract);
+        } else {
+            multiply_add(a, gemm_source(b.expression()), k, subtract);
+        }
+    }
+
+    template < typename SrcA, typename SrcB >
+    void multiply_add(const SrcA& a, const SrcB& b, size_t k, bool subtract) {
+        if(subtract) {
+            gemm::multiply<T>(_h, _w, k, gemm::negated_source<T, SrcA>{a}, b, _data, _row_stride);
+        } else {
+            gemm::multiply<T>(_h, _w, k, a, b, _data, _row_stride);
+        }
+    }
+};
+
+template < typename T, bool Writable >
+struct view_traits<dense_view<T, Writable>> {
+    using type = dense_view<T, Writable>;
+    using const_type = dense_view<T, false>;
+};
+
+template < typename T, bool Writable >
+struct assignment_temporary<dense_view<T, Writable>> {
+    using type = full_matrix<T>;
+};
+
+// how the blocked product kernel reads its operands (see gemm.h): dense
+// storage and views straight from memory, anything else through get()
+
+template < typename M >
+gemm::expr_source<typename M::value_type, M> gemm_source(const M& m) {
+    return {m};
+}
+
+template < typename T, bool Writable >
+gemm::strided_source<T> gemm_source(const dense_view<T, Writable>& v) {
+    return {v.data(), v.row_stride(), v.col_stride()};
+}
+
+template < typename T, bool Writable >
+gemm::strided_source<T> gemm_source(const matrix_transpose<T, dense_view<T, Writable>>& t) {
+    return {t.operand().data(), t.operand().col_stride(), t.operand().row_stride()};
+}
+
+template < typename M >
+alias_target alias_target_of(const indexed_view<M>& v) {
+    alias_target target = alias_target_of(v.base());
+    target.whole = false;
+    return target;
+}
+
+template < typename T, bool Writable >
+alias_target alias_target_of(const dense_view<T, Writable>& v) {
+    return dense_target(nullptr, v.data(), v.height(), v.width(), v.row_stride(), v.col_stride());
+}
+
+template < typename M >
+aliasing alias_of(const indexed_view<M>& v, const alias_target& target) {
+    return alias_elsewhere(alias_of(v.base(), target));
+}
+
+template < typename T, bool Writable >
+aliasing alias_of(const dense_view<T, Writable>& v, const alias_target& target) {
+    return alias_of_dense(v.data(), v.height(), v.width(), v.row_stride(), v.col_stride(), target);
+}
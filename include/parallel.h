@@ -0,0 +1,341 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace parallel {
+
+    // Persistent worker threads, each with its own task deque. A worker runs
+    // its newest task first and, once out of work, steals the oldest task of
+    // another one. Threads waiting for their tasks to finish run queued tasks
+    // themselves, so parallel loops nested inside tasks never starve the pool.
+    class thread_pool {
+    public:
+        using task = std::function<void()>;
+
+        explicit thread_pool(size_t workers) {
+            start(workers);
+        }
+
+        thread_pool(const thread_pool&) = delete;
+
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool() {
+            stop();
+        }
+
+        size_t size() const {
+            return _threads.size();
+        }
+
+        // must not be called while tasks are queued or running
+        void resize(size_t workers) {
+            if(workers != size()) {
+                stop();
+                start(workers);
+            }
+        }
+
+        // queues on the calling worker's own deque, or spreads tasks from
+        // other threads over all of them
+        void submit(task t) {
+            std::pair<const thread_pool*, size_t>& self = current_worker();
+            size_t index = self.first == this ? self.second : _next++ % _queues.size();
+            ++_queued;
+            {
+                std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+                _queues[index]->tasks.push_back(std::move(t));
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _wake.notify_one();
+        }
+
+        // runs one queued task on the calling thread, false if there was none
+        bool run_one() {
+            std::pair<const thread_pool*, size_t>& self = current_worker();
+            task t;
+            if(!take(self.first == this ? self.second : 0, t)) {
+                return false;
+            }
+            t();
+            return true;
+        }
+
+    private:
+        // double-ended queue in a ring that only grows, so that steady use,
+        // unlike std::deque freeing and taking blocks as it moves, never allocates
+        class task_deque {
+        public:
+            bool empty() const {
+                return _size == 0;
+            }
+
+            void push_back(task t) {
+                if(_size == _slots.size()) {
+                    grow();
+                }
+                _slots[(_head + _size) % _slots.size()] = std::move(t);
+                ++_size;
+            }
+
+            void pop_back(task& t) {
+                --_size;
+                take(_slots[(_head + _size) % _slots.size()], t);
+            }
+
+            void pop_front(task& t) {
+                take(_slots[_head], t);
+                _head = (_head + 1) % _slots.size();
+                --_size;
+            }
+
+        private:
+            std::vector<task> _slots;
+            size_t _head = 0;
+            size_t _size = 0;
+
+            static void take(task& slot, task& t) {
+                t = std::move(slot);
+                slot = nullptr;
+            }
+
+            void grow() {
+                std::vector<task> slots (std::max<size_t>(16, 2 * _slots.size()));
+                for (size_t i = 0; i < _size; ++i) {
+                    slots[i] = std::move(_slots[(_head + i) % _slots.size()]);
+                }
+                _slots.swap(slots);
+                _head = 0;
+            }
+        };
+
+        struct queue {
+            std::mutex mutex;
+            task_deque tasks;
+        };
+
+        std::vector<std::unique_ptr<queue>> _queues;
+        std::vector<std::thread> _threads;
+        std::atomic<size_t> _queued {0};
+        std::atomic<size_t> _next {0};
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        bool _stopping = false;
+
+        static std::pair<const thread_pool*, size_t>& current_worker() {
+            static thread_local std::pair<const thread_pool*, size_t> worker(nullptr, 0);
+            return worker;
+        }
+
+        void start(size_t workers) {
+            _stopping = false;
+            _queues.clear();
+            for (size_t i = 0; i < workers; ++i) {
+                _queues.emplace_back(new queue());
+            }
+            for (size_t i = 0; i < workers; ++i) {
+                _threads.emplace_back(&thread_pool::work, this, i);
+            }
+        }
+
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            for (std::thread& thread : _threads) {
+                thread.join();
+            }
+            _threads.clear();
+        }
+
+        // own deque from the back, then the others from the front
+        bool take(size_t index, task& t) {
+            if(_queued.load() == 0) {
+                return false;
+            }
+            for (size_t n = 0; n < _queues.size(); ++n) {
+                queue& q = *_queues[(index + n) % _queues.size()];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if(!q.tasks.empty()) {
+                    if(n == 0) {
+                        q.tasks.pop_back(t);
+                    } else {
+                        q.tasks.pop_front(t);
+                    }
+                    --_queued;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(size_t index) {
+            current_worker() = std::make_pair(this, index);
+            task t;
+            while (true) {
+                if(take(index, t)) {
+                    t();
+                    t = nullptr;
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wake.wait(lock, [this] { return _stopping || _queued.load() > 0; });
+                if(_stopping && _queued.load() == 0) {
+                    return;
+                }
+            }
+        }
+    };
+
+    inline size_t& concurrency_setting() {
+        static size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        return threads;
+    }
+
+    // number of threads the parallel kernels spread their work over,
+    // the hardware concurrency unless set otherwise
+    inline size_t concurrency() {
+        return concurrency_setting();
+    }
+
+    // the calling thread takes part in every parallel loop, so the pool
+    // holds one thread less than the concurrency
+    inline thread_pool& pool() {
+        static thread_pool workers(concurrency() - 1);
+        return workers;
+    }
+
+    // must not be called while a parallel loop is running
+    inline void set_concurrency(size_t threads) {
+        concurrency_setting() = std::max<size_t>(threads, 1);
+        pool().resize(concurrency() - 1);
+    }
+
+    // chunks handed out per thread, so threads that finish early can steal
+    // from the ones that got more expensive parts of the range
+    constexpr size_t chunks_per_thread = 4;
+
+    // Element reads (see element_cost()) below which a chunk of work is not
+    // worth handing to another thread.
+    constexpr double min_chunk_cost = 32768;
+
+    // smallest number of items, each costing `item_cost` reads, worth a chunk
+    inline size_t grain_for(double item_cost) {
+        return item_cost >= min_chunk_cost ? 1 : static_cast<size_t>(min_chunk_cost / std::max(item_cost, 1.0));
+    }
+
+    // Splits [begin, end) into contiguous chunks of at least `grain` items and
+    // runs f(first, last) on each, spread over the pool and the calling
+    // thread, and returns once all are done. Ranges too small to split run on
+    // the calling thread. The first exception thrown by f is rethrown here.
+    template < typename F >
+    void for_range(size_t begin, size_t end, size_t grain, F f) {
+        if(begin >= end) {
+            return;
+        }
+        size_t chunks = std::min(concurrency() * chunks_per_thread, (end - begin) / std::max<size_t>(grain, 1));
+        if(concurrency() == 1 || chunks <= 1) {
+            f(begin, end);
+            return;
+        }
+        size_t step = (end - begin + chunks - 1) / chunks;
+        std::atomic<size_t> remaining((end - begin + step - 1) / step);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto run = [&](size_t first) {
+            try {
+                f(first, std::min(end, first + step));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if(!error) {
+                    error = std::current_exception();
+                }
+            }
+            --remaining;
+        };
+
+        // tasks capture two words, which std::function keeps without
+        // allocating, so loops in iterative methods stay allocation-free
+        thread_pool& workers = pool();
+        for (size_t first = begin + step; first < end; first += step) {
+            workers.submit([&run, first] { run(first); });
+        }
+        run(begin);
+        while (remaining.load() > 0) {
+            if(!workers.run_one()) {
+                std::this_thread::yield();
+            }
+        }
+        if(error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Sums over [0, n) split into fixed chunks of at least `grain` items,
+    // whose partial sums are added in chunk order, so results do not depend
+    // on which threads ran the chunks. Only construction allocates.
+    class reducer {
+    public:
+        reducer(size_t n, size_t grain, size_t width = 2)
+                : _n(n), _width(std::max<size_t>(width, 1)),
+                  _chunks(std::max<size_t>(1, std::min(concurrency() * chunks_per_thread, n / std::max<size_t>(grain, 1)))),
+                  _partial(_chunks * _width), _total(_width) {}
+
+        // f(first, last, sums) adds to `width` sums starting at zero; the
+        // totals stay valid until the next call
+        template < typename F >
+        const double* sum_each(F f) {
+            const size_t step = (_n + _chunks - 1) / _chunks;
+            for_range(0, _chunks, 1, [&](size_t first, size_t last) {
+                for (size_t c = first; c < last; ++c) {
+                    double* sums = _partial.data() + c * _width;
+                    std::fill(sums, sums + _width, 0.0);
+                    f(std::min(_n, c * step), std::min(_n, (c + 1) * step), sums);
+                }
+            });
+            std::fill(_total.begin(), _total.end(), 0.0);
+            for (size_t c = 0; c < _chunks; ++c) {
+                for (size_t k = 0; k < _width; ++k) {
+                    _total[k] += _partial[c * _width + k];
+                }
+            }
+            return _total.data();
+        }
+
+        // f(first, last) returns a double
+        template < typename F >
+        double sum(F f) {
+            return *sum_each([&](size_t first, size_t last, double* sums) { sums[0] = f(first, last); });
+        }
+
+        // f(first, last) returns a pair of doubles, summed separately
+        template < typename F >
+        std::pair<double, double> sum_pair(F f) {
+            const double* total = sum_each([&](size_t first, size_t last, double* sums) {
+                std::pair<double, double> s = f(first, last);
+                sums[0] = s.first;
+                sums[1] = s.second;
+            });
+            return std::make_pair(total[0], total[1]);
+        }
+
+    private:
+        size_t _n;
+        size_t _width;
+        size_t _chunks;
+        std::vector<double> _partial;
+        std::vector<double> _total;
+    };
+}
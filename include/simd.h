@@ -0,0 +1,631 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+// Kernels over contiguous arrays for the element-wise operations, transposes
+// and reductions of dense matrices. float and double run SSE2, AVX2 or
+// AVX-512 code, picked at runtime from what the CPU reports, so the same
+// binary uses the widest instructions of every machine; other element types
+// (and other CPUs) run the plain loops in simd::scalar.
+//
+// Element-wise results are the same whatever the instruction set. Sums are
+// accumulated in double over several lanes, so they may differ from a
+// sequential sum in the last bits.
+namespace simd {
+
+    enum class isa {
+        scalar,
+        sse2,
+        avx2,
+        avx512
+    };
+
+    inline isa detected_isa() {
+#ifdef MATRIX_SIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")) {
+            return isa::avx512;
+        }
+        if(__builtin_cpu_supports("avx2")) {
+            return isa::avx2;
+        }
+        if(__builtin_cpu_supports("sse2")) {
+            return isa::sse2;
+        }
+#endif
+        return isa::scalar;
+    }
+
+    inline isa& isa_setting() {
+        static isa selected = detected_isa();
+        return selected;
+    }
+
+    // instruction set the kernels currently use
+    inline isa active_isa() {
+        return isa_setting();
+    }
+
+    // restricts the kernels to an older instruction set (never to one the
+    // CPU lacks), e.g. to compare them
+    inline void set_isa(isa level) {
+        isa_setting() = std::min(level, detected_isa());
+    }
+
+    template < typename T >
+    struct is_vectorized : std::integral_constant<bool,
+            std::is_same<T, float>::value || std::is_same<T, double>::value> {};
+
+    namespace scalar {
+
+        template < typename T >
+        void add(size_t n, const T* a, const T* b, T* out) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = a[i] + b[i];
+            }
+        }
+
+        template < typename T >
+        void sub(size_t n, const T* a, const T* b, T* out) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = a[i] - b[i];
+            }
+        }
+
+        template < typename T >
+        void scale(size_t n, const T* a, T s, T* out) {
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = a[i] * s;
+            }
+        }
+
+        // largest element of a non-empty array
+        template < typename T >
+        T max(size_t n, const T* a) {
+            T result = a[0];
+            for (size_t i = 1; i < n; ++i) {
+                if(result < a[i]) {
+                    result = a[i];
+                }
+            }
+            return result;
+        }
+
+        template < typename T >
+        double sum(size_t n, const T* a) {
+            double result = 0;
+            for (size_t i = 0; i < n; ++i) {
+                result += double(a[i]);
+            }
+            return result;
+        }
+
+        template < typename T >
+        double sum_squares(size_t n, const T* a) {
+            double result = 0;
+            for (size_t i = 0; i < n; ++i) {
+                result += double(a[i]) * double(a[i]);
+            }
+            return result;
+        }
+
+        // dst (cols x rows, leading dimension ds) = transpose of src (rows x cols, leading dimension ss)
+        template < typename T >
+        void transpose(size_t rows, size_t cols, const T* src, size_t ss, T* dst, size_t ds) {
+            for (size_t i = 0; i < rows; ++i) {
+                for (size_t j = 0; j < cols; ++j) {
+                    dst[j * ds + i] = src[i * ss + j];
+                }
+            }
+        }
+    }
+
+#ifdef MATRIX_SIMD_X86
+
+// The loops shared by every instruction set, over a register type V with
+// `lanes` elements, compiled for TARGET. V also widens its elements into
+// double registers (V::wide) for the sums and transposes tile x tile blocks.
+#define MATRIX_SIMD_KERNELS(TARGET)                                                             \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET))) void add(size_t n, const T* a, const T* b, T* out) {        \
+        size_t i = 0;                                                                           \
+        for (; i + V::lanes <= n; i += V::lanes) {                                              \
+            V::store(out + i, V::add(V::load(a + i), V::load(b + i)));                          \
+        }                                                                                       \
+        scalar::add(n - i, a + i, b + i, out + i);                                              \
+    }                                                                                           \
+                                                                                                \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET))) void sub(size_t n, const T* a, const T* b, T* out) {        \
+        size_t i = 0;                                                                           \
+        for (; i + V::lanes <= n; i += V::lanes) {                                              \
+            V::store(out + i, V::sub(V::load(a + i), V::load(b + i)));                          \
+        }                                                                                       \
+        scalar::sub(n - i, a + i, b + i, out + i);                                              \
+    }                                                                                           \
+                                                                                                \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET))) void scale(size_t n, const T* a, T s, T* out) {             \
+        size_t i = 0;                                                                           \
+        typename V::reg factor = V::set1(s);                                                    \
+        for (; i + V::lanes <= n; i += V::lanes) {                                              \
+            V::store(out + i, V::mul(V::load(a + i), factor));                                  \
+        }                                                                                       \
+        scalar::scale(n - i, a + i, s, out + i);                                                \
+    }                                                                                           \
+                                                                                                \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET))) T max(size_t n, const T* a) {                               \
+        if(n < V::lanes) {                                                                      \
+            return scalar::max(n, a);                                                           \
+        }                                                                                       \
+        typename V::reg m = V::load(a);                                                         \
+        size_t i = V::lanes;                                                                    \
+        for (; i + V::lanes <= n; i += V::lanes) {                                              \
+            m = V::max(m, V::load(a + i));                                                      \
+        }                                                                                       \
+        T result = V::hmax(m);                                                                  \
+        return i < n ? std::max(result, scalar::max(n - i, a + i)) : result;                    \
+    }                                                                                           \
+                                                                                                \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET))) double sum(size_t n, const T* a) {                          \
+        typename V::wide acc = V::wide_zero();                                                  \
+        size_t i = 0;                                                                           \
+        for (; i + V::lanes <= n; i += V::lanes) {                                              \
+            V::accumulate(a + i, acc);                                                          \
+        }                                                                                       \
+        return V::wide_sum(acc) + scalar::sum(n - i, a + i);                                    \
+    }                                                                                           \
+                                                                                                \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET))) double sum_squares(size_t n, const T* a) {                  \
+        typename V::wide acc = V::wide_zero();                                                  \
+        size_t i = 0;                                                                           \
+        for (; i + V::lanes <= n; i += V::lanes) {                                              \
+            V::accumulate_squares(a + i, acc);                                                  \
+        }                                                                                       \
+        return V::wide_sum(acc) + scalar::sum_squares(n - i, a + i);                            \
+    }                                                                                           \
+                                                                                                \
+    template < typename V, typename T >                                                         \
+    __attribute__((target(TARGET)))                                                             \
+    void transpose(size_t rows, size_t cols, const T* src, size_t ss, T* dst, size_t ds) {      \
+        const size_t tile = V::tile;                                                            \
+        const size_t block = 64;                                                                \
+        for (size_t ib = 0; ib < rows; ib += block) {                                           \
+            size_t ie = std::min(rows, ib + block);                                             \
+            for (size_t jb = 0; jb < cols; jb += block) {                                       \
+                size_t je = std::min(cols, jb + block);                                         \
+                size_t i = ib;                                                                  \
+                for (; i + tile <= ie; i += tile) {                                             \
+                    size_t j = jb;                                                              \
+                    for (; j + tile <= je; j += tile) {                                         \
+                        V::transpose_tile(src + i * ss + j, ss, dst + j * ds + i, ds);          \
+                    }                                                                           \
+                    scalar::transpose(tile, je - j, src + i * ss + j, ss, dst + j * ds + i, ds); \
+                }                                                                               \
+                scalar::transpose(ie - i, je - jb, src + i * ss + jb, ss, dst + jb * ds + i, ds); \
+            }                                                                                   \
+        }                                                                                       \
+    }
+
+    namespace sse2 {
+
+        template < typename T >
+        struct vec;
+
+        template <>
+        struct vec<double> {
+            using reg = __m128d;
+            using wide = __m128d;
+            static constexpr size_t lanes = 2;
+            static constexpr size_t tile = 2;
+
+            __attribute__((target("sse2"))) static reg load(const double* p) { return _mm_loadu_pd(p); }
+            __attribute__((target("sse2"))) static void store(double* p, reg v) { _mm_storeu_pd(p, v); }
+            __attribute__((target("sse2"))) static reg set1(double s) { return _mm_set1_pd(s); }
+            __attribute__((target("sse2"))) static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+            __attribute__((target("sse2"))) static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+            __attribute__((target("sse2"))) static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+            __attribute__((target("sse2"))) static reg max(reg a, reg b) { return _mm_max_pd(a, b); }
+
+            __attribute__((target("sse2"))) static double hmax(reg v) {
+                return std::max(_mm_cvtsd_f64(v), _mm_cvtsd_f64(_mm_unpackhi_pd(v, v)));
+            }
+
+            __attribute__((target("sse2"))) static wide wide_zero() { return _mm_setzero_pd(); }
+
+            __attribute__((target("sse2"))) static double wide_sum(wide v) {
+                return _mm_cvtsd_f64(v) + _mm_cvtsd_f64(_mm_unpackhi_pd(v, v));
+            }
+
+            __attribute__((target("sse2"))) static void accumulate(const double* p, wide& acc) {
+                acc = _mm_add_pd(acc, load(p));
+            }
+
+            __attribute__((target("sse2"))) static void accumulate_squares(const double* p, wide& acc) {
+                reg v = load(p);
+                acc = _mm_add_pd(acc, _mm_mul_pd(v, v));
+            }
+
+            __attribute__((target("sse2")))
+            static void transpose_tile(const double* src, size_t ss, double* dst, size_t ds) {
+                reg r0 = load(src);
+                reg r1 = load(src + ss);
+                store(dst, _mm_unpacklo_pd(r0, r1));
+                store(dst + ds, _mm_unpackhi_pd(r0, r1));
+            }
+        };
+
+        template <>
+        struct vec<float> {
+            using reg = __m128;
+            using wide = __m128d;
+            static constexpr size_t lanes = 4;
+            static constexpr size_t tile = 4;
+
+            __attribute__((target("sse2"))) static reg load(const float* p) { return _mm_loadu_ps(p); }
+            __attribute__((target("sse2"))) static void store(float* p, reg v) { _mm_storeu_ps(p, v); }
+            __attribute__((target("sse2"))) static reg set1(float s) { return _mm_set1_ps(s); }
+            __attribute__((target("sse2"))) static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+            __attribute__((target("sse2"))) static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+            __attribute__((target("sse2"))) static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+            __attribute__((target("sse2"))) static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+
+            __attribute__((target("sse2"))) static float hmax(reg v) {
+                v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+                v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+                return _mm_cvtss_f32(v);
+            }
+
+            __attribute__((target("sse2"))) static wide wide_zero() { return _mm_setzero_pd(); }
+
+            __attribute__((target("sse2"))) static double wide_sum(wide v) {
+                return vec<double>::wide_sum(v);
+            }
+
+            __attribute__((target("sse2"))) static void accumulate(const float* p, wide& acc) {
+                reg v = load(p);
+                acc = _mm_add_pd(acc, _mm_add_pd(_mm_cvtps_pd(v), _mm_cvtps_pd(_mm_movehl_ps(v, v))));
+            }
+
+            __attribute__((target("sse2"))) static void accumulate_squares(const float* p, wide& acc) {
+                reg v = load(p);
+                __m128d lo = _mm_cvtps_pd(v);
+                __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v));
+                acc = _mm_add_pd(acc, _mm_add_pd(_mm_mul_pd(lo, lo), _mm_mul_pd(hi, hi)));
+            }
+
+            __attribute__((target("sse2")))
+            static void transpose_tile(const float* src, size_t ss, float* dst, size_t ds) {
+                reg r0 = load(src);
+                reg r1 = load(src + ss);
+                reg r2 = load(src + 2 * ss);
+                reg r3 = load(src + 3 * ss);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                store(dst, r0);
+                store(dst + ds, r1);
+                store(dst + 2 * ds, r2);
+                store(dst + 3 * ds, r3);
+            }
+        };
+
+        MATRIX_SIMD_KERNELS("sse2")
+    }
+
+    namespace avx2 {
+
+        template < typename T >
+        struct vec;
+
+        template <>
+        struct vec<double> {
+            using reg = __m256d;
+            using wide = __m256d;
+            static constexpr size_t lanes = 4;
+            static constexpr size_t tile = 4;
+
+            __attribute__((target("avx2"))) static reg load(const double* p) { return _mm256_loadu_pd(p); }
+            __attribute__((target("avx2"))) static void store(double* p, reg v) { _mm256_storeu_pd(p, v); }
+            __attribute__((target("avx2"))) static reg set1(double s) { return _mm256_set1_pd(s); }
+            __attribute__((target("avx2"))) static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+            __attribute__((target("avx2"))) static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+            __attribute__((target("avx2"))) static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+            __attribute__((target("avx2"))) static reg max(reg a, reg b) { return _mm256_max_pd(a, b); }
+
+            __attribute__((target("avx2"))) static double hmax(reg v) {
+                __m128d m = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+                return std::max(_mm_cvtsd_f64(m), _mm_cvtsd_f64(_mm_unpackhi_pd(m, m)));
+            }
+
+            __attribute__((target("avx2"))) static wide wide_zero() { return _mm256_setzero_pd(); }
+
+            __attribute__((target("avx2"))) static double wide_sum(wide v) {
+                __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+                return _mm_cvtsd_f64(s) + _mm_cvtsd_f64(_mm_unpackhi_pd(s, s));
+            }
+
+            __attribute__((target("avx2"))) static void accumulate(const double* p, wide& acc) {
+                acc = _mm256_add_pd(acc, load(p));
+            }
+
+            __attribute__((target("avx2"))) static void accumulate_squares(const double* p, wide& acc) {
+                reg v = load(p);
+                acc = _mm256_add_pd(acc, _mm256_mul_pd(v, v));
+            }
+
+            __attribute__((target("avx2")))
+            static void transpose_tile(const double* src, size_t ss, double* dst, size_t ds) {
+                reg t0 = _mm256_unpacklo_pd(load(src), load(src + ss));
+                reg t1 = _mm256_unpackhi_pd(load(src), load(src + ss));
+                reg t2 = _mm256_unpacklo_pd(load(src + 2 * ss), load(src + 3 * ss));
+                reg t3 = _mm256_unpackhi_pd(load(src + 2 * ss), load(src + 3 * ss));
+                store(dst, _mm256_permute2f128_pd(t0, t2, 0x20));
+                store(dst + ds, _mm256_permute2f128_pd(t1, t3, 0x20));
+                store(dst + 2 * ds, _mm256_permute2f128_pd(t0, t2, 0x31));
+                store(dst + 3 * ds, _mm256_permute2f128_pd(t1, t3, 0x31));
+            }
+        };
+
+        template <>
+        struct vec<float> {
+            using reg = __m256;
+            using wide = __m256d;
+            static constexpr size_t lanes = 8;
+            static constexpr size_t tile = 8;
+
+            __attribute__((target("avx2"))) static reg load(const float* p) { return _mm256_loadu_ps(p); }
+            __attribute__((target("avx2"))) static void store(float* p, reg v) { _mm256_storeu_ps(p, v); }
+            __attribute__((target("avx2"))) static reg set1(float s) { return _mm256_set1_ps(s); }
+            __attribute__((target("avx2"))) static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+            __attribute__((target("avx2"))) static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+            __attribute__((target("avx2"))) static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+            __attribute__((target("avx2"))) static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+
+            __attribute__((target("avx2"))) static float hmax(reg v) {
+                __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+                m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+                m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+                return _mm_cvtss_f32(m);
+            }
+
+            __attribute__((target("avx2"))) static wide wide_zero() { return _mm256_setzero_pd(); }
+
+            __attribute__((target("avx2"))) static double wide_sum(wide v) {
+                return vec<double>::wide_sum(v);
+            }
+
+            __attribute__((target("avx2"))) static void accumulate(const float* p, wide& acc) {
+                reg v = load(p);
+                __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+                __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+                acc = _mm256_add_pd(acc, _mm256_add_pd(lo, hi));
+            }
+
+            __attribute__((target("avx2"))) static void accumulate_squares(const float* p, wide& acc) {
+                reg v = load(p);
+                __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(v));
+                __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1));
+                acc = _mm256_add_pd(acc, _mm256_add_pd(_mm256_mul_pd(lo, lo), _mm256_mul_pd(hi, hi)));
+            }
+
+            __attribute__((target("avx2")))
+            static void transpose_tile(const float* src, size_t ss, float* dst, size_t ds) {
+                reg t[8];
+                for (size_t i = 0; i < 8; i += 2) {
+                    t[i] = _mm256_unpacklo_ps(load(src + i * ss), load(src + (i + 1) * ss));
+                    t[i + 1] = _mm256_unpackhi_ps(load(src + i * ss), load(src + (i + 1) * ss));
+                }
+                reg u[8];
+                for (size_t i = 0; i < 8; i += 4) {
+                    u[i] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+                    u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+                    u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+                    u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+                }
+                for (size_t i = 0; i < 4; ++i) {
+                    store(dst + i * ds, _mm256_permute2f128_ps(u[i], u[i + 4], 0x20));
+                    store(dst + (i + 4) * ds, _mm256_permute2f128_ps(u[i], u[i + 4], 0x31));
+                }
+            }
+        };
+
+        MATRIX_SIMD_KERNELS("avx2")
+    }
+
+    // AVX-512F has no in-register transpose worth the shuffles over the
+    // AVX2 tiles, so its transposes reuse them. (GCC flags the undefined
+    // pass-through operand of its own AVX-512 intrinsics as uninitialized.)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    namespace avx512 {
+
+        template < typename T >
+        struct vec;
+
+        template <>
+        struct vec<double> {
+            using reg = __m512d;
+            using wide = __m512d;
+            static constexpr size_t lanes = 8;
+            static constexpr size_t tile = avx2::vec<double>::tile;
+
+            __attribute__((target("avx512f"))) static reg load(const double* p) { return _mm512_loadu_pd(p); }
+            __attribute__((target("avx512f"))) static void store(double* p, reg v) { _mm512_storeu_pd(p, v); }
+            __attribute__((target("avx512f"))) static reg set1(double s) { return _mm512_set1_pd(s); }
+            __attribute__((target("avx512f"))) static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+            __attribute__((target("avx512f"))) static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+            __attribute__((target("avx512f"))) static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+            __attribute__((target("avx512f"))) static reg max(reg a, reg b) { return _mm512_max_pd(a, b); }
+            __attribute__((target("avx512f"))) static double hmax(reg v) { return _mm512_reduce_max_pd(v); }
+            __attribute__((target("avx512f"))) static wide wide_zero() { return _mm512_setzero_pd(); }
+            __attribute__((target("avx512f"))) static double wide_sum(wide v) { return _mm512_reduce_add_pd(v); }
+
+            __attribute__((target("avx512f"))) static void accumulate(const double* p, wide& acc) {
+                acc = _mm512_add_pd(acc, load(p));
+            }
+
+            __attribute__((target("avx512f"))) static void accumulate_squares(const double* p, wide& acc) {
+                acc = _mm512_fmadd_pd(load(p), load(p), acc);
+            }
+
+            __attribute__((target("avx512f")))
+            static void transpose_tile(const double* src, size_t ss, double* dst, size_t ds) {
+                avx2::vec<double>::transpose_tile(src, ss, dst, ds);
+            }
+        };
+
+        template <>
+        struct vec<float> {
+            using reg = __m512;
+            using wide = __m512d;
+            static constexpr size_t lanes = 16;
+            static constexpr size_t tile = avx2::vec<float>::tile;
+
+            __attribute__((target("avx512f"))) static reg load(const float* p) { return _mm512_loadu_ps(p); }
+            __attribute__((target("avx512f"))) static void store(float* p, reg v) { _mm512_storeu_ps(p, v); }
+            __attribute__((target("avx512f"))) static reg set1(float s) { return _mm512_set1_ps(s); }
+            __attribute__((target("avx512f"))) static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+            __attribute__((target("avx512f"))) static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+            __attribute__((target("avx512f"))) static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+            __attribute__((target("avx512f"))) static reg max(reg a, reg b) { return _mm512_max_ps(a, b); }
+            __attribute__((target("avx512f"))) static float hmax(reg v) { return _mm512_reduce_max_ps(v); }
+            __attribute__((target("avx512f"))) static wide wide_zero() { return _mm512_setzero_pd(); }
+            __attribute__((target("avx512f"))) static double wide_sum(wide v) { return _mm512_reduce_add_pd(v); }
+
+            __attribute__((target("avx512f"))) static __m512d low(reg v) {
+                return _mm512_cvtps_pd(_mm512_castps512_ps256(v));
+            }
+
+            __attribute__((target("avx512f"))) static __m512d high(reg v) {
+                return _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)));
+            }
+
+            __attribute__((target("avx512f"))) static void accumulate(const float* p, wide& acc) {
+                reg v = load(p);
+                acc = _mm512_add_pd(acc, _mm512_add_pd(low(v), high(v)));
+            }
+
+            __attribute__((target("avx512f"))) static void accumulate_squares(const float* p, wide& acc) {
+                reg v = load(p);
+                acc = _mm512_fmadd_pd(low(v), low(v), acc);
+                acc = _mm512_fmadd_pd(high(v), high(v), acc);
+            }
+
+            __attribute__((target("avx512f")))
+            static void transpose_tile(const float* src, size_t ss, float* dst, size_t ds) {
+                avx2::vec<float>::transpose_tile(src, ss, dst, ds);
+            }
+        };
+
+        MATRIX_SIMD_KERNELS("avx512f")
+    }
+#pragma GCC diagnostic pop
+
+#undef MATRIX_SIMD_KERNELS
+
+// runs the kernel for the active instruction set, or the scalar one
+#define MATRIX_SIMD_DISPATCH(kernel, ...)                                       \
+    switch (active_isa()) {                                                     \
+        case isa::avx512: return avx512::kernel<avx512::vec<T>>(__VA_ARGS__);   \
+        case isa::avx2: return avx2::kernel<avx2::vec<T>>(__VA_ARGS__);         \
+        case isa::sse2: return sse2::kernel<sse2::vec<T>>(__VA_ARGS__);         \
+        default: return scalar::kernel(__VA_ARGS__);                            \
+    }
+
+#else
+
+#define MATRIX_SIMD_DISPATCH(kernel, ...) return scalar::kernel(__VA_ARGS__);
+
+#endif
+
+    // out[i] = a[i] + b[i]
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value>::type add(size_t n, const T* a, const T* b, T* out) {
+        MATRIX_SIMD_DISPATCH(add, n, a, b, out)
+    }
+
+    // out[i] = a[i] - b[i]
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value>::type sub(size_t n, const T* a, const T* b, T* out) {
+        MATRIX_SIMD_DISPATCH(sub, n, a, b, out)
+    }
+
+    // out[i] = a[i] * s
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value>::type scale(size_t n, const T* a, T s, T* out) {
+        MATRIX_SIMD_DISPATCH(scale, n, a, s, out)
+    }
+
+    // largest element of a non-empty array
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value, T>::type max(size_t n, const T* a) {
+        MATRIX_SIMD_DISPATCH(max, n, a)
+    }
+
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value, double>::type sum(size_t n, const T* a) {
+        MATRIX_SIMD_DISPATCH(sum, n, a)
+    }
+
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value, double>::type sum_squares(size_t n, const T* a) {
+        MATRIX_SIMD_DISPATCH(sum_squares, n, a)
+    }
+
+    // dst (cols x rows, leading dimension ds) = transpose of src (rows x cols, leading dimension ss)
+    template < typename T >
+    typename std::enable_if<is_vectorized<T>::value>::type
+    transpose(size_t rows, size_t cols, const T* src, size_t ss, T* dst, size_t ds) {
+        MATRIX_SIMD_DISPATCH(transpose, rows, cols, src, ss, dst, ds)
+    }
+
+#undef MATRIX_SIMD_DISPATCH
+
+    // every other element type runs the scalar loops
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value>::type add(size_t n, const T* a, const T* b, T* out) {
+        scalar::add(n, a, b, out);
+    }
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value>::type sub(size_t n, const T* a, const T* b, T* out) {
+        scalar::sub(n, a, b, out);
+    }
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value>::type scale(size_t n, const T* a, T s, T* out) {
+        scalar::scale(n, a, s, out);
+    }
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value, T>::type max(size_t n, const T* a) {
+        return scalar::max(n, a);
+    }
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value, double>::type sum(size_t n, const T* a) {
+        return scalar::sum(n, a);
+    }
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value, double>::type sum_squares(size_t n, const T* a) {
+        return scalar::sum_squares(n, a);
+    }
+
+    template < typename T >
+    typename std::enable_if<!is_vectorized<T>::value>::type
+    transpose(size_t rows, size_t cols, const T* src, size_t ss, T* dst, size_t ds) {
+        scalar::transpose(rows, cols, src, ss, dst, ds);
+    }
+}
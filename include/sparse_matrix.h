@@ -2,26 +2,80 @@
 
 #include <cstddef>
 #include <map>
+#include <memory>
+#include "full_matrix.h"
 #include "matrix.h"
 
 using coord = std::pair<size_t, size_t>;
 
-template < typename T >
-class sparse_matrix : public matrix<T, sparse_matrix<T>> {
+// Sparse matrix of (row, col)-ordered entries in a map, whose nodes come
+// from Alloc (rebound to the node type).
+template < typename T, typename Alloc = std::allocator<T> >
+class sparse_matrix : public matrix<T, sparse_matrix<T, Alloc>> {
 public:
 
+    using allocator_type = typename std::allocator_traits<Alloc>::template rebind_alloc<std::pair<const coord, T>>;
+    using map_type = std::map< coord, T, std::less<coord>, allocator_type >;
+
+    class nonzero_iterator : public std::iterator<std::input_iterator_tag, matrix_entry<T>> {
+    public:
+        explicit nonzero_iterator(typename map_type::const_iterator it) : _it(it) {}
+
+        matrix_entry<T> operator*() const {
+            return {_it->first.first, _it->first.second, _it->second};
+        }
+
+        nonzero_iterator& operator++() {
+            ++_it;
+            return *this;
+        }
+
+        bool operator==(const nonzero_iterator& other) const {
+            return _it == other._it;
+        }
+
+        bool operator!=(const nonzero_iterator& other) const {
+            return ! operator==(other);
+        }
+
+    private:
+        typename map_type::const_iterator _it;
+    };
+
     sparse_matrix(const sparse_matrix&) noexcept = default;
 
     sparse_matrix(sparse_matrix&&) noexcept = default;
 
+    // assignments keep this matrix's default, see store()
+    sparse_matrix& operator=(const sparse_matrix& other) {
+        return this->assign(other);
+    }
+
+    sparse_matrix& operator=(sparse_matrix&&) = default;
+
     template < typename Other >
-    sparse_matrix(const matrix_expression<T, Other>& other) noexcept :  h(other.height()), w(other.width()), _def()  {
-        this->copy_from(other);
+    sparse_matrix& operator=(const matrix_expression<T, Other>& other) {
+        return this->assign(other);
     }
 
-    sparse_matrix(size_t height, size_t width, const T& def = static_cast<T>(0)) : h(height), w(width), _def(def) {}
+    template < typename Other >
+    sparse_matrix(const matrix_expression<T, Other>& other, const Alloc& alloc = Alloc()) // NOLINT(google-explicit-constructor)
+            : grid(alloc), h(other.height()), w(other.width()), _def()  {
+        fill(other.derived());
+    }
 
-    T get(size_t row, size_t col) const override {
+    // expressions over sparse operands only compute the entries they produce
+    template < typename E, typename std::enable_if<std::is_base_of<matrix_expression<T, E>, E>::value &&
+            sparse_expression<E>::value && !is_sparse<E>::value, int>::type = 0 >
+    sparse_matrix(const E& expr, const Alloc& alloc = Alloc()) : grid(alloc), h(expr.height()), w(expr.width()), _def() {
+        fill(expr, std::true_type());
+    }
+
+    sparse_matrix(size_t height, size_t width, const T& def = static_cast<T>(0), const Alloc& alloc = Alloc())
+            : grid(alloc), h(height), w(width), _def(def) {}
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(sparse_matrix);
         auto it = grid.find(coord(row, col));
         if(it == grid.end()) {
             return _def;
@@ -29,23 +83,58 @@ public:
         return it->second;
     }
 
-    void set(size_t row, size_t col, const T& val) override {
+    // values equal to the default are not stored
+    void set(size_t row, size_t col, const T& val) {
         coord key(row, col);
-        if(val == static_cast<T>(0)) {
+        if(val == _def) {
             grid.erase(key);
         } else {
             grid[key] = val;
         }
     }
 
-    size_t height() const override {
+    // see matrix::assign; the entries are rebuilt against this matrix's
+    // default, so src may read this anywhere
+    template < typename Other >
+    void store(const Other& src) {
+        sparse_matrix result(src.height(), src.width(), _def, Alloc(grid.get_allocator()));
+        result.fill(src, std::integral_constant<bool, sparse_expression<Other>::value>());
+        grid.swap(result.grid);
+        h = result.h;
+        w = result.w;
+    }
+
+    size_t height() const {
         return h;
     }
 
-    size_t width() const override {
+    size_t width() const {
         return w;
     }
 
+    size_t nnz() const {
+        return grid.size();
+    }
+
+    // stored entries, ordered by (row, col)
+    entry_range<nonzero_iterator> nonzeros() const {
+        return {nonzero_iterator(grid.begin()), nonzero_iterator(grid.end())};
+    }
+
+    const map_type& entries() const {
+        return grid;
+    }
+
+    // what missing entries read as; kernels that only visit the stored
+    // entries are exact only when it is zero
+    const T& default_value() const {
+        return _def;
+    }
+
+    allocator_type get_allocator() const {
+        return grid.get_allocator();
+    }
+
     // special generators
 
     static sparse_matrix zero(size_t size) {
@@ -61,9 +150,62 @@ public:
     }
 
 protected:
-    std::map< coord, T > grid;
+    // stores the entries of src that differ from the default into an empty
+    // grid, appending them in (row, col) order
+
+    template < typename Src >
+    void fill(const Src& src, std::false_type) {
+        fill(src);
+    }
+
+    // sparse sources through their CSR form, whose missing entries are zero
+    template < typename Src >
+    void fill(const Src& src, std::true_type) {
+        MATRIX_TIME_MATERIALIZATION("sparse_matrix", Src, src.height(), src.width());
+        const auto& csr = sparse_expression<Src>::evaluate(src);
+        if(_def == static_cast<T>(0)) {
+            for (const matrix_entry<T>& e : csr.nonzeros()) {
+                if(e.value != _def) {
+                    grid.emplace_hint(grid.end(), coord(e.row, e.col), e.value);
+                }
+            }
+            return;
+        }
+        for (size_t i = 0; i < csr.height(); ++i) {
+            size_t k = csr.offsets()[i];
+            for (size_t j = 0; j < csr.width(); ++j) {
+                T val = k < csr.offsets()[i + 1] && csr.indices()[k] == j ? csr.values()[k++] : static_cast<T>(0);
+                if(val != _def) {
+                    grid.emplace_hint(grid.end(), coord(i, j), val);
+                }
+            }
+        }
+    }
+
+    template < typename Src >
+    void fill(const Src& src) {
+        MATRIX_TIME_MATERIALIZATION("sparse_matrix", Src, src.height(), src.width());
+        for (size_t i = 0; i < src.height(); ++i) {
+            for (size_t j = 0; j < src.width(); ++j) {
+                T val = src.get(i, j);
+                if(val != _def) {
+                    grid.emplace_hint(grid.end(), coord(i, j), val);
+                }
+            }
+        }
+    }
+
+    map_type grid;
 
     size_t h;
     size_t w;
-    const T _def;
+    T _def;
 };
+
+template < typename T, typename Alloc >
+struct is_sparse<sparse_matrix<T, Alloc>> : std::true_type {};
+
+// included last: the kernels need the complete class, and everyone using it should get them,
+// along with the compressed formats sparse expressions are evaluated into
+#include "sparse_ops.h"
+#include "compressed_matrix.h"
@@ -0,0 +1,466 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "full_matrix.h"
+#include "parallel.h"
+#include "sparse_matrix.h"
+
+template < typename T, bool RowMajor >
+class compressed_matrix;
+
+// Sparse kernels that only visit stored entries. Each product element still
+// sums its terms in increasing k order, skipping the zero ones.
+namespace sparse {
+
+    // smallest amount of work, in nonzeros or rows, worth handing to a thread
+    constexpr size_t parallel_grain = 4096;
+
+    // Runs f(first_row, last_row) over row ranges holding about the same
+    // number of nonzeros, given CSR-style row offsets.
+    template < typename F >
+    void for_rows(const std::vector<size_t>& offsets, F f) {
+        size_t rows = offsets.size() - 1;
+        size_t nnz = offsets.back();
+        if(nnz == 0) {
+            f(0, rows);
+            return;
+        }
+        auto first_row = offsets.begin();
+        auto last_row = offsets.begin() + rows;
+        parallel::for_range(0, nnz, parallel_grain, [&](size_t lo, size_t hi) {
+            size_t first = std::lower_bound(first_row, last_row, lo) - first_row;
+            size_t last = hi == nnz ? rows : std::lower_bound(first_row, last_row, hi) - first_row;
+            f(first, last);
+        });
+    }
+
+    // c_row += a * b_row over n contiguous elements
+    template < typename T >
+    void axpy(size_t n, T a, const T* b_row, T* c_row) {
+        for (size_t j = 0; j < n; ++j) {
+            c_row[j] += a * b_row[j];
+        }
+    }
+
+    template < typename T >
+    const compressed_matrix<T, true>& as_csr(const compressed_matrix<T, true>& m) {
+        return m;
+    }
+
+    template < typename T, typename M >
+    compressed_matrix<T, true> as_csr(const M& m) {
+        return compressed_matrix<T, true>(m);
+    }
+
+    // Removes the zero values from compressed arrays, shifting the rest down.
+    template < typename T >
+    void drop_zeros(std::vector<size_t>& offsets, std::vector<size_t>& indices, std::vector<T>& values) {
+        size_t out = 0;
+        size_t first = 0;
+        for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+            for (size_t p = first; p < offsets[i + 1]; ++p) {
+                if(values[p] != static_cast<T>(0)) {
+                    indices[out] = indices[p];
+                    values[out++] = values[p];
+                }
+            }
+            first = offsets[i + 1];
+            offsets[i + 1] = out;
+        }
+        indices.resize(out);
+        values.resize(out);
+    }
+
+    // scratch buffers of the product below
+    struct product_marks {};
+    struct product_row {};
+
+    // Marks a row's columns with a number no row before it on this thread
+    // used, so marks left over in a kept buffer never need clearing.
+    inline size_t next_row_stamp() {
+        static thread_local size_t stamp = 0;
+        return ++stamp;
+    }
+
+    // Row-by-row (Gustavson) product of two CSR matrices. A symbolic pass
+    // counts the distinct columns of each output row so the result is
+    // allocated once, then a numeric pass accumulates each row in a dense
+    // scratch row; both split the rows of a across threads. The scratch
+    // rows are kept by each thread and never cleared, so the work follows
+    // the flops rather than the width times the number of chunks.
+    template < typename T >
+    compressed_matrix<T, true> multiply(const compressed_matrix<T, true>& a, const compressed_matrix<T, true>& b) {
+        assert(a.width() == b.height());
+        const size_t h = a.height();
+        const size_t w = b.width();
+        const std::vector<size_t>& a_off = a.offsets();
+        const std::vector<size_t>& a_idx = a.indices();
+        const std::vector<size_t>& b_off = b.offsets();
+        const std::vector<size_t>& b_idx = b.indices();
+
+        std::vector<size_t> offsets(h + 1, 0);
+        for_rows(a_off, [&](size_t first, size_t last) {
+            scratch<std::vector<size_t>, product_marks> marks(w);
+            std::vector<size_t>& seen = marks.buffer();
+            for (size_t i = first; i < last; ++i) {
+                const size_t stamp = next_row_stamp();
+                size_t count = 0;
+                for (size_t ka = a_off[i]; ka < a_off[i + 1]; ++ka) {
+                    size_t k = a_idx[ka];
+                    for (size_t kb = b_off[k]; kb < b_off[k + 1]; ++kb) {
+                        if(seen[b_idx[kb]] != stamp) {
+                            seen[b_idx[kb]] = stamp;
+                            ++count;
+                        }
+                    }
+                }
+                offsets[i + 1] = count;
+            }
+        });
+        for (size_t i = 0; i < h; ++i) {
+            offsets[i + 1] += offsets[i];
+        }
+
+        std::vector<size_t> indices(offsets.back());
+        std::vector<T> values(offsets.back());
+        std::atomic<bool> cancelled(false);
+        for_rows(a_off, [&](size_t first, size_t last) {
+            scratch<std::vector<size_t>, product_marks> marks(w);
+            std::vector<size_t>& seen = marks.buffer();
+            scratch<std::vector<T>, product_row> row(w);
+            std::vector<T>& acc = row.buffer();
+            bool zeros = false;
+            for (size_t i = first; i < last; ++i) {
+                const size_t stamp = next_row_stamp();
+                size_t pos = offsets[i];
+                for (size_t ka = a_off[i]; ka < a_off[i + 1]; ++ka) {
+                    size_t k = a_idx[ka];
+                    T a_ik = a.values()[ka];
+                    for (size_t kb = b_off[k]; kb < b_off[k + 1]; ++kb) {
+                        size_t j = b_idx[kb];
+                        if(seen[j] != stamp) {
+                            seen[j] = stamp;
+                            indices[pos++] = j;
+                            acc[j] = a_ik * b.values()[kb];
+                        } else {
+                            acc[j] += a_ik * b.values()[kb];
+                        }
+                    }
+                }
+                std::sort(indices.begin() + offsets[i], indices.begin() + pos);
+                for (size_t p = offsets[i]; p < pos; ++p) {
+                    values[p] = acc[indices[p]];
+                    zeros = zeros || values[p] == static_cast<T>(0);
+                }
+            }
+            if(zeros) {
+                cancelled.store(true);
+            }
+        });
+
+        if(cancelled) {
+            // entries that summed to zero are not stored
+            drop_zeros(offsets, indices, values);
+        }
+        return compressed_matrix<T, true>(h, w, std::move(offsets), std::move(indices), std::move(values));
+    }
+
+    // Closes the gaps left when row i only filled [offsets[i], ends[i]) of
+    // its slot, leaving offsets as the compressed row offsets.
+    template < typename T >
+    void compact(std::vector<size_t>& offsets, const std::vector<size_t>& ends,
+                 std::vector<size_t>& indices, std::vector<T>& values) {
+        size_t out = 0;
+        for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+            size_t first = offsets[i];
+            offsets[i] = out;
+            for (size_t p = first; p < ends[i]; ++p) {
+                indices[out] = indices[p];
+                values[out++] = values[p];
+            }
+        }
+        offsets.back() = out;
+        indices.resize(out);
+        values.resize(out);
+    }
+
+    // Element-wise op(a, b) of two CSR matrices of the same shape, walking
+    // the sorted columns of each row pair once. Entries stored in only one
+    // operand are combined with a zero, and zero results are not stored.
+    template < typename T, typename Op >
+    compressed_matrix<T, true> merge(const compressed_matrix<T, true>& a, const compressed_matrix<T, true>& b, Op op) {
+        assert(a.height() == b.height() && a.width() == b.width());
+        const size_t h = a.height();
+        const size_t none = size_t(-1);
+        const std::vector<size_t>& a_off = a.offsets();
+        const std::vector<size_t>& a_idx = a.indices();
+        const std::vector<size_t>& b_off = b.offsets();
+        const std::vector<size_t>& b_idx = b.indices();
+
+        // each output row gets room for both operand rows
+        std::vector<size_t> offsets(h + 1);
+        for (size_t i = 0; i <= h; ++i) {
+            offsets[i] = a_off[i] + b_off[i];
+        }
+        std::vector<size_t> ends(h);
+        std::vector<size_t> indices(offsets.back());
+        std::vector<T> values(offsets.back());
+        for_rows(offsets, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                size_t ka = a_off[i];
+                size_t kb = b_off[i];
+                size_t pos = offsets[i];
+                while (ka < a_off[i + 1] || kb < b_off[i + 1]) {
+                    size_t col_a = ka < a_off[i + 1] ? a_idx[ka] : none;
+                    size_t col_b = kb < b_off[i + 1] ? b_idx[kb] : none;
+                    size_t col = std::min(col_a, col_b);
+                    T val = op(col_a == col ? a.values()[ka++] : T{0}, col_b == col ? b.values()[kb++] : T{0});
+                    if(val != static_cast<T>(0)) {
+                        indices[pos] = col;
+                        values[pos++] = val;
+                    }
+                }
+                ends[i] = pos;
+            }
+        });
+        compact(offsets, ends, indices, values);
+        return compressed_matrix<T, true>(h, a.width(), std::move(offsets), std::move(indices), std::move(values));
+    }
+
+    // a * s, keeping the structure of a minus any entries that become zero
+    template < typename T, typename S >
+    compressed_matrix<T, true> scale(const compressed_matrix<T, true>& a, const S& s) {
+        std::vector<size_t> offsets = a.offsets();
+        std::vector<size_t> indices = a.indices();
+        std::vector<T> values(a.nnz());
+        std::atomic<bool> cancelled(false);
+        parallel::for_range(0, a.nnz(), parallel_grain, [&](size_t first, size_t last) {
+            bool zeros = false;
+            for (size_t k = first; k < last; ++k) {
+                values[k] = a.values()[k] * s;
+                zeros = zeros || values[k] == static_cast<T>(0);
+            }
+            if(zeros) {
+                cancelled.store(true);
+            }
+        });
+        if(cancelled) {
+            drop_zeros(offsets, indices, values);
+        }
+        return compressed_matrix<T, true>(a.height(), a.width(), std::move(offsets), std::move(indices), std::move(values));
+    }
+
+    // the CSR arrays of a are the CSC arrays of its transpose
+    template < typename T >
+    compressed_matrix<T, true> transpose(const compressed_matrix<T, true>& a) {
+        return compressed_matrix<T, true>(
+                compressed_matrix<T, false>(a.width(), a.height(), a.offsets(), a.indices(), a.values()));
+    }
+
+    template < typename T >
+    compressed_matrix<T, true> transpose(const compressed_matrix<T, false>& a) {
+        return compressed_matrix<T, true>(a.width(), a.height(), a.offsets(), a.indices(), a.values());
+    }
+}
+
+// Sparse storage evaluates to itself, converted to CSR when stored otherwise.
+// The conversion stores the missing entries of a sparse_matrix whose default
+// is not zero, so the nodes below never need to know about defaults.
+template < typename E >
+struct sparse_expression<E, typename std::enable_if<is_sparse<E>::value>::type> : std::true_type {
+    using value_type = typename E::value_type;
+
+    static auto evaluate(const E& e) -> decltype(sparse::as_csr<value_type>(e)) {
+        return sparse::as_csr<value_type>(e);
+    }
+};
+
+template < typename T, typename M1, typename M2 >
+struct sparse_expression<matrix_sum<T, M1, M2>, typename std::enable_if<
+        sparse_expression<M1>::value && sparse_expression<M2>::value>::type> : std::true_type {
+
+    static compressed_matrix<T, true> evaluate(const matrix_sum<T, M1, M2>& e) {
+        return sparse::merge(sparse_expression<M1>::evaluate(e.lhs()), sparse_expression<M2>::evaluate(e.rhs()),
+                             [](const T& a, const T& b) { return a + b; });
+    }
+};
+
+template < typename T, typename M1, typename M2 >
+struct sparse_expression<matrix_difference<T, M1, M2>, typename std::enable_if<
+        sparse_expression<M1>::value && sparse_expression<M2>::value>::type> : std::true_type {
+
+    static compressed_matrix<T, true> evaluate(const matrix_difference<T, M1, M2>& e) {
+        return sparse::merge(sparse_expression<M1>::evaluate(e.lhs()), sparse_expression<M2>::evaluate(e.rhs()),
+                             [](const T& a, const T& b) { return a - b; });
+    }
+};
+
+template < typename T, typename M, typename S >
+struct sparse_expression<matrix_scalar_product<T, M, S>, typename std::enable_if<
+        sparse_expression<M>::value>::type> : std::true_type {
+
+    static compressed_matrix<T, true> evaluate(const matrix_scalar_product<T, M, S>& e) {
+        return sparse::scale(sparse_expression<M>::evaluate(e.lhs()), e.rhs());
+    }
+};
+
+template < typename T, typename M >
+struct sparse_expression<matrix_transpose<T, M>, typename std::enable_if<
+        sparse_expression<M>::value>::type> : std::true_type {
+
+    static compressed_matrix<T, true> evaluate(const matrix_transpose<T, M>& e) {
+        return transpose_of(e.operand());
+    }
+
+private:
+    template < typename Other >
+    static compressed_matrix<T, true> transpose_of(const Other& m) {
+        return sparse::transpose(sparse_expression<Other>::evaluate(m));
+    }
+
+    // a CSC operand needs no conversion at all
+    static compressed_matrix<T, true> transpose_of(const compressed_matrix<T, false>& m) {
+        return sparse::transpose(m);
+    }
+};
+
+template < typename T, typename M1, typename M2 >
+struct sparse_expression<matrix_dot_product<T, M1, M2>, typename std::enable_if<
+        sparse_expression<M1>::value && sparse_expression<M2>::value>::type> : std::true_type {
+
+    static compressed_matrix<T, true> evaluate(const matrix_dot_product<T, M1, M2>& e) {
+        return sparse::multiply(sparse_expression<M1>::evaluate(e.lhs().expression()),
+                                sparse_expression<M2>::evaluate(e.rhs().expression()));
+    }
+};
+
+template < typename T >
+struct product_kernel<compressed_matrix<T, true>> {
+    static constexpr bool has_matrix_product = true;
+
+    template < typename S >
+    static void multiply(const compressed_matrix<T, true>& a, const vector<S>& x, vector<T>& y) {
+        const size_t* offsets = a.offsets().data();
+        const size_t* indices = a.indices().data();
+        const T* values = a.values().data();
+        sparse::for_rows(a.offsets(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                T val {0};
+                for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+                    val += values[k] * x[indices[k]];
+                }
+                y[i] = val;
+            }
+        });
+    }
+
+    template < typename A1, typename A2 >
+    static void multiply(const compressed_matrix<T, true>& a, const full_matrix<T, A1>& b, full_matrix<T, A2>& c) {
+        const size_t* offsets = a.offsets().data();
+        const size_t* indices = a.indices().data();
+        const T* values = a.values().data();
+        const size_t n = b.width();
+        sparse::for_rows(a.offsets(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                T* c_row = c.data() + i * c.stride();
+                for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+                    sparse::axpy(n, values[k], b.data() + indices[k] * b.stride(), c_row);
+                }
+            }
+        });
+    }
+};
+
+// column-major storage scatters into every output row, so it runs serially
+template < typename T >
+struct product_kernel<compressed_matrix<T, false>> {
+    static constexpr bool has_matrix_product = true;
+
+    template < typename S >
+    static void multiply(const compressed_matrix<T, false>& a, const vector<S>& x, vector<T>& y) {
+        std::fill(y.begin(), y.end(), T{0});
+        for (size_t col = 0; col < a.width(); ++col) {
+            for (size_t k = a.offsets()[col]; k < a.offsets()[col + 1]; ++k) {
+                y[a.indices()[k]] += a.values()[k] * x[col];
+            }
+        }
+    }
+
+    template < typename A1, typename A2 >
+    static void multiply(const compressed_matrix<T, false>& a, const full_matrix<T, A1>& b, full_matrix<T, A2>& c) {
+        const size_t n = b.width();
+        for (size_t col = 0; col < a.width(); ++col) {
+            const T* b_row = b.data() + col * b.stride();
+            for (size_t k = a.offsets()[col]; k < a.offsets()[col + 1]; ++k) {
+                sparse::axpy(n, a.values()[k], b_row, c.data() + a.indices()[k] * c.stride());
+            }
+        }
+    }
+};
+
+template < typename T, typename Alloc >
+struct product_kernel<sparse_matrix<T, Alloc>> {
+    static constexpr bool has_matrix_product = true;
+
+    // visiting only the stored entries needs missing ones to read as zero;
+    // otherwise every element is read
+
+    template < typename S >
+    static void multiply(const sparse_matrix<T, Alloc>& a, const vector<S>& x, vector<T>& y) {
+        if(a.default_value() != T{0}) {
+            parallel::for_range(0, a.height(), parallel::grain_for(a.width()), [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    T val {0};
+                    for (size_t k = 0; k < x.size(); ++k) {
+                        val += a.get(i, k) * x[k];
+                    }
+                    y[i] = val;
+                }
+            });
+            return;
+        }
+        for_rows(a, [&](size_t first, size_t last) {
+            std::fill(y.begin() + first, y.begin() + last, T{0});
+            auto end = a.entries().lower_bound(coord(last, 0));
+            for (auto it = a.entries().lower_bound(coord(first, 0)); it != end; ++it) {
+                y[it->first.first] += it->second * x[it->first.second];
+            }
+        });
+    }
+
+    template < typename A1, typename A2 >
+    static void multiply(const sparse_matrix<T, Alloc>& a, const full_matrix<T, A1>& b, full_matrix<T, A2>& c) {
+        const size_t n = b.width();
+        if(a.default_value() != T{0}) {
+            parallel::for_range(0, a.height(), parallel::grain_for(a.width() * n), [&](size_t first, size_t last) {
+                for (size_t i = first; i < last; ++i) {
+                    for (size_t k = 0; k < a.width(); ++k) {
+                        sparse::axpy(n, a.get(i, k), b.data() + k * b.stride(), c.data() + i * c.stride());
+                    }
+                }
+            });
+            return;
+        }
+        for_rows(a, [&](size_t first, size_t last) {
+            auto end = a.entries().lower_bound(coord(last, 0));
+            for (auto it = a.entries().lower_bound(coord(first, 0)); it != end; ++it) {
+                sparse::axpy(n, it->second, b.data() + it->first.second * b.stride(),
+                             c.data() + it->first.first * c.stride());
+            }
+        });
+    }
+
+private:
+    // the map has no row index, so split rows evenly and seek each range's start
+    template < typename F >
+    static void for_rows(const sparse_matrix<T, Alloc>& a, F f) {
+        size_t grain = a.entries().empty() ? a.height() :
+                       std::max<size_t>(1, sparse::parallel_grain * a.height() / a.entries().size());
+        parallel::for_range(0, a.height(), grain, f);
+    }
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include "dense_storage.h"
+#include "matrix.h"
+#include "parallel.h"
+
+// Square symmetric matrix keeping only its lower triangle, packed by rows:
+// element (i, j) with j <= i is at data()[i * (i + 1) / 2 + j], n (n + 1) / 2
+// elements in all instead of n². Element (i, j) and (j, i) are the same
+// storage, so set() writes both; assigning an expression reads only its
+// lower triangle, which is all a symmetric result needs.
+template < typename T, typename Alloc = aligned_allocator<T> >
+class symmetric_matrix : public matrix<T, symmetric_matrix<T, Alloc>> {
+public:
+    using allocator_type = Alloc;
+
+    explicit symmetric_matrix(size_t n, T def = {}, const Alloc& alloc = Alloc())
+            : _n(n), _data(packed_size(n), def, alloc) {}
+
+    // throws std::runtime_error if other is not square
+    template < typename Other >
+    explicit symmetric_matrix(const matrix_expression<T, Other>& other, const Alloc& alloc = Alloc())
+            : _n(0), _data(alloc) {
+        store(other.derived());
+    }
+
+    symmetric_matrix(const symmetric_matrix&) = default;
+
+    symmetric_matrix(symmetric_matrix&&) noexcept = default;
+
+    symmetric_matrix& operator=(const symmetric_matrix& other) {
+        return this->assign(other);
+    }
+
+    symmetric_matrix& operator=(symmetric_matrix&&) noexcept = default;
+
+    template < typename Other >
+    symmetric_matrix& operator=(const matrix_expression<T, Other>& other) {
+        return this->assign(other);
+    }
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(symmetric_matrix);
+        return row >= col ? _data[offset(row) + col] : _data[offset(col) + row];
+    }
+
+    void set(size_t row, size_t col, const T& val) {
+        if(row >= col) {
+            _data[offset(row) + col] = val;
+        } else {
+            _data[offset(col) + row] = val;
+        }
+    }
+
+    // see matrix::assign; reads the lower triangle of src
+    template < typename Other >
+    void store(const Other& src) {
+        if(src.height() != src.width()) {
+            throw std::runtime_error("symmetric_matrix from a non-square matrix");
+        }
+        if(src.height() != _n) {
+            _n = src.height();
+            _data.assign(packed_size(_n), T{});
+        }
+        MATRIX_TIME_MATERIALIZATION("symmetric_matrix assign", Other, _n, _n);
+        // rows get longer downwards, so chunks are weighed by half a row
+        parallel::for_range(0, _n, parallel::grain_for(_n * src.element_cost() / 2), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                T* out = _data.data() + offset(i);
+                for (size_t j = 0; j <= i; ++j) {
+                    out[j] = src.get(i, j);
+                }
+            }
+        });
+    }
+
+    size_t height() const {
+        return _n;
+    }
+
+    size_t width() const {
+        return _n;
+    }
+
+    // the packed lower triangle, row i starting at data()[i * (i + 1) / 2]
+
+    T* data() noexcept {
+        return _data.data();
+    }
+
+    const T* data() const noexcept {
+        return _data.data();
+    }
+
+    static size_t packed_size(size_t n) {
+        return n * (n + 1) / 2;
+    }
+
+private:
+    size_t _n;
+    std::vector<T, Alloc> _data;
+
+    static size_t offset(size_t row) {
+        return row * (row + 1) / 2;
+    }
+};
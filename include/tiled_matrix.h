@@ -0,0 +1,926 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "full_matrix.h"
+#include "gemm.h"
+#include "matrix.h"
+#include "matrix_file.h"
+#include "parallel.h"
+
+template < typename T >
+class tiled_matrix;
+
+namespace tiled {
+
+    namespace detail {
+
+        inline void read_at(int fd, void* dst, size_t bytes, uint64_t offset) {
+            char* p = static_cast<char*>(dst);
+            while (bytes > 0) {
+                ssize_t n = ::pread(fd, p, bytes, static_cast<off_t>(offset));
+                if(n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(n <= 0) {
+                    throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "tile read");
+                }
+                p += n;
+                bytes -= static_cast<size_t>(n);
+                offset += static_cast<uint64_t>(n);
+            }
+        }
+
+        inline void write_at(int fd, const void* src, size_t bytes, uint64_t offset) {
+            const char* p = static_cast<const char*>(src);
+            while (bytes > 0) {
+                ssize_t n = ::pwrite(fd, p, bytes, static_cast<off_t>(offset));
+                if(n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if(n <= 0) {
+                    throw std::system_error(n < 0 ? errno : EIO, std::generic_category(), "tile write");
+                }
+                p += n;
+                bytes -= static_cast<size_t>(n);
+                offset += static_cast<uint64_t>(n);
+            }
+        }
+
+        // tells the slots of a cache apart from those of any earlier one
+        inline uint64_t next_generation() {
+            static std::atomic<uint64_t> generation {0};
+            return ++generation;
+        }
+    }
+
+    struct cache_statistics {
+        uint64_t reads = 0;         // tiles read from the file, prefetched ones included
+        uint64_t prefetched = 0;    // of those, read ahead of use by the I/O thread
+        uint64_t writes = 0;        // dirty tiles written back
+        size_t peak_tiles = 0;      // most tiles held at once
+    };
+
+    // Tiles of one file kept in memory, least recently used first out. At
+    // most `capacity` tiles are held unless more than that are in use at
+    // once: tiles stay pinned while any handle to them is alive and are only
+    // evicted once released. Dirty tiles are written back when evicted or
+    // flushed. A background thread reads tiles ahead of use (prefetch) and
+    // writes finished ones behind, so the file is read and written while the
+    // calling threads compute. Owns the file descriptor.
+    template < typename T >
+    class tile_cache {
+    public:
+        struct tile {
+            tile(size_t index, size_t elements) : index(index), data(elements) {}
+
+            const size_t index;
+            gemm::buffer<T> data;
+            std::atomic<bool> dirty {false};
+            bool ready = false;     // data loaded, guarded by the cache mutex
+            bool failed = false;    // a prefetch could not read it
+
+            // Writes through a handle taken without the cache mutex (see
+            // tiled_matrix::set) are announced here. Eviction claims the tile
+            // first and backs off while one is under way, so either the write
+            // sees the claim and goes to a fresh copy or eviction sees the write.
+            std::atomic<size_t> writers {0};
+            std::atomic<bool> evicted {false};
+
+            bool begin_write() {
+                ++writers;
+                if(evicted) {
+                    --writers;
+                    return false;
+                }
+                return true;
+            }
+
+            void end_write() {
+                --writers;
+            }
+        };
+
+        using handle = std::shared_ptr<tile>;
+
+        tile_cache(int fd, uint64_t offset, size_t elements, size_t capacity, bool write_on_close)
+                : _fd(fd), _offset(offset), _elements(elements), _capacity(std::max<size_t>(capacity, 2)),
+                  _write_on_close(write_on_close), _generation(detail::next_generation()) {
+            _io = std::thread(&tile_cache::serve, this);
+        }
+
+        tile_cache(const tile_cache&) = delete;
+
+        tile_cache& operator=(const tile_cache&) = delete;
+
+        ~tile_cache() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            _io.join();
+            if(_write_on_close) {
+                try {
+                    flush();
+                } catch (...) {
+                    // nothing to report errors to; call flush() first to see them
+                }
+            }
+            ::close(_fd);
+        }
+
+        // the tile, read from the file unless `discard`, in which case its
+        // contents are about to be overwritten and it is not read if absent
+        handle acquire(size_t index, bool discard = false) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            bool evicted = false;
+            while (true) {
+                // an evicted copy still being written back is read once on file
+                _loaded.wait(lock, [&] { return _writing.count(index) == 0; });
+                auto found = _tiles.find(index);
+                if(found == _tiles.end()) {
+                    if(evicted) {
+                        break;
+                    }
+                    evict(lock, false);
+                    evicted = true;
+                    continue;
+                }
+                handle t = found->second.tile;
+                touch(found->second);
+                _loaded.wait(lock, [&] { return t->ready; });
+                if(!t->failed) {
+                    return t;
+                }
+            }
+            handle t = insert(index);
+            if(discard) {
+                t->ready = true;
+                return t;
+            }
+            lock.unlock();
+            try {
+                load(*t);
+            } catch (...) {
+                lock.lock();
+                fail(t);
+                throw;
+            }
+            lock.lock();
+            ++_stats.reads;
+            t->ready = true;
+            _loaded.notify_all();
+            return t;
+        }
+
+        // asks the I/O thread to read the tile in, unless it is held already
+        void prefetch(size_t index) {
+            request(index, false);
+        }
+
+        // asks the I/O thread to write the tile back if it is dirty
+        void write_behind(size_t index) {
+            request(index, true);
+        }
+
+        // Writes back every dirty tile, once the I/O thread has finished
+        // what it is writing; pending write requests are served here. Throws
+        // the first error of a write back, the I/O thread's included. No tile
+        // may be written meanwhile.
+        void flush() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _requests.erase(std::remove_if(_requests.begin(), _requests.end(), [](const io_request& r) {
+                return r.write;
+            }), _requests.end());
+            _loaded.wait(lock, [&] { return _busy == 0 && _writing.empty(); });
+            for (auto& entry : _tiles) {
+                if(entry.second.tile->ready) {
+                    write_back(*entry.second.tile);
+                }
+            }
+            if(_write_error) {
+                std::exception_ptr error = _write_error;
+                _write_error = nullptr;
+                std::rethrow_exception(error);
+            }
+        }
+
+        // Forgets every tile without writing any back, for a file whose
+        // contents were replaced. Handles still held elsewhere keep their
+        // memory but are no longer the cache's.
+        void reset() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _requests.clear();
+            _loaded.wait(lock, [&] { return _busy == 0 && _writing.empty(); });
+            _tiles.clear();
+            _order.clear();
+            _write_error = nullptr;
+            _generation = detail::next_generation();
+        }
+
+        uint64_t generation() const {
+            return _generation;
+        }
+
+        int fd() const {
+            return _fd;
+        }
+
+        size_t capacity() const {
+            return _capacity;
+        }
+
+        cache_statistics statistics() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _stats;
+        }
+
+    private:
+        struct entry {
+            handle tile;
+            std::list<size_t>::iterator position;
+        };
+
+        struct io_request {
+            size_t index;
+            bool write;
+        };
+
+        const int _fd;
+        const uint64_t _offset;
+        const size_t _elements;
+        const size_t _capacity;
+        const bool _write_on_close;
+        std::atomic<uint64_t> _generation;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _loaded;
+        std::condition_variable _wake;
+        std::unordered_map<size_t, entry> _tiles;
+        std::list<size_t> _order;               // most recently used first
+        std::deque<io_request> _requests;
+        size_t _busy = 0;                       // requests the I/O thread is serving
+        std::unordered_set<size_t> _writing;    // evicted tiles being written back
+        std::exception_ptr _write_error;        // of a write back by the I/O thread, for flush()
+        bool _stopping = false;
+        cache_statistics _stats;
+        std::thread _io;
+
+        uint64_t offset_of(size_t index) const {
+            return _offset + static_cast<uint64_t>(index) * _elements * sizeof(T);
+        }
+
+        void load(tile& t) const {
+            detail::read_at(_fd, t.data.data(), _elements * sizeof(T), offset_of(t.index));
+        }
+
+        // with the mutex held
+        void write_back(tile& t) {
+            if(t.dirty.exchange(false)) {
+                try {
+                    detail::write_at(_fd, t.data.data(), _elements * sizeof(T), offset_of(t.index));
+                } catch (...) {
+                    t.dirty = true;
+                    throw;
+                }
+                ++_stats.writes;
+            }
+        }
+
+        // marks t evicted unless a write to it is under way
+        static bool claim(tile& t) {
+            t.evicted = true;
+            if(t.writers != 0) {
+                t.evicted = false;
+                return false;
+            }
+            return true;
+        }
+
+        // with the mutex held
+        void keep_error(std::exception_ptr error) {
+            if(!_write_error) {
+                _write_error = error;
+            }
+        }
+
+        void touch(entry& e) {
+            _order.splice(_order.begin(), _order, e.position);
+        }
+
+        handle insert(size_t index) {
+            handle t = std::make_shared<tile>(index, _elements);
+            _order.push_front(index);
+            _tiles.emplace(index, entry {t, _order.begin()});
+            _stats.peak_tiles = std::max(_stats.peak_tiles, _tiles.size());
+            return t;
+        }
+
+        void fail(const handle& t) {
+            _tiles.erase(t->index);
+            _order.remove(t->index);
+            t->failed = true;
+            t->ready = true;
+            _loaded.notify_all();
+        }
+
+        // Makes room for one more tile by evicting released ones, oldest
+        // first. A dirty one is written back with the mutex released, so
+        // computing threads are not held up meanwhile; it is out of the cache
+        // by then and listed in _writing until its data is on file, and the
+        // caller has to look its own tile up again. With `strict` it gives up
+        // (returning false) rather than go over capacity; otherwise the cache
+        // grows past it while every tile is pinned.
+        bool evict(std::unique_lock<std::mutex>& lock, bool strict) {
+            while (_tiles.size() >= _capacity) {
+                handle t = victim();
+                if(!t) {
+                    return !strict;
+                }
+                if(!t->dirty.exchange(false)) {
+                    continue;
+                }
+                _writing.insert(t->index);
+                lock.unlock();
+                std::exception_ptr error;
+                try {
+                    detail::write_at(_fd, t->data.data(), _elements * sizeof(T), offset_of(t->index));
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                lock.lock();
+                _writing.erase(t->index);
+                if(error) {
+                    // back in as the oldest tile, dirty still
+                    t->dirty = true;
+                    t->evicted = false;
+                    _order.push_back(t->index);
+                    _tiles.emplace(t->index, entry {t, std::prev(_order.end())});
+                }
+                _loaded.notify_all();
+                if(error) {
+                    std::rethrow_exception(error);
+                }
+                ++_stats.writes;
+            }
+            return true;
+        }
+
+        // the oldest released tile, claimed and taken out of the cache, or
+        // none if every tile is pinned
+        handle victim() {
+            for (auto position = _order.end(); position != _order.begin();) {
+                --position;
+                auto found = _tiles.find(*position);
+                handle& t = found->second.tile;
+                // handles are only copied with the mutex held, but may be
+                // taken from weak ones without it, so writes are ruled out too
+                if(t->ready && t.use_count() == 1 && claim(*t)) {
+                    handle result = std::move(t);
+                    _order.erase(position);
+                    _tiles.erase(found);
+                    return result;
+                }
+            }
+            return nullptr;
+        }
+
+        void request(size_t index, bool write) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(!write && _tiles.count(index) != 0) {
+                    return;
+                }
+                _requests.push_back(io_request {index, write});
+            }
+            _wake.notify_one();
+        }
+
+        // the I/O thread
+        void serve() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true) {
+                _wake.wait(lock, [&] { return _stopping || !_requests.empty(); });
+                if(_stopping) {
+                    return;
+                }
+                io_request r = _requests.front();
+                _requests.pop_front();
+                auto found = _tiles.find(r.index);
+                if(r.write) {
+                    if(found == _tiles.end() || !found->second.tile->ready || !found->second.tile->dirty) {
+                        continue;
+                    }
+                    // pinned while written, so it is not evicted meanwhile
+                    handle t = found->second.tile;
+                    t->dirty = false;
+                    ++_busy;
+                    lock.unlock();
+                    std::exception_ptr error;
+                    try {
+                        detail::write_at(_fd, t->data.data(), _elements * sizeof(T), offset_of(t->index));
+                    } catch (...) {
+                        error = std::current_exception();
+                    }
+                    lock.lock();
+                    --_busy;
+                    if(!error) {
+                        ++_stats.writes;
+                    } else {
+                        t->dirty = true;    // written back again on eviction or flush
+                        keep_error(error);
+                    }
+                    _loaded.notify_all();
+                    continue;
+                }
+                bool room = false;
+                try {
+                    room = found == _tiles.end() && _writing.count(r.index) == 0 && evict(lock, true);
+                } catch (...) {
+                    // the tile stays dirty, and flush() reports the error
+                    keep_error(std::current_exception());
+                }
+                // the lock may have been released to write a victim back
+                if(!room || _stopping || _tiles.count(r.index) != 0 || _writing.count(r.index) != 0
+                   || _tiles.size() >= _capacity) {
+                    continue;
+                }
+                handle t = insert(r.index);
+                ++_busy;
+                lock.unlock();
+                bool read = true;
+                try {
+                    load(*t);
+                } catch (...) {
+                    read = false;
+                }
+                lock.lock();
+                --_busy;
+                if(read) {
+                    ++_stats.reads;
+                    ++_stats.prefetched;
+                    t->ready = true;
+                    _loaded.notify_all();
+                } else {
+                    fail(t);    // acquire() reads it again and reports the error
+                }
+            }
+        }
+    };
+
+    // A block of a product operand for the out-of-core product: the tile it
+    // lies in, pinned while the block is in use, or a window onto anything
+    // that is not tiled.
+    template < typename Src >
+    struct block {
+        std::shared_ptr<const void> pin;
+        Src source;
+    };
+
+    template < typename T, typename Src >
+    struct offset_source {
+        Src src;
+        size_t row;
+        size_t col;
+
+        T operator()(size_t r, size_t c) const {
+            return src(row + r, col + c);
+        }
+    };
+
+    template < typename T, typename M >
+    auto block_at(const matrix_expression<T, M>& m, size_t row, size_t col)
+            -> block<offset_source<T, decltype(gemm_source(m.derived()))>> {
+        using source = offset_source<T, decltype(gemm_source(m.derived()))>;
+        return {nullptr, source {gemm_source(m.derived()), row, col}};
+    }
+
+    template < typename T >
+    block<gemm::strided_source<T>> block_at(const tiled_matrix<T>& m, size_t row, size_t col) {
+        auto t = m.tile_at(row, col);
+        return {t, gemm::strided_source<T> {t->data.data(), m.tile_size(), 1}};
+    }
+
+    template < typename T >
+    block<gemm::strided_source<T>> block_at(const matrix_transpose<T, tiled_matrix<T>>& m, size_t row, size_t col) {
+        auto t = m.operand().tile_at(col, row);
+        return {t, gemm::strided_source<T> {t->data.data(), 1, m.operand().tile_size()}};
+    }
+
+    // side of the tiles the blocks of an operand must line up with, 0 for any
+
+    template < typename T, typename M >
+    size_t tile_side(const matrix_expression<T, M>&) {
+        return 0;
+    }
+
+    template < typename T >
+    size_t tile_side(const tiled_matrix<T>& m) {
+        return m.tile_size();
+    }
+
+    template < typename T >
+    size_t tile_side(const matrix_transpose<T, tiled_matrix<T>>& m) {
+        return m.operand().tile_size();
+    }
+
+    // prefetch(expression, row, col): the tiled matrices an expression reads
+    // start reading in the tiles its element (row, col) comes from
+
+    template < typename T, typename M >
+    void prefetch(const matrix_expression<T, M>&, size_t, size_t) {}
+
+    template < typename T >
+    void prefetch(const tiled_matrix<T>& m, size_t row, size_t col) {
+        m.prefetch(row, col);
+    }
+
+    template < typename T >
+    void prefetch(const matrix_transpose<T, tiled_matrix<T>>& e, size_t row, size_t col) {
+        e.operand().prefetch(col, row);
+    }
+
+    template < typename T, typename M1, typename M2 >
+    void prefetch(const matrix_sum<T, M1, M2>& e, size_t row, size_t col) {
+        prefetch(e.lhs(), row, col);
+        prefetch(e.rhs(), row, col);
+    }
+
+    template < typename T, typename M1, typename M2 >
+    void prefetch(const matrix_difference<T, M1, M2>& e, size_t row, size_t col) {
+        prefetch(e.lhs(), row, col);
+        prefetch(e.rhs(), row, col);
+    }
+
+    template < typename T, typename M, typename S >
+    void prefetch(const matrix_scalar_product<T, M, S>& e, size_t row, size_t col) {
+        prefetch(e.lhs(), row, col);
+    }
+}
+
+// Dense matrix kept in a file of fixed-size square tiles, for matrices and
+// products larger than memory. Only the tiles in the cache are in memory,
+// which holds at most cache_bytes worth of them (two at the least) beyond
+// the ones in use, so memory stays bounded whatever the size of the matrix.
+//
+// Assignments evaluate a tile at a time, reading ahead the tiles of the
+// tiled operands the next one needs. Products of tiled operands (and their
+// transposes) with matching tiles are computed tile by tile with the blocked
+// kernel: while one pair of tiles is multiplied, the next pair is read and
+// finished result tiles are written, so I/O overlaps compute. Other product
+// operands are read in place; expressions that would be worth materializing
+// as product operands are evaluated in memory, so keep large operands stored.
+// Element access through get/set works from any thread, each keeping a few
+// tiles at hand; it is far slower than whole-tile evaluation.
+//
+// The file starts with a binary::header of layout tiled, whose stride is the
+// tile side; edge tiles are stored padded to full size. Matrices made
+// without a path live in an unlinked temporary file in $TMPDIR. POSIX only.
+template < typename T >
+class tiled_matrix : public matrix<T, tiled_matrix<T>> {
+public:
+    using cache = tiled::tile_cache<T>;
+
+    static constexpr size_t default_tile = 512;
+    static constexpr size_t default_cache_bytes = size_t(256) << 20;
+
+    // zero matrix in a temporary file
+    tiled_matrix(size_t h, size_t w, size_t tile = default_tile, size_t cache_bytes = default_cache_bytes)
+            : tiled_matrix(temporary_file(), h, w, tile, cache_bytes, false) {}
+
+    // zero matrix in a new file at `path`, which is replaced if it exists
+    tiled_matrix(const std::string& path, size_t h, size_t w,
+                 size_t tile = default_tile, size_t cache_bytes = default_cache_bytes)
+            : tiled_matrix(create(path), h, w, tile, cache_bytes, true) {}
+
+    template < typename Other >
+    tiled_matrix(const matrix_expression<T, Other>& other) // NOLINT(google-explicit-constructor)
+            : tiled_matrix(other.height(), other.width()) {
+        store(other.derived());
+    }
+
+    // opens a file written by an earlier tiled_matrix
+    static tiled_matrix open(const std::string& path, size_t cache_bytes = default_cache_bytes) {
+        int fd = ::open(path.c_str(), O_RDWR);
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        binary::header h {};
+        struct stat st {};
+        try {
+            if(::fstat(fd, &st) != 0) {
+                throw std::system_error(errno, std::generic_category(), path);
+            }
+            if(static_cast<uint64_t>(st.st_size) < sizeof(h)) {
+                throw std::runtime_error(path + ": truncated");
+            }
+            tiled::detail::read_at(fd, &h, sizeof(h), 0);
+            binary::check<T>(h, static_cast<uint64_t>(st.st_size), path, binary::layout::tiled);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        return tiled_matrix(fd, h.height, h.width, h.stride, cache_bytes, true, false);
+    }
+
+    tiled_matrix(tiled_matrix&&) noexcept = default;
+
+    tiled_matrix& operator=(tiled_matrix&&) noexcept = default;
+
+    tiled_matrix& operator=(const tiled_matrix& other) {
+        return this->assign(other);
+    }
+
+    template < typename Other >
+    tiled_matrix& operator=(const matrix_expression<T, Other>& other) {
+        return this->assign(other);
+    }
+
+    T get(size_t row, size_t col) const {
+        MATRIX_COUNT_EVALUATION(tiled_matrix);
+        return at_hand(row, col)->data[(row % _tile) * _tile + col % _tile];
+    }
+
+    void set(size_t row, size_t col, const T& val) {
+        while (true) {
+            typename cache::handle t = at_hand(row, col);
+            // an evicted tile is read in again and written there
+            if(t->begin_write()) {
+                t->data[(row % _tile) * _tile + col % _tile] = val;
+                t->dirty = true;
+                t->end_write();
+                return;
+            }
+        }
+    }
+
+    // see matrix::assign, which checks that src only reads this element-wise
+    template < typename Other >
+    void store(const Other& src) {
+        reshape(src.height(), src.width());
+        MATRIX_TIME_MATERIALIZATION("tiled_matrix assign", Other, height(), width());
+        evaluate(src);
+    }
+
+    template < typename M1, typename M2 >
+    void store(const matrix_dot_product<T, M1, M2>& product) {
+        reshape(product.height(), product.width());
+        MATRIX_TIME_MATERIALIZATION("tiled_matrix product", typename std::decay<decltype(product)>::type, height(), width());
+        const product_operand<M1>& lhs = product.lhs();
+        if(lhs.evaluated()) {
+            multiply_by(*lhs.evaluated(), product);
+        } else {
+            multiply_by(lhs.expression(), product);
+        }
+    }
+
+    size_t height() const {
+        return _h;
+    }
+
+    size_t width() const {
+        return _w;
+    }
+
+    size_t tile_size() const noexcept {
+        return _tile;
+    }
+
+    // tiles the cache holds beyond the ones in use
+    size_t cache_tiles() const {
+        return _cache->capacity();
+    }
+
+    // the tile element (row, col) lies in, pinned while the handle is held
+    typename cache::handle tile_at(size_t row, size_t col) const {
+        return _cache->acquire(index_of(row, col));
+    }
+
+    // starts reading in the tile element (row, col) lies in
+    void prefetch(size_t row, size_t col) const {
+        if(row < _h && col < _w) {
+            _cache->prefetch(index_of(row, col));
+        }
+    }
+
+    // writes every modified tile to the file
+    void flush() {
+        _cache->flush();
+    }
+
+    tiled::cache_statistics statistics() const {
+        return _cache->statistics();
+    }
+
+private:
+    std::unique_ptr<cache> _cache;
+    size_t _h;
+    size_t _w;
+    size_t _tile;
+
+    tiled_matrix(int fd, size_t h, size_t w, size_t tile, size_t cache_bytes, bool keep, bool initialize = true)
+            : _h(h), _w(w), _tile(std::max<size_t>(tile, 1)) {
+        const binary::header header = binary::make_header<T>(_h, _w, _tile, binary::layout::tiled);
+        size_t tile_bytes = _tile * _tile * sizeof(T);
+        _cache.reset(new cache(fd, header.data_offset, _tile * _tile, cache_bytes / tile_bytes, keep));
+        if(initialize) {
+            format();
+        }
+    }
+
+    static int create(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+        return fd;
+    }
+
+    static int temporary_file() {
+        const char* dir = std::getenv("TMPDIR");
+        std::string name = std::string(dir != nullptr && *dir != '\0' ? dir : "/tmp") + "/tiled_matrix_XXXXXX";
+        std::vector<char> path(name.begin(), name.end());
+        path.push_back('\0');
+        int fd = ::mkstemp(path.data());
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), name);
+        }
+        ::unlink(path.data());
+        return fd;
+    }
+
+    size_t tiles_down() const {
+        return (_h + _tile - 1) / _tile;
+    }
+
+    size_t tiles_across() const {
+        return (_w + _tile - 1) / _tile;
+    }
+
+    size_t index_of(size_t row, size_t col) const {
+        return row / _tile * tiles_across() + col / _tile;
+    }
+
+    // Writes the header and sizes the file for the current shape, every tile
+    // reading as zero. Holes are left unwritten where the file system allows.
+    void format() {
+        const binary::header header = binary::make_header<T>(_h, _w, _tile, binary::layout::tiled);
+        uint64_t size = header.data_offset + static_cast<uint64_t>(tiles_down() * tiles_across()) * _tile * _tile * sizeof(T);
+        int fd = _cache->fd();
+        if(::ftruncate(fd, 0) != 0 || ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            throw std::system_error(errno, std::generic_category(), "tiled_matrix");
+        }
+        tiled::detail::write_at(fd, &header, sizeof(header), 0);
+    }
+
+    void reshape(size_t h, size_t w) {
+        if(h != _h || w != _w) {
+            _cache->reset();
+            _h = h;
+            _w = w;
+            format();
+        }
+    }
+
+    // Each thread keeps the last few tiles it reached through get/set, so
+    // reading along a tile takes no lock. Slots belong to one generation of
+    // one cache and do not pin their tiles: the cache still evicts them to
+    // stay within its capacity, and frees them when reset or destroyed.
+    typename cache::handle at_hand(size_t row, size_t col) const {
+        struct slot {
+            uint64_t generation = 0;
+            size_t index = 0;
+            std::weak_ptr<typename cache::tile> tile;
+        };
+        static constexpr size_t slots = 4;
+        static thread_local slot kept[slots];
+        static thread_local size_t next = 0;
+        const uint64_t generation = _cache->generation();
+        const size_t index = index_of(row, col);
+        slot* reuse = nullptr;
+        for (slot& s : kept) {
+            if(s.generation == generation && s.index == index) {
+                typename cache::handle t = s.tile.lock();
+                if(t && !t->evicted) {
+                    return t;
+                }
+                reuse = &s;
+            }
+        }
+        slot& s = reuse != nullptr ? *reuse : kept[next++ % slots];
+        typename cache::handle t = _cache->acquire(index);
+        s.generation = generation;
+        s.index = index;
+        s.tile = t;
+        return t;
+    }
+
+    // element-wise: a tile at a time, each split over threads by rows,
+    // reading in the operands' tiles for the next one meanwhile
+    template < typename Other >
+    void evaluate(const matrix_expression<T, Other>& other) {
+        const Other& src = other.derived();
+        // tiles src reads are overwritten in place, the others without reading them first
+        const bool discard = alias_of(src, alias_target_of(*this)) == aliasing::none;
+        for (size_t row = 0; row < _h; row += _tile) {
+            for (size_t col = 0; col < _w; col += _tile) {
+                if(col + _tile < _w) {
+                    tiled::prefetch(src, row, col + _tile);
+                } else {
+                    tiled::prefetch(src, row + _tile, 0);
+                }
+                size_t rows = std::min(_tile, _h - row);
+                size_t cols = std::min(_tile, _w - col);
+                typename cache::handle t = _cache->acquire(index_of(row, col), discard);
+                T* data = t->data.data();
+                parallel::for_range(0, rows, parallel::grain_for(cols * src.element_cost()), [&](size_t first, size_t last) {
+                    for (size_t i = first; i < last; ++i) {
+                        for (size_t j = 0; j < cols; ++j) {
+                            data[i * _tile + j] = src.get(row + i, col + j);
+                        }
+                    }
+                });
+                t->dirty = true;
+                _cache->write_behind(t->index);
+            }
+        }
+    }
+
+    template < typename A, typename M1, typename M2 >
+    void multiply_by(const A& a, const matrix_dot_product<T, M1, M2>& product) {
+        const product_operand<M2>& rhs = product.rhs();
+        if(rhs.evaluated()) {
+            multiply(a, *rhs.evaluated(), product);
+        } else {
+            multiply(a, rhs.expression(), product);
+        }
+    }
+
+    // C tile (i, j) = sum over k of A block (i, k) * B block (k, j), with the
+    // blocks of the next step read in while this one is multiplied
+    template < typename A, typename B, typename P >
+    void multiply(const A& a, const B& b, const P& product) {
+        size_t side_a = tiled::tile_side(a);
+        size_t side_b = tiled::tile_side(b);
+        if((side_a != 0 && side_a != _tile) || (side_b != 0 && side_b != _tile)) {
+            evaluate(product);  // tiles that do not line up: element by element
+            return;
+        }
+        const size_t depth = a.width();
+        auto prefetch_step = [&](size_t row, size_t col, size_t k) {
+            if(k >= depth) {
+                k = 0;
+                col += _tile;
+                if(col >= _w) {
+                    col = 0;
+                    row += _tile;
+                }
+            }
+            if(row < _h && depth > 0) {
+                tiled::prefetch(a, row, k);
+                tiled::prefetch(b, k, col);
+            }
+        };
+        for (size_t row = 0; row < _h; row += _tile) {
+            for (size_t col = 0; col < _w; col += _tile) {
+                size_t rows = std::min(_tile, _h - row);
+                size_t cols = std::min(_tile, _w - col);
+                typename cache::handle c = _cache->acquire(index_of(row, col), true);
+                std::fill(c->data.begin(), c->data.end(), T{});
+                for (size_t k = 0; k < depth; k += _tile) {
+                    prefetch_step(row, col, k + _tile);
+                    auto a_block = tiled::block_at(a, row, k);
+                    auto b_block = tiled::block_at(b, k, col);
+                    gemm::multiply<T>(rows, cols, std::min(_tile, depth - k),
+                                      a_block.source, b_block.source, c->data.data(), _tile);
+                }
+                c->dirty = true;
+                _cache->write_behind(c->index);
+            }
+        }
+    }
+};
+
+template < typename T > constexpr size_t tiled_matrix<T>::default_tile;
+template < typename T > constexpr size_t tiled_matrix<T>::default_cache_bytes;
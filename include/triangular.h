@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include "full_matrix.h"
+#include "matrix.h"
+#include "parallel.h"
+
+// Triangular solves T X = B in place of B, for any number of right-hand
+// sides as the columns of B. Blocked: each diagonal block of T is solved by
+// substitution, the columns of B split over threads, and what the solved
+// rows contribute to the remaining ones is subtracted with one product
+// through the blocked kernel (gemm.h). Only the triangle the solve reads is
+// accessed, so the factors of an LU or Cholesky factorization, held in one
+// matrix, are solved against directly; views with swapped strides solve
+// against a transposed factor.
+namespace triangular {
+
+    // whether the diagonal is stored, or taken as all ones without reading it
+    enum class diagonal { unit, stored };
+
+    constexpr size_t default_block = 64;
+
+    namespace detail {
+
+        template < typename T, bool W >
+        T at(const dense_view<T, W>& m, size_t row, size_t col) {
+            return m.data()[row * m.row_stride() + col * m.col_stride()];
+        }
+
+        // forward (lower) or backward (upper) substitution with an n x n block
+        template < typename T, bool W >
+        void substitute(const dense_view<T, W>& t, dense_view<T, true>& b, diagonal d, bool lower) {
+            const size_t n = t.height();
+            const size_t m = b.width();
+            const size_t rs = b.row_stride();
+            const size_t cs = b.col_stride();
+            parallel::for_range(0, m, parallel::grain_for(n * n / 2.0), [&](size_t first, size_t last) {
+                for (size_t step = 0; step < n; ++step) {
+                    size_t i = lower ? step : n - 1 - step;
+                    T* bi = b.data() + i * rs;
+                    size_t k_first = lower ? 0 : i + 1;
+                    size_t k_last = lower ? i : n;
+                    for (size_t k = k_first; k < k_last; ++k) {
+                        const T tik = at(t, i, k);
+                        const T* bk = b.data() + k * rs;
+                        for (size_t j = first; j < last; ++j) {
+                            bi[j * cs] -= tik * bk[j * cs];
+                        }
+                    }
+                    if(d == diagonal::stored) {
+                        const T tii = at(t, i, i);
+                        for (size_t j = first; j < last; ++j) {
+                            bi[j * cs] /= tii;
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+    // L X = B for the lower triangle of the n x n matrix l, B n x m
+    template < typename T, bool W >
+    void solve_lower(const dense_view<T, W>& l, dense_view<T, true> b, diagonal d, size_t block = default_block) {
+        const size_t n = l.height();
+        const size_t m = b.width();
+        block = std::max<size_t>(block, 1);
+        for (size_t kb = 0; kb < n; kb += block) {
+            size_t nb = std::min(block, n - kb);
+            dense_view<T, true> solved = b.block(kb, 0, nb, m);
+            detail::substitute(l.block(kb, kb, nb, nb), solved, d, true);
+            if(kb + nb < n) {
+                // rows below are disjoint from the solved ones: no temporary
+                dense_view<T, true> rest = b.block(kb + nb, 0, n - kb - nb, m);
+                rest.store(rest - l.block(kb + nb, kb, n - kb - nb, nb).dotProduct(solved));
+            }
+        }
+    }
+
+    // U X = B for the upper triangle of the n x n matrix u, B n x m
+    template < typename T, bool W >
+    void solve_upper(const dense_view<T, W>& u, dense_view<T, true> b, diagonal d, size_t block = default_block) {
+        const size_t n = u.height();
+        const size_t m = b.width();
+        block = std::max<size_t>(block, 1);
+        for (size_t end = n; end > 0;) {
+            size_t nb = std::min(block, end);
+            size_t kb = end - nb;
+            dense_view<T, true> solved = b.block(kb, 0, nb, m);
+            detail::substitute(u.block(kb, kb, nb, nb), solved, d, false);
+            if(kb > 0) {
+                dense_view<T, true> rest = b.block(0, 0, kb, m);
+                rest.store(rest - u.block(0, kb, kb, nb).dotProduct(solved));
+            }
+            end = kb;
+        }
+    }
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "arena.h"
+#include "compressed_matrix.h"
+#include "full_matrix.h"
+#include "sparse_matrix.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+// GCC pairs the replacements below by name and sees free() of operator new memory
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// every heap allocation of the test program
+static std::atomic<size_t> heap_calls(0);
+
+void* operator new(size_t bytes) {
+    ++heap_calls;
+    if(void* p = std::malloc(bytes == 0 ? 1 : bytes)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void* operator new[](size_t bytes) {
+    return operator new(bytes);
+}
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept {
+    ++heap_calls;
+    return std::malloc(bytes == 0 ? 1 : bytes);
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t& tag) noexcept {
+    return operator new(bytes, tag);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+template < typename T >
+using scratch_matrix = full_matrix<T, arena_allocator<T>>;
+
+TEST(arena_test, bump_allocation) {
+    arena a (1024);
+    void* first = nullptr;
+    {
+        arena::scope scope(a);
+        arena_allocator<double> alloc;
+        ASSERT_EQ(alloc.source(), &a);
+        first = alloc.allocate(10);
+        double* second = alloc.allocate(10);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(first) % matrix_alignment, 0);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(second) % matrix_alignment, 0);
+        ASSERT_GE(second, static_cast<double*>(first) + 10);
+
+        // larger than a block
+        alloc.allocate(1000);
+        ASSERT_EQ(a.blocks(), 2);
+    }
+    ASSERT_EQ(arena::active(), nullptr);
+    ASSERT_EQ(arena_allocator<double>().source(), nullptr);
+    {
+        arena::scope scope(a);
+        ASSERT_EQ(arena_allocator<double>().allocate(10), first);
+    }
+    ASSERT_EQ(a.blocks(), 2);
+}
+
+TEST(arena_test, storage_allocators) {
+    full_matrix<int> a ({{1, 2, 3}, {4, 5, 6}});
+    full_matrix<int> b ({{1, 0, 1}, {0, 1, 0}});
+    arena temporaries;
+    {
+        arena::scope scope(temporaries);
+        scratch_matrix<int> sum = a + b * 2;
+        scratch_matrix<int> product = sum.dotProduct(a.transpose());
+        ASSERT_EQ(sum.get_allocator().source(), &temporaries);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(sum.data()) % matrix_alignment, 0);
+        ASSERT_EQ(sum, a + b * 2);
+        ASSERT_EQ(product, (a + b * 2).dotProduct(a.transpose()));
+        ASSERT_EQ(scratch_matrix<int>(sum - a), b * 2);
+        ASSERT_EQ(full_matrix<int>(sum.transpose()), (a + b * 2).transpose());
+
+        sparse_matrix<int, arena_allocator<int>> s = a - b;
+        ASSERT_EQ(s, a - b);
+        ASSERT_EQ(s.nnz(), 5);
+        ASSERT_EQ(csr_matrix<int>(s), a - b);
+        ASSERT_EQ(full_matrix<int>(s.dotProduct(a.transpose())), (a - b).dotProduct(a.transpose()));
+    }
+    // outside of a scope the same types use the heap
+    scratch_matrix<int> heap = a * 3;
+    ASSERT_EQ(heap.get_allocator().source(), nullptr);
+    ASSERT_EQ(heap, a * 3);
+}
+
+// one step of x <- x + (b - A x) / 4 on temporaries, with a vector product
+// and a matrix product of the same size
+TEST(arena_test, steady_state_iterations) {
+    const size_t n = 64;
+    full_matrix<double> a (n, n);
+    full_matrix<double> x (n, 1);
+    full_matrix<double> b (n, 1, 1.0);
+    for (size_t i = 0; i < n; ++i) {
+        a[i][i] = 4;
+        a[i][(i + 1) % n] = -1;
+    }
+    vector<double> v (n, 1.0);
+
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(1);
+    arena temporaries;
+    double products = 0;
+    for (int iteration = 0; iteration < 5; ++iteration) {
+        size_t before = heap_calls;
+        {
+            arena::scope scope(temporaries);
+            scratch_matrix<double> ax = a.dotProduct(x);
+            scratch_matrix<double> av = a.dotProduct(v);
+            scratch_matrix<double> residual = b - ax;
+            scratch_matrix<double> step = residual * 0.25;
+            scratch_matrix<double> aa = a.dotProduct(a);
+            for (size_t i = 0; i < n; ++i) {
+                x.set(i, 0, x.get(i, 0) + step.get(i, 0));
+            }
+            products += av.get(0, 0) + aa.get(0, 0);
+        }
+        size_t calls = heap_calls - before;
+        if(iteration > 0) {
+            ASSERT_EQ(calls, 0);
+        }
+    }
+    parallel::set_concurrency(threads);
+    ASSERT_EQ(temporaries.blocks(), 1);
+    ASSERT_EQ(products, 5 * (3 + 16));
+    ASSERT_NEAR(x[0][0], 1.0 / 3, 0.01);
+}
+
+// products started by the tasks of a parallel loop, and by the products' own tasks
+TEST(arena_test, nested_products) {
+    const size_t n = 96;
+    full_matrix<double> a (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            a[i][j] = static_cast<double>((i * 7 + j * 3) % 11) - 5;
+        }
+    }
+    full_matrix<double> expected = a.dotProduct(a);
+
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(4);
+    std::vector<int> same (16);
+    parallel::for_range(0, same.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            same[i] = full_matrix<double>(a.dotProduct(a)) == expected;
+        }
+    });
+    parallel::set_concurrency(threads);
+    ASSERT_EQ(same, std::vector<int>(16, 1));
+}
+
+#pragma clang diagnostic pop
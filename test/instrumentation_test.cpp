@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include "full_matrix.h"
+#include "sparse_matrix.h"
+
+// built as its own executable with MATRIX_INSTRUMENTATION defined
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+// evaluations of every node type whose name starts with `prefix`
+static uint64_t evaluations(const std::string& prefix) {
+    uint64_t total = 0;
+    for (const auto& node : instrumentation::registry::instance().evaluations()) {
+        if(node.first.compare(0, prefix.size(), prefix) == 0) {
+            total += node.second;
+        }
+    }
+    return total;
+}
+
+TEST(instrumentation_test, element_evaluations) {
+    full_matrix<int> a (4, 4, 1);
+    full_matrix<int> b (4, 4, 2);
+
+    instrumentation::reset();
+    full_matrix<int> c = a + b * 2;
+    ASSERT_EQ(c, full_matrix<int>(4, 4, 5));
+    ASSERT_EQ(evaluations("matrix_sum<"), 16);
+    ASSERT_EQ(evaluations("matrix_scalar_product<"), 16);
+    // 32 reads while evaluating, 32 more in the comparison above
+    ASSERT_EQ(evaluations("full_matrix<"), 64);
+
+    instrumentation::reset();
+    sparse_matrix<int> s = a - b;
+    ASSERT_EQ(evaluations("matrix_difference<"), 16);
+    ASSERT_EQ(evaluations("sparse_matrix<"), 0);
+    ASSERT_EQ(s.get(0, 0), -1);
+    ASSERT_EQ(evaluations("sparse_matrix<"), 1);
+}
+
+TEST(instrumentation_test, allocations) {
+    full_matrix<double> a (8, 3);
+
+    instrumentation::reset();
+    {
+        full_matrix<double> b = a * 2.0;
+        full_matrix<double> c = b.transpose();
+        ASSERT_EQ(instrumentation::registry::instance().allocations(), 2);
+        // rows are padded to a whole cache line
+        ASSERT_EQ(instrumentation::registry::instance().allocated_bytes(), (8 + 3) * 64);
+        // a is still allocated too
+        ASSERT_EQ(instrumentation::registry::instance().peak_bytes(), (8 + 8 + 3) * 64);
+    }
+    ASSERT_EQ(instrumentation::registry::instance().allocations(), 2);
+}
+
+TEST(instrumentation_test, materializations) {
+    full_matrix<int> a (30, 30, 1);
+
+    instrumentation::reset();
+    // the nested product is evaluated once into a temporary
+    full_matrix<int> c = a.dotProduct(a).dotProduct(a) + a;
+    ASSERT_EQ(c.get(0, 0), 30 * 30 + 1);
+
+    std::vector<instrumentation::materialization> events = instrumentation::registry::instance().materializations();
+    ASSERT_EQ(events.size(), 3);
+    size_t operands = 0;
+    for (const instrumentation::materialization& m : events) {
+        operands += std::string(m.kind) == "product operand";
+        ASSERT_EQ(m.height, 30);
+        ASSERT_EQ(m.width, 30);
+    }
+    ASSERT_EQ(operands, 1);
+    ASSERT_EQ(evaluations("matrix_dot_product<int, matrix_dot_product<"), 900);
+
+    // nothing is evaluated for a product only inspected
+    instrumentation::reset();
+    auto inner = a.dotProduct(a);
+    ASSERT_EQ(inner.dotProduct(a).height(), 30);
+    ASSERT_TRUE(instrumentation::registry::instance().materializations().empty());
+    instrumentation::reset();
+    c = a.dotProduct(a).dotProduct(a) + a;
+
+    std::ostringstream report;
+    instrumentation::report(report);
+    ASSERT_NE(report.str().find("product operand  matrix_dot_product<int, full_matrix<int, "),
+              std::string::npos);
+
+    std::ostringstream trace;
+    instrumentation::write_trace(trace);
+    ASSERT_EQ(trace.str().compare(0, 15, "{\"traceEvents\":"), 0);
+    ASSERT_NE(trace.str().find("\"ph\":\"X\""), std::string::npos);
+    ASSERT_NE(trace.str().find("\"evaluations\":{"), std::string::npos);
+
+    // timestamps keep nanosecond digits, however late in the run
+    std::ostringstream us;
+    instrumentation::write_microseconds(us, 12345678901234);
+    us << ' ';
+    instrumentation::write_microseconds(us, 5);
+    ASSERT_EQ(us.str(), "12345678901.234 0.005");
+}
+
+#pragma clang diagnostic pop
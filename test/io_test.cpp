@@ -0,0 +1,320 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "full_matrix.h"
+#include "matrix_file.h"
+#include "matrix_market.h"
+#include "sparse_matrix.h"
+#include "tiled_matrix.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+static std::string temp_path(const std::string& name) {
+    return testing::TempDir() + name;
+}
+
+template < typename T >
+static full_matrix<T> numbered(size_t h, size_t w) {
+    full_matrix<T> m (h, w);
+    for (size_t i = 0; i < h; ++i) {
+        for (size_t j = 0; j < w; ++j) {
+            m[i][j] = static_cast<T>(i * w + j) / 2;
+        }
+    }
+    return m;
+}
+
+TEST(io_test, binary_round_trip) {
+    const std::string path = temp_path("binary_round_trip.bin");
+    full_matrix<double> a = numbered<double>(37, 21);
+    binary::save(a, path);
+    ASSERT_EQ(binary::load<double>(path), a);
+
+    full_matrix<int> b = numbered<int>(5, 3);
+    binary::save(b.transpose() * 2, path);
+    full_matrix<int> loaded = binary::load<int>(path);
+    ASSERT_EQ(loaded, b.transpose() * 2);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(loaded.data()) % matrix_alignment, 0);
+
+    binary::save(full_matrix<float>(0, 0), path);
+    ASSERT_EQ(binary::load<float>(path).height(), 0);
+
+    // the type is part of the format
+    binary::save(a, path);
+    ASSERT_THROW(binary::load<float>(path), std::runtime_error);
+    ASSERT_THROW(binary::load<int64_t>(path), std::runtime_error);
+    ASSERT_THROW(binary::load<double>(temp_path("missing.bin")), std::runtime_error);
+
+    // headers that do not match the file are refused
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << "not a matrix, but long enough to hold a header of 64 bytes or more";
+    ASSERT_THROW(binary::load<double>(path), std::runtime_error);
+    binary::save(a, path);
+    std::string bytes;
+    {
+        std::ifstream in(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() - 8);
+    ASSERT_THROW(binary::load<double>(path), std::runtime_error);
+    ASSERT_THROW(mapped_matrix<double>{path}, std::runtime_error);
+
+    // sizes whose product wraps around would otherwise pass for a short file
+    binary::header h = binary::make_header<double>(uint64_t(1) << 61, 8, 8);
+    ASSERT_THROW(binary::check<double>(h, bytes.size(), path), std::runtime_error);
+    std::memcpy(&bytes[0], &h, sizeof(h));
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes;
+    ASSERT_THROW(mapped_matrix<double>{path}, std::runtime_error);
+    h = binary::make_header<double>(uint64_t(1) << 33, uint64_t(1) << 33, uint64_t(1) << 31, binary::layout::tiled);
+    ASSERT_THROW(binary::check<double>(h, bytes.size(), path, binary::layout::tiled), std::runtime_error);
+}
+
+TEST(io_test, mapped_matrix) {
+    const std::string path = temp_path("mapped_matrix.bin");
+    full_matrix<double> a = numbered<double>(70, 45);
+    binary::save(a, path);
+
+    mapped_matrix<double> m (path);
+    ASSERT_EQ(m.height(), 70);
+    ASSERT_EQ(m.width(), 45);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(m.data()) % matrix_alignment, 0);
+    ASSERT_EQ(m, a);
+    ASSERT_EQ(m.twoNorm(), a.twoNorm());
+    ASSERT_EQ(m.block(10, 5, 3, 4), a.block(10, 5, 3, 4));
+    ASSERT_EQ(full_matrix<double>(m.dotProduct(a.transpose())), a.dotProduct(a.transpose()));
+    ASSERT_EQ(full_matrix<double>(m.transpose().dotProduct(m)), a.transpose().dotProduct(a));
+
+    // mappings of one file share its pages and outlive a move
+    mapped_matrix<double> other (path);
+    ASSERT_EQ(other, m);
+    mapped_matrix<double> moved (std::move(other));
+    m = std::move(moved);
+    ASSERT_EQ(full_matrix<double>(m * 2), a * 2);
+
+    ASSERT_THROW(mapped_matrix<float>{path}, std::runtime_error);
+    ASSERT_THROW(mapped_matrix<double>{temp_path("missing.bin")}, std::system_error);
+}
+
+TEST(io_test, matrix_market_variants) {
+    std::istringstream general(
+            "%%MatrixMarket matrix coordinate real general\n"
+            "% a comment\n"
+            "\n"
+            "3 4 5\n"
+            "1 1 1.5\n"
+            "3 4 -2e1\n"
+            "  2 2 3\n"
+            "% entries may repeat\n"
+            "2 2 1\n"
+            "1 3 0\n");
+    ASSERT_EQ(matrix_market::read<double>(general), full_matrix<double>({{1.5, 0, 0, 0}, {0, 4, 0, 0}, {0, 0, 0, -20}}));
+
+    std::istringstream pattern(
+            "%%MatrixMarket matrix coordinate pattern symmetric\n"
+            "3 3 3\n"
+            "1 1\n"
+            "3 1\n"
+            "3 2\n");
+    csr_matrix<int> p = matrix_market::read<int>(pattern);
+    ASSERT_EQ(p, full_matrix<int>({{1, 0, 1}, {0, 0, 1}, {1, 1, 0}}));
+    ASSERT_TRUE(p.isSymmetric());
+
+    std::istringstream skew(
+            "%%MatrixMarket matrix coordinate integer skew-symmetric\n"
+            "2 2 1\n"
+            "2 1 7\n");
+    ASSERT_EQ(matrix_market::read<int>(skew), full_matrix<int>({{0, -7}, {7, 0}}));
+
+    std::istringstream array(
+            "%%MatrixMarket matrix array integer general\n"
+            "2 3\n"
+            "1\n4\n2\n5\n3\n0\n");
+    ASSERT_EQ(matrix_market::read<int>(array), full_matrix<int>({{1, 2, 3}, {4, 5, 0}}));
+
+    std::istringstream symmetric_array(
+            "%%MatrixMarket matrix array real symmetric\n"
+            "3 3\n"
+            "1\n2\n3\n4\n5\n6\n");
+    ASSERT_EQ(matrix_market::read<double>(symmetric_array), full_matrix<double>({{1, 2, 3}, {2, 4, 5}, {3, 5, 6}}));
+
+    // the last line need not end in a newline, whichever chunk it falls in
+    for (size_t chunk : {size_t(16), size_t(1) << 24}) {
+        std::istringstream unterminated(
+                "%%MatrixMarket matrix coordinate real general\n"
+                "3 3 2\n"
+                "1 1 1\n"
+                "3 3 2");
+        ASSERT_EQ(matrix_market::read<double>(unterminated, chunk), full_matrix<double>({{1, 0, 0}, {0, 0, 0}, {0, 0, 2}}));
+        std::istringstream unterminated_array(
+                "%%MatrixMarket matrix array integer general\n"
+                "2 1\n"
+                "12\n"
+                "34");
+        ASSERT_EQ(matrix_market::read<int>(unterminated_array, chunk), full_matrix<int>({{12}, {34}}));
+    }
+
+    const char* malformed[] = {
+            "%%MatrixMarket matrix coordinate complex general\n1 1 1\n1 1 1 0\n",
+            "%%MatrixMarket matrix coordinate real general\n2 2 2\n1 1 1\n",
+            "%%MatrixMarket matrix coordinate real general\n2 2 1\n3 1 1\n",
+            "%%MatrixMarket matrix coordinate real general\n2 2 1\n1 1\n",
+            "%%MatrixMarket matrix coordinate real symmetric\n2 2 1\n1 2 1\n",
+            "%%MatrixMarket matrix array real general\n2 2\n1\n2\n3\n4\n5\n",
+            "not a matrix\n"
+    };
+    for (const char* text : malformed) {
+        std::istringstream in(text);
+        ASSERT_THROW(matrix_market::read<double>(in), std::runtime_error) << text;
+    }
+}
+
+// written files read back the same, also when chunks and pieces split them anywhere
+TEST(io_test, matrix_market_round_trip) {
+    const size_t n = 6000;
+    sparse_matrix<double> s (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        s.set(i, i, 1.0 / (i + 1));
+        s.set(i, (i * 7) % n, -0.1 * i);
+        s.set((i * 13) % n, i, 3e-5 * i);
+    }
+    std::stringstream text;
+    matrix_market::write(text, s);
+    ASSERT_EQ(text.str().find("%%MatrixMarket matrix coordinate real general\n6000 6000 "), 0);
+    const csr_matrix<double> expected (s);
+    for (size_t chunk : {size_t(7), size_t(4096), size_t(1) << 24}) {
+        std::istringstream in(text.str());
+        csr_matrix<double> read = matrix_market::read<double>(in, chunk);
+        ASSERT_EQ(read.offsets(), expected.offsets());
+        ASSERT_EQ(read.indices(), expected.indices());
+        ASSERT_EQ(read.values(), expected.values());
+    }
+
+    full_matrix<int> a = {{1, 2, 0}, {2, 5, -3}, {0, -3, 4}};
+    std::stringstream dense;
+    matrix_market::write(dense, a, matrix_market::symmetry::symmetric);
+    ASSERT_EQ(dense.str(), "%%MatrixMarket matrix array integer symmetric\n3 3\n1\n2\n0\n5\n-3\n4\n");
+    ASSERT_EQ(matrix_market::read<int>(dense), a);
+
+    const std::string path = temp_path("round_trip.mtx");
+    csr_matrix<int> sparse (a);
+    matrix_market::write(path, sparse, matrix_market::symmetry::symmetric);
+    ASSERT_EQ(matrix_market::read<int>(path), a);
+    matrix_market::write(path, a.transpose() * 2);
+    ASSERT_EQ(matrix_market::read<int>(path), a * 2);
+}
+
+// tiles of 16, with room for only a few of them in memory
+TEST(io_test, tiled_matrix) {
+    const size_t budget = 3 * 16 * 16 * sizeof(double);
+    full_matrix<double> a = numbered<double>(70, 45);
+    tiled_matrix<double> t (70, 45, 16, budget);
+    ASSERT_EQ(t.cache_tiles(), 3);
+    ASSERT_EQ(t, full_matrix<double>(70, 45));
+
+    t = a;
+    ASSERT_EQ(t, a);
+    t = t * 2 + a;
+    full_matrix<double> expected = a * 3;
+    ASSERT_EQ(t, expected);
+    t.set(69, 44, -1);
+    expected.set(69, 44, -1);
+    ASSERT_EQ(t.get(69, 44), -1);
+    ASSERT_EQ(t.block(60, 30, 10, 15), expected.block(60, 30, 10, 15));
+
+    // read elsewhere than element-wise: through a temporary tiled matrix
+    t = t.transpose();
+    ASSERT_EQ(t.height(), 45);
+    ASSERT_EQ(t, expected.transpose());
+    ASSERT_EQ(full_matrix<double>(t.transpose() - a), expected - a);
+
+    tiled::cache_statistics stats = t.statistics();
+    ASSERT_GT(stats.reads, 0);
+    ASSERT_GT(stats.writes, 0);
+    ASSERT_LE(stats.peak_tiles, t.cache_tiles()) << stats.peak_tiles;
+
+    // elements set from several threads while their tiles are evicted
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(4);
+    tiled_matrix<double> u (70, 45, 16, budget);
+    parallel::for_range(0, 70, 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            for (size_t j = 0; j < 45; ++j) {
+                u.set(i, j, a.get(i, j));
+            }
+        }
+    });
+    ASSERT_EQ(u, a);
+
+    // a column at a time, so a dirty tile is read back, by another thread
+    // too, right after being evicted and while it is written back
+    parallel::for_range(0, 45, 1, [&](size_t first, size_t last) {
+        for (size_t j = first; j < last; ++j) {
+            for (size_t i = 0; i < 70; ++i) {
+                u.set(i, j, u.get(i, j) * 2 + u.get(69 - i, j) * 0);
+            }
+        }
+    });
+    parallel::set_concurrency(threads);
+    ASSERT_EQ(u, a * 2);
+}
+
+TEST(io_test, tiled_product) {
+    const size_t budget = 4 * 16 * 16 * sizeof(double);
+    full_matrix<double> a = numbered<double>(70, 45);
+    full_matrix<double> b = numbered<double>(45, 33) * -1;
+    tiled_matrix<double> ta (70, 45, 16, budget);
+    tiled_matrix<double> tb (45, 33, 16, budget);
+    ta = a;
+    tb = b;
+
+    tiled_matrix<double> c (1, 1, 16, budget);
+    c = ta.dotProduct(tb);
+    ASSERT_EQ(c.height(), 70);
+    ASSERT_EQ(c.width(), 33);
+    ASSERT_EQ(c, a.dotProduct(b));
+    c = ta.transpose().dotProduct(ta);
+    ASSERT_EQ(c, a.transpose().dotProduct(a));
+    c = ta.dotProduct(b);
+    ASSERT_EQ(c, a.dotProduct(b));
+    c = c.dotProduct(tb.transpose());
+    ASSERT_EQ(c, a.dotProduct(b).eval().dotProduct(b.transpose()));
+
+    // tiles that do not line up are multiplied element by element
+    tiled_matrix<double> other (45, 33, 8, budget);
+    other = b;
+    c = ta.dotProduct(other);
+    ASSERT_EQ(c, a.dotProduct(b));
+    ASSERT_EQ(full_matrix<double>(ta.dotProduct(tb)), a.dotProduct(b));
+
+    // operands are read a tile at a time, so none held more than its cache
+    ASSERT_LE(ta.statistics().peak_tiles, ta.cache_tiles() + 4);
+    ASSERT_LE(c.statistics().peak_tiles, c.cache_tiles() + 4);
+}
+
+TEST(io_test, tiled_file) {
+    const std::string path = temp_path("tiled.bin");
+    full_matrix<int> a = numbered<int>(37, 21);
+    {
+        tiled_matrix<int> t (path, 37, 21, 8, 0);
+        t = a;
+        t.set(36, 20, 7);
+    }
+    a.set(36, 20, 7);
+    tiled_matrix<int> t = tiled_matrix<int>::open(path);
+    ASSERT_EQ(t.tile_size(), 8);
+    ASSERT_EQ(t, a);
+    t = t * 2;
+    t.flush();
+    ASSERT_EQ(tiled_matrix<int>::open(path), a * 2);
+
+    ASSERT_THROW(tiled_matrix<double>::open(path), std::runtime_error);
+    binary::save(a, path);
+    ASSERT_THROW(tiled_matrix<int>::open(path), std::runtime_error);
+    ASSERT_THROW(tiled_matrix<int>::open(temp_path("missing.bin")), std::system_error);
+}
+
+#pragma clang diagnostic pop
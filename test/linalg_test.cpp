@@ -0,0 +1,462 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include "full_matrix.h"
+#include "cholesky.h"
+#include "compressed_matrix.h"
+#include "eigen.h"
+#include "iterative.h"
+#include "lu.h"
+#include "sparse_matrix.h"
+#include "symmetric_matrix.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+static full_matrix<double> random_matrix(size_t h, size_t w, unsigned seed) {
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> dist(-1, 1);
+    full_matrix<double> m (h, w);
+    for (size_t i = 0; i < h; ++i) {
+        for (size_t j = 0; j < w; ++j) {
+            m.set(i, j, dist(gen));
+        }
+    }
+    return m;
+}
+
+static double max_difference(const full_matrix<double>& a, const full_matrix<double>& b) {
+    double result = 0;
+    for (size_t i = 0; i < a.height(); ++i) {
+        for (size_t j = 0; j < a.width(); ++j) {
+            result = std::max(result, std::abs(a.get(i, j) - b.get(i, j)));
+        }
+    }
+    return result;
+}
+
+// blocks of 16 over a matrix of 150: full panels, a partial one, and
+// trailing updates through the blocked product
+TEST(linalg_test, lu) {
+    const size_t n = 150;
+    full_matrix<double> a = random_matrix(n, n, 1);
+    lu_factorization<double> f (a, 16);
+    ASSERT_EQ(f.size(), n);
+    ASSERT_FALSE(f.singular());
+
+    // P A = L U, with the rows of A swapped as recorded
+    full_matrix<double> pa = a;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            double t = pa.get(i, j);
+            pa.set(i, j, pa.get(f.pivots()[i], j));
+            pa.set(f.pivots()[i], j, t);
+        }
+    }
+    ASSERT_LT(max_difference(f.lower().dotProduct(f.upper()), pa), 1e-12);
+    ASSERT_TRUE(f.lower().isLowerTriangular());
+    ASSERT_TRUE(f.upper().isUpperTriangular());
+
+    // the same factors as the unblocked algorithm, up to rounding
+    ASSERT_LT(max_difference(lu(a, n).factors(), f.factors()), 1e-12);
+
+    // a batch of right-hand sides, and one as a vector
+    full_matrix<double> b = random_matrix(n, 5, 2);
+    full_matrix<double> x = f.solve(b);
+    ASSERT_LT(max_difference(a.dotProduct(x), b), 1e-10);
+    vector<double> y = f.solve(vector<double>(n, 1.0));
+    full_matrix<double> z = f.solve(full_matrix<double>(n, 1, 1.0));
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_DOUBLE_EQ(y[i], z.get(i, 0));
+    }
+}
+
+TEST(linalg_test, lu_pivoting) {
+    // a zero in the first pivot position needs a row swap
+    full_matrix<double> a = {{0, 2, 1}, {1, 1, 0}, {2, 0, 3}};
+    lu_factorization<double> f = lu(a);
+    ASSERT_EQ(f.pivots()[0], 2);
+    ASSERT_DOUBLE_EQ(f.determinant(), -8);
+    full_matrix<double> x = f.solve(full_matrix<double>::identity(3));
+    ASSERT_LT(max_difference(a.dotProduct(x), full_matrix<double>::identity(3)), 1e-15);
+
+    full_matrix<double> singular = {{1, 2}, {2, 4}};
+    lu_factorization<double> g = lu(singular);
+    ASSERT_TRUE(g.singular());
+    ASSERT_EQ(g.determinant(), 0);
+    ASSERT_THROW(g.solve(vector<double>{1, 1}), std::runtime_error);
+    ASSERT_THROW(lu(full_matrix<double>(2, 3)), std::runtime_error);
+    ASSERT_THROW(f.solve(full_matrix<double>(2, 1)), std::runtime_error);
+}
+
+TEST(linalg_test, symmetric_matrix) {
+    full_matrix<double> a = {{4, 1, 2}, {1, 5, 3}, {2, 3, 6}};
+    symmetric_matrix<double> s (a);
+    ASSERT_EQ(s, a);
+    ASSERT_EQ(s.data()[2], 5);
+    ASSERT_EQ(s.data()[4], 3);
+    ASSERT_EQ(symmetric_matrix<double>::packed_size(1000), 500500);
+
+    // one element stands for both positions
+    s.set(0, 2, -1);
+    ASSERT_EQ(s.get(2, 0), -1);
+    s = s * 2 + s;
+    ASSERT_EQ(s.get(0, 2), -3);
+    ASSERT_EQ(s.get(1, 1), 15);
+    s = s.transpose() - s;
+    ASSERT_EQ(s, full_matrix<double>(3, 3));
+    ASSERT_TRUE(s.isSymmetric());
+
+    // only the lower triangle is read
+    full_matrix<double> lower_only = {{1, 9, 9}, {2, 3, 9}, {4, 5, 6}};
+    ASSERT_EQ(symmetric_matrix<double>(lower_only), full_matrix<double>({{1, 2, 4}, {2, 3, 5}, {4, 5, 6}}));
+    ASSERT_THROW(symmetric_matrix<double>(full_matrix<double>(2, 3)), std::runtime_error);
+}
+
+// positive definite: Cholesky, over blocks of 16 of a matrix of 150
+TEST(linalg_test, cholesky) {
+    const size_t n = 150;
+    full_matrix<double> b = random_matrix(n, n, 3);
+    full_matrix<double> a = b.dotProduct(b.transpose()) + full_matrix<double>::identity(n) * double(n);
+    symmetric_matrix<double> packed (a);
+    symmetric_factorization<double> f (packed, 16);
+    ASSERT_TRUE(f.positive_definite());
+    ASSERT_TRUE(f.pivots().empty());
+    full_matrix<double> l = f.lower();
+    ASSERT_TRUE(l.isLowerTriangular());
+    ASSERT_LT(max_difference(l.dotProduct(l.transpose()), a), 1e-10);
+    ASSERT_LT(max_difference(cholesky(a, n).lower(), l), 1e-12);
+    ASSERT_EQ(full_matrix<double>(f.block_diagonal()), full_matrix<double>::identity(n));
+    ASSERT_EQ(full_matrix<double>(cholesky(full_matrix<double>({{4, 2, 0}, {2, 5, 1}, {0, 1, 3}})).block_diagonal()),
+              full_matrix<double>::identity(3));
+
+    full_matrix<double> rhs = random_matrix(n, 4, 4);
+    ASSERT_LT(max_difference(a.dotProduct(f.solve(rhs)), rhs), 1e-10);
+    vector<double> y = f.solve(vector<double>(n, 1.0));
+    full_matrix<double> z = lu(a).solve(full_matrix<double>(n, 1, 1.0));
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_NEAR(y[i], z.get(i, 0), 1e-12);
+    }
+}
+
+// indefinite: LDLᵀ with 1 x 1 and 2 x 2 pivots
+TEST(linalg_test, ldlt) {
+    full_matrix<double> swap = {{0, 1}, {1, 0}};
+    symmetric_factorization<double> g = cholesky(swap);
+    ASSERT_EQ(g.kind(), symmetric_factorization<double>::method::ldlt);
+    ASSERT_EQ(g.block_diagonal().get(1, 0), 1);
+    ASSERT_LT(max_difference(swap.dotProduct(g.solve(full_matrix<double>::identity(2))), full_matrix<double>::identity(2)), 1e-15);
+
+    const size_t n = 90;
+    full_matrix<double> r = random_matrix(n, n, 5);
+    full_matrix<double> a = r + r.transpose();
+    symmetric_factorization<double> f (a, 16);
+    ASSERT_FALSE(f.positive_definite());
+    ASSERT_FALSE(f.singular());
+
+    // P A Pᵀ = L D Lᵀ
+    full_matrix<double> pap = a;
+    for (size_t i = 0; i < n; ++i) {
+        size_t p = f.pivots()[i];
+        for (size_t j = 0; j < n; ++j) {
+            double t = pap.get(i, j);
+            pap.set(i, j, pap.get(p, j));
+            pap.set(p, j, t);
+        }
+        for (size_t j = 0; j < n; ++j) {
+            double t = pap.get(j, i);
+            pap.set(j, i, pap.get(j, p));
+            pap.set(j, p, t);
+        }
+    }
+    full_matrix<double> l = f.lower();
+    full_matrix<double> d (f.block_diagonal());
+    ASSERT_LT(max_difference(l.dotProduct(d).eval().dotProduct(l.transpose()), pap), 1e-10);
+
+    full_matrix<double> rhs = random_matrix(n, 3, 6);
+    ASSERT_LT(max_difference(a.dotProduct(f.solve(rhs)), rhs), 1e-9);
+
+    // positive definite but for its last rows: LDLᵀ from A rebuilt out of
+    // the five panels Cholesky had factored, from a packed matrix
+    full_matrix<double> q = random_matrix(n, n, 7);
+    full_matrix<double> late = q.dotProduct(q.transpose()) + full_matrix<double>::identity(n) * double(n);
+    for (size_t i = 80; i < n; ++i) {
+        late.set(i, i, -late.get(i, i));
+    }
+    symmetric_factorization<double> h (symmetric_matrix<double>(late), 16);
+    ASSERT_EQ(h.kind(), symmetric_factorization<double>::method::ldlt);
+    ASSERT_LT(max_difference(late.dotProduct(h.solve(rhs)), rhs), 1e-9);
+
+    full_matrix<double> singular = {{1, 1}, {1, 1}};
+    ASSERT_TRUE(cholesky(singular).singular());
+    ASSERT_THROW(cholesky(singular).solve(vector<double>{1, 2}), std::runtime_error);
+}
+
+// the 5-point Laplacian on a k x k grid, plus `convection` times the
+// backward difference along rows, which makes it nonsymmetric
+static sparse_matrix<double> laplacian(size_t k, double convection = 0) {
+    sparse_matrix<double> a (k * k, k * k);
+    for (size_t i = 0; i < k; ++i) {
+        for (size_t j = 0; j < k; ++j) {
+            size_t row = i * k + j;
+            a.set(row, row, 4 + convection);
+            if(i > 0) a.set(row, row - k, -1);
+            if(i + 1 < k) a.set(row, row + k, -1);
+            if(j > 0) a.set(row, row - 1, -1 - convection);
+            if(j + 1 < k) a.set(row, row + 1, -1);
+        }
+    }
+    return a;
+}
+
+template < typename M >
+static double relative_residual(const M& a, const vector<double>& x, const vector<double>& b) {
+    vector<double> ax (b.size());
+    product_kernel<M>::multiply(a, x, ax);
+    double r = 0;
+    double n = 0;
+    for (size_t i = 0; i < b.size(); ++i) {
+        r += (b[i] - ax[i]) * (b[i] - ax[i]);
+        n += b[i] * b[i];
+    }
+    return std::sqrt(r / n);
+}
+
+TEST(linalg_test, conjugate_gradient) {
+    sparse_matrix<double> a = laplacian(20);
+    vector<double> b (a.height(), 1.0);
+    iterative::options opts (1000, 1e-10);
+
+    vector<double> x;
+    iterative::convergence plain = iterative::cg(a, b, x, opts);
+    ASSERT_TRUE(plain.converged);
+    ASSERT_EQ(plain.history.size(), plain.iterations + 1);
+    ASSERT_DOUBLE_EQ(plain.history.front(), 1);
+    ASSERT_EQ(plain.history.back(), plain.residual);
+    ASSERT_LT(relative_residual(a, x, b), 1e-9);
+
+    // the same system through CSR with preconditioners, which need fewer iterations
+    csr_matrix<double> csr (a);
+    vector<double> y;
+    iterative::convergence ic = iterative::cg(csr, b, y, opts, iterative::ic0_preconditioner<double>(a));
+    ASSERT_TRUE(ic.converged);
+    ASSERT_LT(ic.iterations, plain.iterations);
+    for (size_t i = 0; i < x.size(); ++i) {
+        ASSERT_NEAR(x[i], y[i], 1e-8);
+    }
+    vector<double> z;
+    ASSERT_TRUE(iterative::cg(csr, b, z, opts, iterative::jacobi_preconditioner<double>(csr)).converged);
+    ASSERT_LT(relative_residual(csr, z, b), 1e-9);
+
+    // from a converged guess nothing is left to do
+    iterative::convergence again = iterative::cg(a, b, x, opts);
+    ASSERT_TRUE(again.converged);
+    ASSERT_EQ(again.iterations, 0);
+
+    // too few iterations
+    vector<double> w;
+    iterative::convergence short_run = iterative::cg(a, b, w, iterative::options(5));
+    ASSERT_FALSE(short_run.converged);
+    ASSERT_EQ(short_run.iterations, 5);
+    ASSERT_EQ(short_run.history.size(), 6);
+}
+
+TEST(linalg_test, bicgstab) {
+    sparse_matrix<double> a = laplacian(20, 1.5);
+    ASSERT_FALSE(a.isSymmetric());
+    vector<double> b (a.height());
+    for (size_t i = 0; i < b.size(); ++i) {
+        b[i] = std::sin(double(i));
+    }
+    iterative::options opts (1000, 1e-10);
+    vector<double> x;
+    iterative::convergence plain = iterative::bicgstab(a, b, x, opts);
+    ASSERT_TRUE(plain.converged);
+    ASSERT_LT(relative_residual(a, x, b), 1e-9);
+
+    vector<double> y;
+    iterative::convergence ilu = iterative::bicgstab(a, b, y, opts, iterative::ilu0_preconditioner<double>(a));
+    ASSERT_TRUE(ilu.converged);
+    ASSERT_LT(ilu.iterations, plain.iterations);
+    ASSERT_LT(relative_residual(a, y, b), 1e-9);
+
+    // a dense system, checked against LU
+    const size_t n = 60;
+    full_matrix<double> d = random_matrix(n, n, 7) + full_matrix<double>::identity(n) * double(n);
+    vector<double> c (n, 1.0);
+    vector<double> z;
+    ASSERT_TRUE(iterative::bicgstab(d, c, z, opts, iterative::ilu0_preconditioner<double>(d)).converged);
+    vector<double> exact = lu(d).solve(c);
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_NEAR(z[i], exact[i], 1e-9);
+    }
+}
+
+TEST(linalg_test, stationary_iterations) {
+    const size_t n = 50;
+    full_matrix<double> a = random_matrix(n, n, 8) + full_matrix<double>::identity(n) * double(2 * n);
+    vector<double> b (n, 1.0);
+    iterative::options opts (500, 1e-12);
+
+    vector<double> x;
+    iterative::convergence j = iterative::jacobi(a, b, x, opts);
+    ASSERT_TRUE(j.converged);
+    ASSERT_EQ(j.history.size(), j.iterations + 1);
+    ASSERT_LT(relative_residual(a, x, b), 1e-11);
+
+    vector<double> y;
+    iterative::convergence gs = iterative::gauss_seidel(csr_matrix<double>(a), b, y, opts);
+    ASSERT_TRUE(gs.converged);
+    ASSERT_LE(gs.iterations, j.iterations);
+    ASSERT_EQ(gs.history.size(), gs.iterations + 1);
+    ASSERT_EQ(gs.history.front(), 1);
+    ASSERT_LT(relative_residual(a, y, b), 1e-10);
+
+    // over-relaxation on the Laplacian, where plain Gauss-Seidel is slow
+    sparse_matrix<double> l = laplacian(10);
+    vector<double> c (l.height(), 1.0);
+    vector<double> u;
+    vector<double> v;
+    iterative::convergence slow = iterative::gauss_seidel(l, c, u, iterative::options(2000, 1e-8));
+    iterative::convergence fast = iterative::sor(l, c, v, iterative::options(2000, 1e-8, 1.5));
+    ASSERT_TRUE(slow.converged);
+    ASSERT_TRUE(fast.converged);
+    ASSERT_LT(fast.iterations, slow.iterations / 2);
+    ASSERT_LE(relative_residual(l, v, c), 1e-8);
+    // the residual reported is that of the result, not the sweep's estimate
+    ASSERT_NEAR(fast.residual, relative_residual(l, v, c), 1e-14);
+    vector<double> early;
+    iterative::convergence cut = iterative::sor(l, c, early, iterative::options(5, 1e-8, 1.5));
+    ASSERT_FALSE(cut.converged);
+    ASSERT_EQ(cut.history.size(), 6);
+    ASSERT_NEAR(cut.residual, relative_residual(l, early, c), 1e-14);
+
+    // missing entries of a sparse matrix read as its default
+    sparse_matrix<double> shifted (3, 3, 1.0);
+    full_matrix<double> dense = {{8, 1, 1}, {1, 8, 1}, {1, 1, 8}};
+    for (size_t i = 0; i < 3; ++i) {
+        shifted.set(i, i, 8);
+    }
+    vector<double> w;
+    vector<double> expected = lu(dense).solve(vector<double>{1, 2, 3});
+    ASSERT_TRUE(iterative::jacobi(shifted, vector<double>{1, 2, 3}, w, opts).converged);
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_NEAR(w[i], expected[i], 1e-11);
+    }
+    w.clear();
+    ASSERT_TRUE(iterative::gauss_seidel(shifted, vector<double>{1, 2, 3}, w, opts).converged);
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_NEAR(w[i], expected[i], 1e-11);
+    }
+
+    // a zero right-hand side has the zero solution
+    vector<double> zero (n, 0.0);
+    iterative::convergence none = iterative::jacobi(a, zero, x, opts);
+    ASSERT_TRUE(none.converged);
+    ASSERT_EQ(x, zero);
+
+    ASSERT_THROW(iterative::jacobi(full_matrix<double>(2, 2), vector<double>{1, 1}, x), std::runtime_error);
+    ASSERT_THROW(iterative::cg(full_matrix<double>(2, 3), vector<double>{1, 1}, x), std::runtime_error);
+    ASSERT_THROW(iterative::ilu0_preconditioner<double>(full_matrix<double>({{0, 1}, {1, 0}})), std::runtime_error);
+    ASSERT_THROW(iterative::ic0_preconditioner<double>(full_matrix<double>({{1, 2}, {2, 1}})), std::runtime_error);
+}
+
+// tridiagonal (-1, 2, -1): eigenvalues 2 - 2 cos(j pi / (n + 1)), distinct
+// and crowding together at both ends as n grows
+static csr_matrix<double> second_difference(size_t n) {
+    sparse_matrix<double> a (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        a.set(i, i, 2);
+        if(i > 0) a.set(i, i - 1, -1);
+        if(i + 1 < n) a.set(i, i + 1, -1);
+    }
+    return csr_matrix<double>(a);
+}
+
+static double second_difference_eigenvalue(size_t n, size_t j) {
+    return 2 - 2 * std::cos(j * M_PI / (n + 1));
+}
+
+// unit length, orthogonal, and A v = λ v up to the reported residuals
+template < typename M >
+static void check_eigenpairs(const M& a, const eigen::eigenpairs<double>& e, double tolerance) {
+    for (size_t i = 0; i < e.values.size(); ++i) {
+        for (size_t j = 0; j <= i; ++j) {
+            double dot = std::inner_product(e.vectors[i].begin(), e.vectors[i].end(), e.vectors[j].begin(), 0.0);
+            ASSERT_NEAR(dot, i == j ? 1 : 0, 1e-8);
+        }
+        vector<double> av (a.height());
+        product_kernel<M>::multiply(a, e.vectors[i], av);
+        double r = 0;
+        for (size_t k = 0; k < av.size(); ++k) {
+            r += (av[k] - e.values[i] * e.vectors[i][k]) * (av[k] - e.values[i] * e.vectors[i][k]);
+        }
+        ASSERT_NEAR(std::sqrt(r) / std::abs(e.values[i]), e.residuals[i], 1e-12);
+        ASSERT_LE(e.residuals[i], tolerance);
+        if(i > 0) {
+            ASSERT_GE(std::abs(e.values[i - 1]), std::abs(e.values[i]));
+        }
+    }
+}
+
+TEST(linalg_test, power_iteration) {
+    const size_t n = 12;
+    csr_matrix<double> a = second_difference(n);
+    eigen::eigenpairs<double> e = eigen::power_iteration(a, 3, eigen::options(5000, 1e-9));
+    ASSERT_TRUE(e.converged);
+    // later pairs carry the error of the ones they were deflated by
+    check_eigenpairs(a, e, 2e-9);
+    for (size_t i = 0; i < 3; ++i) {
+        ASSERT_NEAR(e.values[i], second_difference_eigenvalue(n, n - i), 1e-12);
+    }
+
+    // a column-stochastic matrix has the dominant eigenvalue 1
+    full_matrix<double> p = {{0.5, 0.2, 0.3}, {0.25, 0.6, 0.3}, {0.25, 0.2, 0.4}};
+    eigen::eigenpairs<double> rank = eigen::power_iteration(p);
+    ASSERT_TRUE(rank.converged);
+    ASSERT_NEAR(rank.values[0], 1, 1e-9);
+    for (double x : rank.vectors[0]) {
+        ASSERT_GT(x * rank.vectors[0][0], 0);
+    }
+
+    // too few iterations
+    eigen::eigenpairs<double> short_run = eigen::power_iteration(a, 1, eigen::options(3));
+    ASSERT_FALSE(short_run.converged);
+    ASSERT_EQ(short_run.products, 3);
+
+    ASSERT_THROW(eigen::power_iteration(a, 0), std::runtime_error);
+    ASSERT_THROW(eigen::power_iteration(a, n + 1), std::runtime_error);
+    ASSERT_THROW(eigen::lanczos(full_matrix<double>(2, 3)), std::runtime_error);
+}
+
+TEST(linalg_test, lanczos) {
+    // close eigenvalues: several restarts, still far fewer products than power iteration
+    const size_t n = 300;
+    csr_matrix<double> a = second_difference(n);
+    eigen::eigenpairs<double> e = eigen::lanczos(a, 4, eigen::options(1000, 1e-8));
+    ASSERT_TRUE(e.converged);
+    check_eigenpairs(a, e, 1e-8);
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_NEAR(e.values[i], second_difference_eigenvalue(n, n - i), 1e-10);
+    }
+    eigen::eigenpairs<double> slow = eigen::power_iteration(a, 1, eigen::options(e.products, 1e-8));
+    ASSERT_FALSE(slow.converged);
+
+    // largest magnitude, negative ones included, and a basis covering the matrix
+    const size_t m = 40;
+    full_matrix<double> r = random_matrix(m, m, 9);
+    full_matrix<double> s = r + r.transpose();
+    eigen::eigenpairs<double> f = eigen::lanczos(s, 5, eigen::options(100, 1e-10, m));
+    ASSERT_TRUE(f.converged);
+    check_eigenpairs(s, f, 1e-10);
+    eigen::eigenpairs<double> g = eigen::lanczos(s, 5, eigen::options(1000, 1e-10, 8));
+    ASSERT_TRUE(g.converged);
+    for (size_t i = 0; i < 5; ++i) {
+        ASSERT_NEAR(f.values[i], g.values[i], 1e-9);
+    }
+}
+
+#pragma clang diagnostic pop
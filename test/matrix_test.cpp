@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include "fixed_matrix.h"
 #include "full_matrix.h"
 #include "sparse_matrix.h"
+#include "any_expression.h"
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "cert-err58-cpp"
@@ -221,4 +226,417 @@ TEST(matrix_test, upper_triangular) {
     ASSERT_TRUE(m.isUpperTriangular());
 }
 
+TEST(matrix_test, full_contiguous_storage) {
+    full_matrix<double> m (m_h, 3, 0);
+    for (size_t i = 0; i < m.height(); ++i) {
+        for (size_t j = 0; j < m.width(); ++j) {
+            m[i][j] = double(i * 10 + j);
+        }
+    }
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(m.data()) % matrix_alignment, 0);
+    ASSERT_GE(m.stride(), m.width());
+    ASSERT_EQ((m.stride() * sizeof(double)) % matrix_alignment, 0);
+    for (size_t i = 0; i < m.height(); ++i) {
+        const double* row = m.data() + i * m.stride();
+        for (size_t j = 0; j < m.width(); ++j) {
+            ASSERT_EQ(row[j], m[i][j]);
+        }
+    }
+
+    full_matrix<double> copy(m);
+    ASSERT_EQ(copy, m);
+    ASSERT_NE(copy.data(), m.data());
+}
+
+TEST(matrix_test, blocked_dot_product_matches_lazy) {
+    const size_t n = 37, k = 301, w = 29;
+    full_matrix<double> a(n, k), b(k, w);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < k; ++j) {
+            a[i][j] = std::sin(double(i * k + j));
+        }
+    }
+    for (size_t i = 0; i < k; ++i) {
+        for (size_t j = 0; j < w; ++j) {
+            b[i][j] = std::cos(double(i * w + j)) / 3;
+        }
+    }
+
+    auto lazy = a.dotProduct(b);
+    full_matrix<double> blocked = lazy;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < w; ++j) {
+            ASSERT_EQ(blocked[i][j], lazy.get(i, j));
+        }
+    }
+
+    full_matrix<double> blocked_t = b.transpose().dotProduct(a.transpose());
+    ASSERT_EQ(blocked_t, b.transpose().dotProduct(a.transpose()));
+
+    full_matrix<int> c = {
+            {2, 5, 1},
+            {4, 3, 1}
+    };
+    full_matrix<int> cc = (c + c).dotProduct(c.transpose());
+    ASSERT_EQ(cc, (c + c).dotProduct(c.transpose()));
+}
+
+TEST(matrix_test, nested_dot_product) {
+    full_matrix<int> a = {
+            {2, 0, 1},
+            {3, 0, 0},
+            {5, 1, 1}
+    };
+
+    full_matrix<int> b = {
+            {1, 0, 1},
+            {1, 2, 1},
+            {1, 1, 0}
+    };
+
+    full_matrix<int> d = {
+            {1, 0, 0},
+            {0, 2, 0},
+            {2, 3, 1}
+    };
+
+    full_matrix<int> ab = a.dotProduct(b);
+    full_matrix<int> expected = ab.dotProduct(d);
+
+    // the inner product is evaluated once, each outer element reads it like a stored matrix
+    ASSERT_EQ(a.dotProduct(b).dotProduct(d).element_cost(), 3.0 * (1 + 1 + 1));
+    ASSERT_EQ(a.dotProduct(b).dotProduct(d), expected);
+    ASSERT_EQ(a.dotProduct(b).eval().dotProduct(d), expected);
+    ASSERT_EQ(full_matrix<int>(a.dotProduct(b).dotProduct(d)), expected);
+    ASSERT_EQ(full_matrix<int>(d.dotProduct(a.dotProduct(b))), d.dotProduct(ab));
+
+    // the inner product is evaluated with the outer one, not when it is built
+    full_matrix<int> changed = a;
+    auto inner = changed.dotProduct(b);
+    auto outer = inner.dotProduct(d);
+    changed.set(0, 0, 100);
+    ASSERT_EQ(full_matrix<int>(outer), full_matrix<int>(changed.dotProduct(b).dotProduct(d)));
+    ASSERT_FALSE(full_matrix<int>(outer) == expected);
+
+    vector<int> v = {1, 2, 3};
+    vector<int> av = a.dotProduct(v);
+    ASSERT_EQ(av, vector<int>({5, 3, 10}));
+    ASSERT_EQ(full_matrix<int>(b.dotProduct(a.dotProduct(v))), full_matrix<int>(b.dotProduct(full_matrix<int>({{5}, {3}, {10}}))));
+
+    // a temporary vector outlives the statement that built the node
+    auto kept = a.dotProduct(vector<int>{1, 2, 3});
+    auto copied = kept;
+    ASSERT_EQ(vector<int>(kept), av);
+    ASSERT_EQ(full_matrix<int>(copied), full_matrix<int>({{5}, {3}, {10}}));
+}
+
+TEST(matrix_test, parallel_evaluation) {
+    const size_t n = 300;
+    full_matrix<double> a (n, n);
+    full_matrix<double> b (n, n);
+    full_matrix<double> c (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            a[i][j] = static_cast<double>((i * 7 + j * 3) % 11) - 5;
+            b[i][j] = static_cast<double>((i * 5 + j) % 13) / 4;
+            c[i][j] = static_cast<double>(i) - static_cast<double>(j);
+        }
+    }
+
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(1);
+    full_matrix<double> serial_product = a.dotProduct(b);
+    full_matrix<double> serial = a.dotProduct(b) + c * 0.5;
+    sparse_matrix<double> serial_sparse = c * 0.5 - a;
+
+    parallel::set_concurrency(4);
+    ASSERT_EQ(full_matrix<double>(a.dotProduct(b)), serial_product);
+    ASSERT_EQ(full_matrix<double>(a.dotProduct(b) + c * 0.5), serial);
+    ASSERT_EQ(sparse_matrix<double>(c * 0.5 - a), serial_sparse);
+
+    // loops nested inside tasks and exceptions thrown by them
+    std::vector<size_t> sums(64);
+    parallel::for_range(0, sums.size(), 1, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            std::atomic<size_t> sum(0);
+            parallel::for_range(0, 1000, 10, [&](size_t lo, size_t hi) {
+                for (size_t k = lo; k < hi; ++k) {
+                    sum += k;
+                }
+            });
+            sums[i] = sum;
+        }
+    });
+    ASSERT_EQ(sums, std::vector<size_t>(64, 499500));
+    ASSERT_THROW(parallel::for_range(0, 100, 1, [](size_t first, size_t) {
+        if(first > 50) {
+            throw std::runtime_error("chunk failed");
+        }
+    }), std::runtime_error);
+
+    parallel::set_concurrency(threads);
+}
+
+TEST(matrix_test, simd_kernels) {
+    const size_t h = 37;
+    const size_t w = 53;
+    full_matrix<double> a (h, w);
+    full_matrix<double> b (h, w);
+    full_matrix<float> f (h, w);
+    double max = -1e9;
+    double sum = 0;
+    double squares = 0;
+    for (size_t i = 0; i < h; ++i) {
+        for (size_t j = 0; j < w; ++j) {
+            a[i][j] = static_cast<double>((i * 7 + j * 3) % 11) - 5.5;
+            b[i][j] = static_cast<double>(i) / 4 - static_cast<double>(j);
+            f[i][j] = static_cast<float>(a[i][j] / 2);
+            max = std::max(max, b.get(i, j));
+            sum += a.get(i, j);
+            squares += f.get(i, j) * f.get(i, j);
+        }
+    }
+
+    simd::isa detected = simd::active_isa();
+    for (simd::isa level : {simd::isa::scalar, simd::isa::sse2, simd::isa::avx2, simd::isa::avx512}) {
+        simd::set_isa(level);
+        full_matrix<double> sum_ab = a + b;
+        full_matrix<double> diff_ab = a - b;
+        full_matrix<double> scaled = a * 0.75;
+        full_matrix<float> scaled_f = f * 3.0f;
+        full_matrix<double> a_t = a.transpose();
+        full_matrix<float> f_t = f.transpose();
+        for (size_t i = 0; i < h; ++i) {
+            for (size_t j = 0; j < w; ++j) {
+                ASSERT_EQ(sum_ab.get(i, j), a.get(i, j) + b.get(i, j));
+                ASSERT_EQ(diff_ab.get(i, j), a.get(i, j) - b.get(i, j));
+                ASSERT_EQ(scaled.get(i, j), a.get(i, j) * 0.75);
+                ASSERT_EQ(scaled_f.get(i, j), f.get(i, j) * 3.0f);
+                ASSERT_EQ(a_t.get(j, i), a.get(i, j));
+                ASSERT_EQ(f_t.get(j, i), f.get(i, j));
+            }
+        }
+        ASSERT_EQ(b.infinityNorm(), max);
+        ASSERT_NEAR(a.singleNorm(), sum, 1e-9);
+        ASSERT_NEAR(f.twoNorm(), std::sqrt(squares), 1e-9);
+    }
+    simd::set_isa(detected);
+    ASSERT_EQ(simd::active_isa(), detected);
+}
+
+TEST(matrix_test, static_dispatch) {
+    full_matrix<int> a = {
+            {2, 0, 1},
+            {3, 0, 0},
+            {5, 1, 1}
+    };
+
+    full_matrix<int> b = {
+            {1, 0, 1},
+            {1, 2, 1},
+            {1, 1, 0}
+    };
+
+    ASSERT_FALSE(std::is_polymorphic<decltype(a + b * 2 - a)>::value);
+    ASSERT_FALSE(std::is_polymorphic<decltype(a.dotProduct(b).transpose())>::value);
+
+    full_matrix<int> fused = a + b * 2 - a;
+    ASSERT_EQ(fused, b * 2);
+
+    std::vector<any_expression<int>> erased = {a, b * 2, a.transpose()};
+    ASSERT_EQ(erased[0], a);
+    ASSERT_EQ(erased[1], b + b);
+    ASSERT_EQ(full_matrix<int>(erased[2]), a.transpose());
+    ASSERT_EQ(full_matrix<int>(erased[1] + erased[0]), a + b * 2);
+}
+
+TEST(matrix_test, fixed_size) {
+    using mat3 = fixed_matrix<double, 3, 3>;
+    ASSERT_TRUE(std::is_trivially_copyable<mat3>::value);
+    ASSERT_EQ(sizeof(mat3), 9 * sizeof(double));
+    ASSERT_FALSE(std::is_polymorphic<mat3>::value);
+    static_assert(mat3::height() == 3 && mat3::width() == 3, "dimensions are constant expressions");
+
+    mat3 a ({{{{2, 0, 1}}, {{3, 0, 0}}, {{5, 1, 1}}}});
+    fixed_matrix<double, 3, 2> b ({{{{1, 0}}, {{1, 2}}, {{1, 1}}}});
+    full_matrix<double> full_a = a;
+    full_matrix<double> full_b = b;
+
+    fixed_matrix<double, 3, 2> ab = a.dotProduct(b);
+    ASSERT_EQ(ab, full_a.dotProduct(full_b));
+    fixed_matrix<double, 2, 3> bt = b.transpose();
+    ASSERT_EQ(bt, full_b.transpose());
+    ASSERT_EQ(mat3::identity().dotProduct(a), a);
+
+    // composes with the lazy operators and with dynamic matrices
+    mat3 sum = a + a * 2.0 - mat3::identity();
+    ASSERT_EQ(sum, full_a * 3.0 - full_matrix<double>::identity(3));
+    ASSERT_EQ(full_matrix<double>(full_a.dotProduct(b)), full_a.dotProduct(full_b));
+    ASSERT_EQ(full_matrix<double>(a.dotProduct(full_b)), full_a.dotProduct(full_b));
+    ab += a.dotProduct(b);
+    ab *= 0.5;
+    ASSERT_EQ(ab, full_a.dotProduct(full_b));
+    mat3 c = a;
+    c = c.dotProduct(c);
+    ASSERT_EQ(c, full_a.dotProduct(full_a));
+
+    ASSERT_EQ(a.infinityNorm(), full_a.infinityNorm());
+    ASSERT_DOUBLE_EQ(a.twoNorm(), full_a.twoNorm());
+    ASSERT_DOUBLE_EQ(a.singleNorm(), full_a.singleNorm());
+}
+
+TEST(matrix_test, in_place_assignment) {
+    full_matrix<int> a = {
+            {2, 0, 1},
+            {3, 0, 0},
+            {5, 1, 1}
+    };
+    full_matrix<int> b = {
+            {1, 0, 1},
+            {1, 2, 1},
+            {1, 1, 0}
+    };
+    full_matrix<int> expected = a;
+
+    // element-wise reads of the destination evaluate straight into its buffer
+    full_matrix<int> x = a;
+    const int* buffer = x.data();
+    x += b;
+    expected = a + b;
+    ASSERT_EQ(x, expected);
+    x -= b * 2;
+    x *= 3;
+    ASSERT_EQ(x, (a - b) * 3);
+    x = x * 2 + a - x;
+    ASSERT_EQ(x, (a - b) * 3 + a);
+    x.assign(a);
+    ASSERT_EQ(x, a);
+    ASSERT_EQ(x.data(), buffer);
+
+    // reads of other positions go through a temporary
+    x = x.transpose();
+    ASSERT_EQ(x, a.transpose());
+    x = a;
+    x = x.dotProduct(b);
+    ASSERT_EQ(x, a.dotProduct(b));
+    x = a;
+    x += x.dotProduct(x);
+    ASSERT_EQ(x, a + a.dotProduct(a));
+    x = a;
+    x = b.dotProduct(x) + x.transpose();
+    ASSERT_EQ(x, b.dotProduct(a) + a.transpose());
+
+    // products into an existing buffer do not add to its old value
+    x = a;
+    x.assign(a.dotProduct(b));
+    ASSERT_EQ(x, a.dotProduct(b));
+    ASSERT_EQ(x.data(), buffer);
+    full_matrix<int> column (3, 1, 7);
+    column = a.dotProduct(vector<int>{1, 1, 1});
+    ASSERT_EQ(column, full_matrix<int>({{3}, {3}, {7}}));
+
+    // shapes that differ reallocate
+    full_matrix<int> row (1, 3);
+    row = a.dotProduct(b).transpose();
+    ASSERT_EQ(row, a.dotProduct(b).transpose());
+    ASSERT_EQ(row.height(), 3);
+
+    sparse_matrix<int> s (3, 3);
+    s += a;
+    s -= b;
+    ASSERT_EQ(s, a - b);
+    s.assign(s.dotProduct(s));
+    ASSERT_EQ(s, (a - b).dotProduct(a - b));
+    s *= 0;
+    ASSERT_EQ(s.nnz(), 0);
+}
+
+TEST(matrix_test, views) {
+    full_matrix<int> a = {
+            {1, 2, 3, 4},
+            {5, 6, 7, 8},
+            {9, 10, 11, 12},
+            {13, 14, 15, 16}
+    };
+    const full_matrix<int>& ca = a;
+
+    ASSERT_EQ(a.block(1, 1, 2, 3), full_matrix<int>({{6, 7, 8}, {10, 11, 12}}));
+    ASSERT_EQ(a.row_view(2), full_matrix<int>({{9, 10, 11, 12}}));
+    ASSERT_EQ(ca.column_view(1), full_matrix<int>({{2}, {6}, {10}, {14}}));
+    ASSERT_EQ(a.diagonal(), full_matrix<int>({{1}, {6}, {11}, {16}}));
+    ASSERT_EQ(a.strided(0, 1, 2, 2, 2, 2), full_matrix<int>({{2, 4}, {10, 12}}));
+    ASSERT_EQ(a.block(1, 0, 3, 3).diagonal(), full_matrix<int>({{5}, {10}, {15}}));
+    ASSERT_EQ(a.block(0, 0, 2, 2).transpose(), full_matrix<int>({{1, 5}, {2, 6}}));
+    ASSERT_EQ(a.block(2, 2, 2, 2).data(), a.data() + 2 * a.stride() + 2);
+    ASSERT_EQ(a.block(0, 0, 2, 2) + a.block(2, 2, 2, 2) * 2, full_matrix<int>({{23, 26}, {35, 38}}));
+
+    // writes go to the viewed matrix
+    full_matrix<int> x = a;
+    x.row_view(0) = x.row_view(3);
+    x.diagonal() *= 0;
+    x.block(2, 0, 2, 2) += full_matrix<int>::identity(2);
+    x.column_view(3)[1][0] = -1;
+    ASSERT_EQ(x, full_matrix<int>({{0, 14, 15, 16}, {5, 0, 7, -1}, {10, 10, 0, 12}, {13, 15, 15, 0}}));
+
+    // overlapping reads of the destination go through a temporary
+    x = a;
+    x.block(1, 1, 3, 3) = x.block(0, 0, 3, 3);
+    ASSERT_EQ(x, full_matrix<int>({{1, 2, 3, 4}, {5, 1, 2, 3}, {9, 5, 6, 7}, {13, 9, 10, 11}}));
+    x = a;
+    x.block(0, 0, 2, 2) = x.block(0, 0, 2, 2).transpose();
+    ASSERT_EQ(x.block(0, 0, 2, 2), full_matrix<int>({{1, 5}, {2, 6}}));
+    x = a;
+    x = x.block(1, 1, 2, 2);
+    ASSERT_EQ(x, full_matrix<int>({{6, 7}, {10, 11}}));
+
+    // blocks that only interleave in memory do not overlap
+    ASSERT_EQ(alias_of(x.block(0, 2, 4, 2), alias_target_of(x.block(0, 0, 4, 2))), aliasing::none);
+    ASSERT_EQ(alias_of(x.block(0, 0, 4, 2), alias_target_of(x.block(0, 2, 4, 2))), aliasing::none);
+    ASSERT_EQ(alias_of(x.block(2, 1, 2, 2), alias_target_of(x.block(0, 1, 2, 3))), aliasing::none);
+    ASSERT_EQ(alias_of(x.strided(0, 1, 4, 2, 1, 2), alias_target_of(x.strided(0, 0, 4, 2, 1, 2))), aliasing::none);
+    ASSERT_EQ(alias_of(x.block(1, 1, 2, 2), alias_target_of(x.block(0, 0, 2, 2))), aliasing::other);
+    ASSERT_EQ(alias_of(x.block(0, 1, 4, 2), alias_target_of(x.block(0, 0, 4, 2))), aliasing::other);
+    x = a;
+    full_matrix<int> updated = x.block(0, 0, 2, 2) + x.block(0, 2, 2, 2).dotProduct(x.block(2, 2, 2, 2));
+    x.block(0, 0, 2, 2) += x.block(0, 2, 2, 2).dotProduct(x.block(2, 2, 2, 2));
+    ASSERT_EQ(x.block(0, 0, 2, 2), updated);
+    ASSERT_EQ(x.block(0, 2, 4, 2), a.block(0, 2, 4, 2));
+
+    // tiled products accumulate in place
+    full_matrix<double> c (64, 64);
+    full_matrix<double> p (64, 64);
+    for (size_t i = 0; i < 64; ++i) {
+        for (size_t j = 0; j < 64; ++j) {
+            p[i][j] = static_cast<double>((i * 3 + j * 5) % 7) - 3;
+        }
+    }
+    full_matrix<double> expected = p.dotProduct(p);
+    for (size_t i = 0; i < 64; i += 32) {
+        for (size_t j = 0; j < 64; j += 32) {
+            for (size_t k = 0; k < 64; k += 32) {
+                c.block(i, j, 32, 32) += p.block(i, k, 32, 32).dotProduct(p.block(k, j, 32, 32));
+            }
+        }
+    }
+    ASSERT_EQ(c, expected);
+    c.block(0, 0, 32, 64) -= p.block(0, 0, 32, 64).dotProduct(p);
+    ASSERT_EQ(c.block(0, 0, 32, 64), full_matrix<double>(32, 64));
+    expected = p.dotProduct(p.transpose());
+    c.block(0, 0, 32, 64) = p.block(0, 0, 32, 64).dotProduct(p.block(0, 0, 64, 64).transpose());
+    ASSERT_EQ(c.block(0, 0, 32, 64), expected.block(0, 0, 32, 64));
+    c.strided(1, 0, 32, 32, 2, 2) = p.strided(1, 0, 32, 64, 2, 1).dotProduct(p.strided(0, 0, 64, 32, 1, 2).transpose().transpose());
+    ASSERT_EQ(c.strided(1, 0, 32, 32, 2, 2), full_matrix<double>(p.dotProduct(p)).strided(1, 0, 32, 32, 2, 2));
+
+    // sparse matrices are viewed through get() and set()
+    sparse_matrix<int> s = a;
+    ASSERT_EQ(s.block(1, 1, 2, 3), a.block(1, 1, 2, 3));
+    ASSERT_EQ(s.block(1, 0, 3, 3).diagonal(), a.block(1, 0, 3, 3).diagonal());
+    s.row_view(0) = a.row_view(1) - a.row_view(1);
+    s.column_view(0) = s.column_view(1);
+    ASSERT_EQ(s.nnz(), 12);
+    ASSERT_EQ(s.column_view(0), full_matrix<int>({{0}, {6}, {10}, {14}}));
+    const csr_matrix<int> csr (a);
+    ASSERT_EQ(csr.strided(1, 0, 2, 2, 2, 3), full_matrix<int>({{5, 8}, {13, 16}}));
+}
+
 #pragma clang diagnostic pop
\ No newline at end of file
@@ -0,0 +1,401 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <tuple>
+#include "compressed_matrix.h"
+#include "coo_builder.h"
+#include "full_matrix.h"
+#include "sparse_matrix.h"
+
+#pragma clang diagnostic push
+#pragma ide diagnostic ignored "cert-err58-cpp"
+
+constexpr size_t m_size = 5;
+
+static sparse_matrix<int> sample() {
+    sparse_matrix<int> m (4, 5);
+    m[0][1] = 3;
+    m[0][4] = -1;
+    m[2][0] = 7;
+    m[3][2] = 2;
+    m[3][4] = 5;
+    return m;
+}
+
+// missing entries read as 5, not 0
+static sparse_matrix<int> with_default() {
+    sparse_matrix<int> m (3, 3, 5);
+    m[0][0] = 1;
+    return m;
+}
+
+TEST(sparse_test, compressed_from_sparse) {
+    sparse_matrix<int> m = sample();
+    csr_matrix<int> csr (m);
+    csc_matrix<int> csc (m);
+
+    ASSERT_EQ(csr.nnz(), 5);
+    ASSERT_EQ(csc.nnz(), 5);
+    ASSERT_EQ(csr.offsets(), std::vector<size_t>({0, 2, 2, 3, 5}));
+    ASSERT_EQ(csr.indices(), std::vector<size_t>({1, 4, 0, 2, 4}));
+    ASSERT_EQ(csc.offsets(), std::vector<size_t>({0, 1, 2, 3, 3, 5}));
+    ASSERT_EQ(csc.indices(), std::vector<size_t>({2, 0, 3, 0, 3}));
+    ASSERT_EQ(csr, m);
+    ASSERT_EQ(csc, m);
+    ASSERT_EQ(csc_matrix<int>(csr), m);
+    ASSERT_EQ(csr_matrix<int>(csc), m);
+    ASSERT_EQ(sparse_matrix<int>(csr), m);
+
+    // a non-zero default is stored wherever nothing else is
+    sparse_matrix<int> d = with_default();
+    ASSERT_EQ(csr_matrix<int>(d).nnz(), 9);
+    ASSERT_EQ(csr_matrix<int>(d), full_matrix<int>({{1, 5, 5}, {5, 5, 5}, {5, 5, 5}}));
+    ASSERT_EQ(csc_matrix<int>(d), d);
+}
+
+TEST(sparse_test, compressed_algebra) {
+    sparse_matrix<int> m = sample();
+    full_matrix<int> dense (m);
+    csr_matrix<int> csr (dense);
+
+    ASSERT_EQ(csr.nnz(), 5);
+    ASSERT_EQ(csr + csr, dense * 2);
+    ASSERT_EQ(csr.transpose(), dense.transpose());
+    ASSERT_EQ(full_matrix<int>(csr.dotProduct(dense.transpose())), dense.dotProduct(dense.transpose()));
+    ASSERT_EQ(csr_matrix<int>::identity(4).dotProduct(csr), dense);
+
+    csr[1][3] = 4;
+    csr[0][1] = 0;
+    csr[0][4] = 6;
+    dense[1][3] = 4;
+    dense[0][1] = 0;
+    dense[0][4] = 6;
+    ASSERT_EQ(csr.nnz(), 5);
+    ASSERT_EQ(csr, dense);
+
+    // assignment and in-place updates rebuild the arrays
+    csr += csr;
+    ASSERT_EQ(csr, dense * 2);
+    csr *= 0;
+    ASSERT_EQ(csr.nnz(), 0);
+    csr = dense;
+    csr_matrix<int> copy (4, 4);
+    copy = csr;
+    ASSERT_EQ(copy, dense);
+    csc_matrix<int> csc (dense);
+    csc -= csr;
+    ASSERT_EQ(csc.nnz(), 0);
+    csc = csr.transpose();
+    ASSERT_EQ(csc, dense.transpose());
+
+    sparse_matrix<int> s (1, 1);
+    s = m * 2;
+    ASSERT_EQ(s, full_matrix<int>(m) * 2);
+    s = m;
+    ASSERT_EQ(s, m);
+}
+
+TEST(sparse_test, coo_assembly) {
+    coo_builder<int> builder (4, 5);
+    builder.insert(3, 4, 2);
+    builder.insert(0, 1, 3);
+    builder.insert(3, 4, 3);
+    builder.insert(1, 1, 0);
+    builder.insert(2, 0, 7);
+    builder.insert(0, 4, -1);
+    builder.insert(3, 2, 4);
+    builder.insert(1, 3, 1);
+    builder.insert(3, 2, -2);
+    builder.insert(1, 3, -1);
+    ASSERT_EQ(builder.size(), 10);
+
+    csr_matrix<int> m = builder.build();
+    ASSERT_EQ(m.nnz(), 5);
+    ASSERT_EQ(m, sample());
+    ASSERT_EQ(builder.size(), 0);
+}
+
+TEST(sparse_test, coo_parallel_assembly) {
+    const size_t n = 200;
+    const size_t threads = 4;
+    coo_builder<double> builder (n, n);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&builder, t, n, threads]() {
+            coo_builder<double>::batch entries;
+            for (size_t i = t; i < n; i += threads) {
+                entries.push_back({i, i, 1.0});
+                entries.push_back({i, (i + 1) % n, 0.5});
+                entries.push_back({i, i, 1.0});
+            }
+            builder.insert(std::move(entries));
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    csr_matrix<double> m = builder.build();
+    ASSERT_EQ(m.nnz(), 2 * n);
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_EQ(m.get(i, i), 2.0);
+        ASSERT_EQ(m.get(i, (i + 1) % n), 0.5);
+    }
+}
+
+TEST(sparse_test, sparse_products) {
+    const size_t n = 1000;
+    const size_t k = 200;
+    coo_builder<double> builder (n, k);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = i % 7; j < k; j += 7 + i % 5) {
+            builder.insert(i, j, std::sin(double(i + 3 * j)));
+        }
+    }
+    csr_matrix<double> csr = builder.build();
+    csc_matrix<double> csc (csr);
+    sparse_matrix<double> map (csr);
+    full_matrix<double> dense (csr);
+    full_matrix<double> b (k, 9);
+    for (size_t i = 0; i < k; ++i) {
+        for (size_t j = 0; j < b.width(); ++j) {
+            b[i][j] = std::cos(double(i * b.width() + j));
+        }
+    }
+    vector<double> x (k);
+    for (size_t i = 0; i < k; ++i) {
+        x[i] = 1.0 / (i + 1);
+    }
+
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(4);
+
+    vector<double> expected_y = dense.dotProduct(x);
+    full_matrix<double> expected_c = dense.dotProduct(b);
+    for (size_t i = 0; i < n; ++i) {
+        double val = 0;
+        for (size_t j = 0; j < k; ++j) {
+            val += dense[i][j] * x[j];
+        }
+        ASSERT_DOUBLE_EQ(expected_y[i], val);
+    }
+
+    ASSERT_EQ(vector<double>(csr.dotProduct(x)), expected_y);
+    ASSERT_EQ(vector<double>(csc.dotProduct(x)), expected_y);
+    ASSERT_EQ(vector<double>(map.dotProduct(x)), expected_y);
+    ASSERT_EQ(full_matrix<double>(csr.dotProduct(x)), full_matrix<double>(dense.dotProduct(x)));
+
+    ASSERT_EQ(full_matrix<double>(csr.dotProduct(b)), expected_c);
+    ASSERT_EQ(full_matrix<double>(csc.dotProduct(b)), expected_c);
+    ASSERT_EQ(full_matrix<double>(map.dotProduct(b)), expected_c);
+    ASSERT_EQ(full_matrix<double>(csr.dotProduct(b * 2.0)), full_matrix<double>(expected_c * 2.0));
+
+    // missing entries that read as 5 take part too
+    sparse_matrix<int> d = with_default();
+    full_matrix<int> dense_d (d);
+    ASSERT_EQ(vector<int>(d.dotProduct(vector<int>{1, 1, 1})), vector<int>({11, 15, 15}));
+    full_matrix<int> ones (3, 2, 1);
+    ASSERT_EQ(full_matrix<int>(d.dotProduct(ones)), dense_d.dotProduct(ones));
+    ASSERT_EQ(full_matrix<int>(d.dotProduct(ones)).get(1, 0), 15);
+
+    parallel::set_concurrency(threads);
+}
+
+TEST(sparse_test, sparse_sparse_product) {
+    const size_t n = 6000;
+    coo_builder<int> builder (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        builder.insert(i, (i + 1) % n, 1);
+        builder.insert(i, (i * 7) % n, 2);
+        builder.insert((i * 13) % n, i, -1);
+    }
+    csr_matrix<int> a = builder.build();
+
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(1);
+    csr_matrix<int> expected = a.dotProduct(a);
+    parallel::set_concurrency(3);
+
+    for (size_t i = 0; i < n; i += 997) {
+        for (size_t j = 0; j < n; j += 1499) {
+            ASSERT_EQ(expected.get(i, j), a.dotProduct(a).get(i, j));
+        }
+        size_t j = (i * 7 * 7) % n;
+        ASSERT_EQ(expected.get(i, j), a.dotProduct(a).get(i, j));
+    }
+
+    csr_matrix<int> csr = a.dotProduct(a);
+    ASSERT_EQ(csr.offsets(), expected.offsets());
+    ASSERT_EQ(csr.indices(), expected.indices());
+    ASSERT_EQ(csr.values(), expected.values());
+
+    sparse_matrix<int> map (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t k = a.offsets()[i]; k < a.offsets()[i + 1]; ++k) {
+            map[i][a.indices()[k]] = a.values()[k];
+        }
+    }
+    sparse_matrix<int> map_product = map.dotProduct(map);
+    ASSERT_EQ(csr_matrix<int>(map_product).values(), expected.values());
+
+    csc_matrix<int> csc = csc_matrix<int>(a).dotProduct(map);
+    ASSERT_EQ(csr_matrix<int>(csc).values(), expected.values());
+
+    parallel::set_concurrency(threads);
+
+    // entries that cancel out are dropped
+    csr_matrix<int> b = full_matrix<int>({{1, 1}, {1, -1}});
+    csr_matrix<int> c = full_matrix<int>({{1, 0}, {1, 0}});
+    csr_matrix<int> bc = b.dotProduct(c);
+    ASSERT_EQ(bc.nnz(), 1);
+    ASSERT_EQ(bc, full_matrix<int>({{2, 0}, {0, 0}}));
+}
+
+TEST(sparse_test, sparse_elementwise_algebra) {
+    sparse_matrix<int> m = sample();
+    full_matrix<int> dense (m);
+    csr_matrix<int> csr (m);
+    csc_matrix<int> csc (m);
+    csr_matrix<int> other = full_matrix<int>({{0, -3, 1, 0, 0}, {0, 0, 0, 0, 0}, {0, 0, 0, 0, 4}, {0, 0, 0, 0, 0}});
+
+    csr_matrix<int> sum = csr + other;
+    ASSERT_EQ(sum.nnz(), 6);
+    ASSERT_EQ(sum, full_matrix<int>(dense + full_matrix<int>(other)));
+    csr_matrix<int> diff = csc - m;
+    ASSERT_EQ(diff.nnz(), 0);
+    ASSERT_EQ(diff.offsets(), std::vector<size_t>(5, 0));
+    ASSERT_EQ(csr_matrix<int>(csr * 3), full_matrix<int>(dense * 3));
+    ASSERT_EQ(csr_matrix<int>(csr * 0).nnz(), 0);
+
+    csr_matrix<int> t = csc.transpose();
+    ASSERT_EQ(t.height(), 5);
+    ASSERT_EQ(t, dense.transpose());
+    ASSERT_EQ(csr_matrix<int>(csr.transpose()), t);
+    ASSERT_EQ(csr_matrix<int>(m.transpose()), t);
+
+    csr_matrix<int> nested = (csr * 2 - other).transpose().dotProduct(csr + csc);
+    full_matrix<int> expected = full_matrix<int>(dense * 2 - full_matrix<int>(other)).transpose().dotProduct(dense * 2);
+    ASSERT_EQ(nested, expected);
+    ASSERT_EQ(sparse_matrix<int>((csr + other) * 2), full_matrix<int>((dense + full_matrix<int>(other)) * 2));
+
+    // operands with a non-zero default contribute their missing entries too
+    sparse_matrix<int> d = with_default();
+    full_matrix<int> full (d);
+    ASSERT_EQ(sparse_matrix<int>(d + d).get(1, 1), 10);
+    ASSERT_EQ(sparse_matrix<int>(d.transpose()).get(1, 0), 5);
+    ASSERT_EQ(full_matrix<int>(csr_matrix<int>(d - d * 2)), full * -1);
+    ASSERT_EQ(full_matrix<int>(sparse_matrix<int>(d.transpose().dotProduct(d))), full.transpose().dotProduct(full));
+
+    // in-place updates keep the default, storing whatever differs from it
+    sparse_matrix<int> s (2, 2, 5);
+    s.set(0, 0, 1);
+    s -= s;
+    ASSERT_EQ(full_matrix<int>(s), full_matrix<int>(2, 2, 0));
+    ASSERT_EQ(s.nnz(), 4);
+    s.set(1, 1, 5);
+    ASSERT_EQ(s.nnz(), 3);
+    d *= 0;
+    ASSERT_EQ(full_matrix<int>(d), full_matrix<int>(3, 3, 0));
+    d += full * 2;
+    ASSERT_EQ(full_matrix<int>(d), full * 2);
+    ASSERT_EQ(d.nnz(), 9);
+
+    // large enough to split the merge across threads
+    const size_t n = 20000;
+    coo_builder<double> a_builder (n, n);
+    coo_builder<double> b_builder (n, n);
+    for (size_t i = 0; i < n; ++i) {
+        a_builder.insert(i, i, 1.0);
+        a_builder.insert(i, (i * 7) % n, 2.0);
+        b_builder.insert(i, i, -1.0);
+        b_builder.insert(i, (i + 1) % n, 3.0);
+    }
+    csr_matrix<double> a = a_builder.build();
+    csr_matrix<double> b = b_builder.build();
+    size_t threads = parallel::concurrency();
+    parallel::set_concurrency(4);
+    csr_matrix<double> ab = a + b;
+    parallel::set_concurrency(threads);
+    for (size_t i = 0; i < n; i += 331) {
+        ASSERT_EQ(ab.get(i, i), i == 0 ? 2.0 : 0.0);
+        ASSERT_EQ(ab.get(i, (i + 1) % n), a.get(i, (i + 1) % n) + 3.0);
+        ASSERT_EQ(ab.get(i, (i * 7) % n), a.get(i, (i * 7) % n) + b.get(i, (i * 7) % n));
+    }
+    ASSERT_EQ(ab.nnz(), 2 * n);
+}
+
+TEST(sparse_test, nonzero_iteration) {
+    sparse_matrix<int> m = sample();
+    csr_matrix<int> csr (m);
+    csc_matrix<int> csc (m);
+
+    std::vector<std::tuple<size_t, size_t, int>> visited;
+    for (const matrix_entry<int>& e : csr.nonzeros()) {
+        visited.emplace_back(e.row, e.col, e.value);
+    }
+    std::vector<std::tuple<size_t, size_t, int>> expected = {
+            std::make_tuple(0, 1, 3), std::make_tuple(0, 4, -1), std::make_tuple(2, 0, 7),
+            std::make_tuple(3, 2, 2), std::make_tuple(3, 4, 5)
+    };
+    ASSERT_EQ(visited, expected);
+
+    visited.clear();
+    for (const matrix_entry<int>& e : m.nonzeros()) {
+        visited.emplace_back(e.row, e.col, e.value);
+    }
+    ASSERT_EQ(visited, expected);
+
+    visited.clear();
+    for (const matrix_entry<int>& e : csc.nonzeros()) {
+        visited.emplace_back(e.row, e.col, e.value);
+    }
+    std::sort(visited.begin(), visited.end());
+    ASSERT_EQ(visited, expected);
+
+    csr_matrix<int> empty (4, 4);
+    ASSERT_TRUE(empty.nonzeros().begin() == empty.nonzeros().end());
+}
+
+TEST(sparse_test, sparse_reductions) {
+    sparse_matrix<int> m = sample();
+    full_matrix<int> dense (m);
+    csr_matrix<int> csr (m);
+    csc_matrix<int> csc (m);
+
+    ASSERT_EQ(m.infinityNorm(), dense.infinityNorm());
+    ASSERT_EQ(csr.infinityNorm(), 7);
+    ASSERT_EQ(csc.twoNorm(), dense.twoNorm());
+    ASSERT_EQ(csr.singleNorm(), dense.singleNorm());
+    ASSERT_EQ(full_matrix<int>(2, 2, -3).infinityNorm(), -3);
+    ASSERT_EQ(csr_matrix<int>(full_matrix<int>(2, 2, -3)).infinityNorm(), -3);
+    ASSERT_EQ(csr_matrix<int>(full_matrix<int>({{-3, 0}, {-1, -3}})).infinityNorm(), 0);
+
+    sparse_matrix<int> sym (m_size, m_size);
+    sym[0][0] = 1;
+    sym[1][3] = 2;
+    sym[3][1] = 2;
+    ASSERT_TRUE(sym.isSymmetric());
+    ASSERT_FALSE(sym.isDiagonal());
+    ASSERT_FALSE(sym.isLowerTriangular());
+    sym[4][2] = 5;
+    ASSERT_FALSE(sym.isSymmetric());
+    ASSERT_FALSE(csc_matrix<int>(sym).isSymmetric());
+    sym[3][1] = 0;
+    ASSERT_FALSE(csr_matrix<int>(sym).isUpperTriangular());
+    ASSERT_TRUE(sparse_matrix<int>::identity(m_size).isDiagonal());
+    ASSERT_TRUE(csr_matrix<int>::identity(m_size).isLowerTriangular());
+    ASSERT_TRUE(csc_matrix<int>::identity(m_size).isUpperTriangular());
+
+    // missing entries read as the default, so every entry counts
+    sparse_matrix<int> d = with_default();
+    full_matrix<int> full (d);
+    ASSERT_EQ(d.infinityNorm(), 5);
+    ASSERT_EQ(d.twoNorm(), full.twoNorm());
+    ASSERT_EQ(d.singleNorm(), full.singleNorm());
+    ASSERT_NEAR(d.twoNorm(), 14.18, 0.01);
+    ASSERT_FALSE(d.isDiagonal());
+    ASSERT_FALSE(d.isLowerTriangular());
+    ASSERT_FALSE(d.isUpperTriangular());
+    ASSERT_TRUE(d.isSymmetric());
+}
+
+#pragma clang diagnostic pop